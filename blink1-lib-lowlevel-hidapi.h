@@ -16,7 +16,7 @@ int blink1_enumerateByVidPid(int vid, int pid)
     int p = 0; 
     devs = hid_enumerate(vid, pid);
     cur_dev = devs;    
-    while (cur_dev) {
+    while (cur_dev && p < cache_max) {
         if( (cur_dev->vendor_id != 0 && cur_dev->product_id != 0) &&  
             (cur_dev->vendor_id == vid && cur_dev->product_id == pid) ) { 
             if( cur_dev->serial_number != NULL ) { // can happen if not root
@@ -34,6 +34,8 @@ int blink1_enumerateByVidPid(int vid, int pid)
                 else if( serialnum >= blink1mk2_serialstart ) {
                     blink1_infos[p].type = BLINK1_MK2;
                 }
+                blink1_infos[p].fwversion = 0; // unknown until probed
+                blink1_infos[p].caps = blink1_capsFor( blink1_infos[p].type, 0 );
                 p++;
             }
         }
@@ -47,6 +49,7 @@ int blink1_enumerateByVidPid(int vid, int pid)
             i, blink1_infos[i].serial);
     }
     blink1_cached_count = p;
+    blink1_cache_fromfile = 0;
     blink1_sortCache();
 
     return p;
@@ -62,6 +65,18 @@ blink1_device* blink1_openByPath(const char* path)
     blink1_device* handle = hid_open_path( path ); 
 
     int i = blink1_getCacheIndexByPath( path );
+    if( handle && i >= 0 && blink1_cache_fromfile ) { // cache may be stale
+        wchar_t wserialstr[serialstrmax] = {L'\0'};
+        char serialstr[serialstrmax] = "";
+        hid_get_serial_number_string( handle, wserialstr, serialstrmax );
+        snprintf(serialstr, sizeof(serialstr), "%ls", wserialstr);
+        if( strcmp( serialstr, blink1_infos[i].serial ) != 0 ) {
+            LOG("blink1_openByPath: expected serial %s, got %s\n",
+                blink1_infos[i].serial, serialstr);
+            hid_close( handle );
+            handle = NULL;
+        }
+    }
     if( i >= 0 ) {  // good
         blink1_infos[i].dev = handle;
     }
@@ -80,6 +95,13 @@ blink1_device* blink1_openBySerial(const char* serial)
     
     LOG("blink1_openBySerial: %s at vid/pid %x/%x\n", serial, vid,pid);
 
+    // if we already know where it is, skip hid_open()'s enumeration
+    int ci = blink1_getCacheIndexBySerial( serial );
+    if( ci >= 0 ) {
+        blink1_device* handle = blink1_openByPath( blink1_infos[ci].path );
+        if( handle ) return handle;
+    }
+
     wchar_t wserialstr[serialstrmax] = {L'\0'};
 #ifdef _WIN32   // omg windows you suck
     swprintf( wserialstr, serialstrmax, L"%S", serial); // convert to wchar_t*
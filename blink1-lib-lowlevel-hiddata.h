@@ -65,7 +65,12 @@ int blink1_enumerateByVidPid(int vid, int pid)
     hid_free_enumeration(devs);
 */
     
+    for( int i=0; i<p; i++ ) {
+        blink1_infos[i].fwversion = 0; // unknown until probed
+        blink1_infos[i].caps = blink1_capsFor( blink1_infos[i].type, 0 );
+    }
     blink1_cached_count = p;
+    blink1_cache_fromfile = 0;
 
     blink1_sortCache();
 
@@ -14,6 +14,8 @@
 #include <stdarg.h>
 #include <ctype.h>  // for toupper()
 #include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -22,6 +24,14 @@
 //#include <unistd.h>    // for usleep()
 #endif
 
+// devices are probed concurrently where we have threads & many devices
+#if !defined(_WIN32) && !USE_HIDDATA
+#define BLINK1_PROBE_THREADS 1
+#include <pthread.h>
+#include <errno.h>
+#include <sys/time.h>
+#endif
+
 #include "blink1-lib.h"
 
 int msg_quiet = 0;
@@ -33,10 +43,13 @@ typedef struct blink1_info_ {
     char path[pathstrmax];  // platform-specific device path
     char serial[serialstrmax];
     int type;  // from blink1types
+    int fwversion; // 0 if not probed yet, -1 if probe failed
+    int caps;  // from blink1Caps_t
 } blink1_info;
 
 static blink1_info blink1_infos[cache_max];
 static int blink1_cached_count = 0;  // number of cached entities
+static int blink1_cache_fromfile = 0; // cache came from blink1_loadCache()
 
 static int blink1_enable_degamma = 1;
 
@@ -57,6 +70,7 @@ int blink1_lib_verbose = 0;
 #define blink1_eeaddr_patternstart (blink1_eeaddr_serialnum + blink1_serialnum_len)
 
 void blink1_sortCache(void);
+static int blink1_capsFor( int type, int fwversion );
 
 
 //----------------------------------------------------------------------------
@@ -101,7 +115,8 @@ const char* blink1_getCachedSerial(int i)
 
 int blink1_getCacheIndexByPath( const char* path ) 
 {
-    for( int i=0; i< cache_max; i++ ) { 
+    if( path == NULL ) return -1;
+    for( int i=0; i< blink1_cached_count; i++ ) { 
         if( strcmp( blink1_infos[i].path, (const char*) path ) == 0 ) return i;
     }
     return -1;
@@ -119,7 +134,8 @@ int blink1_getCacheIndexById( uint32_t i )
 
 int blink1_getCacheIndexBySerial( const char* serial ) 
 {
-    for( int i=0; i< cache_max; i++ ) { 
+    if( serial == NULL ) return -1;
+    for( int i=0; i< blink1_cached_count; i++ ) { 
         if( strcmp( blink1_infos[i].serial, serial ) == 0 ) return i;
     }
     return -1;
@@ -147,6 +163,62 @@ int blink1_clearCacheDev( blink1_device* dev )
     return i;
 }
 
+//
+int blink1_saveCache( const char* filename )
+{
+    FILE* fp = fopen( filename, "w" );
+    if( fp == NULL ) {
+        LOG("blink1_saveCache: cannot write %s\n", filename);
+        return -1;
+    }
+    fprintf(fp, "# blink1-lib device cache: serial type fwversion path\n");
+    for( int i=0; i< blink1_cached_count; i++ ) {
+        fprintf(fp, "%s %d %d %s\n", blink1_infos[i].serial, blink1_infos[i].type,
+                blink1_infos[i].fwversion, blink1_infos[i].path);
+    }
+    fclose(fp);
+    return blink1_cached_count;
+}
+
+//
+int blink1_loadCache( const char* filename, int maxAgeSecs )
+{
+    struct stat st;
+    if( stat( filename, &st ) != 0 ) return -1;
+    if( time(NULL) - st.st_mtime > maxAgeSecs ) {
+        LOG("blink1_loadCache: %s is stale\n", filename);
+        return -1;
+    }
+    FILE* fp = fopen( filename, "r" );
+    if( fp == NULL ) return -1;
+
+    // parse into a copy, so a bad file leaves the live cache alone
+    static blink1_info infos[cache_max];  // too big for the stack
+    char line[pathstrmax + 64];
+    int p = 0;
+    while( p < cache_max && fgets( line, sizeof(line), fp ) != NULL ) {
+        if( line[0] == '#' ) continue;
+        blink1_info* info = &infos[p];
+        memset( info, 0, sizeof(blink1_info) );
+        if( sscanf( line, "%8s %d %d %127[^\n]", info->serial, &info->type,
+                    &info->fwversion, info->path ) != 4 ) {
+            LOG("blink1_loadCache: bad line '%s'\n", line);
+            p = -1;
+            break;
+        }
+        info->caps = blink1_capsFor( info->type, info->fwversion );
+        p++;
+    }
+    fclose(fp);
+    if( p <= 0 ) return -1;
+
+    LOG("blink1_loadCache: %d devices from %s\n", p, filename);
+    memcpy( blink1_infos, infos, p * sizeof(blink1_info) );
+    blink1_cached_count = p;
+    blink1_cache_fromfile = 1;
+    return p;
+}
+
 #if 0
 blink1Type_t blink1_deviceTypeById( int i )
 {
@@ -175,6 +247,170 @@ int blink1_isMk2( blink1_device* dev )
     return blink1_isMk2ById( blink1_getCacheIndexByDev(dev) );
 }
 
+blink1Type_t blink1_getCachedType( int i )
+{
+    if( i < 0 || i > blink1_getCachedCount()-1 ) return BLINK1_UNKNOWN;
+    return blink1_infos[i].type;
+}
+
+int blink1_getCachedVersion( int i )
+{
+    if( i < 0 || i > blink1_getCachedCount()-1 ) return -1;
+    return blink1_infos[i].fwversion;
+}
+
+int blink1_getCachedCaps( int i )
+{
+    if( i < 0 || i > blink1_getCachedCount()-1 ) return BLINK1_CAP_NONE;
+    return blink1_infos[i].caps;
+}
+
+// work out what a device can do from its type & firmware version
+static int blink1_capsFor( int type, int fwversion )
+{
+    int caps = BLINK1_CAP_NONE;
+    if( type == BLINK1_MK2 || type == BLINK1_MK3 ) {
+        caps |= BLINK1_CAP_LEDN | BLINK1_CAP_PLAYLOOP;
+    }
+    if( type == BLINK1_MK3 ) {
+        caps |= BLINK1_CAP_SETLEDN | BLINK1_CAP_STARTUP |
+                BLINK1_CAP_NOTES | BLINK1_CAP_BOOTLOAD;
+    }
+    else if( type == BLINK1_MK2 ) {
+        if( fwversion >= 204 ) caps |= BLINK1_CAP_SETLEDN;
+        if( fwversion >= 206 ) caps |= BLINK1_CAP_STARTUP;
+    }
+    return caps;
+}
+
+static void blink1_setCachedVersion( int i, int fwversion )
+{
+    blink1_infos[i].fwversion = fwversion;
+    blink1_infos[i].caps = blink1_capsFor( blink1_infos[i].type, fwversion );
+}
+
+//
+int blink1_probe( int i )
+{
+    if( i < 0 || i > blink1_getCachedCount()-1 ) return -1;
+    if( blink1_infos[i].fwversion > 0 ) return blink1_infos[i].fwversion;
+
+    int rc = -1;
+    blink1_device* dev = blink1_openByPath( blink1_infos[i].path );
+    if( dev != NULL ) {
+        rc = blink1_getVersion( dev );
+        blink1_close( dev );
+    }
+    blink1_setCachedVersion( i, (rc > 0) ? rc : -1 );
+    return blink1_infos[i].fwversion;
+}
+
+#if BLINK1_PROBE_THREADS
+
+// one per device being probed. Owned by the prober until it gives up
+// waiting, after which the (wedged) worker frees it if it ever returns
+typedef struct {
+    char path[pathstrmax];
+    int fwversion;
+    int done;
+    int abandoned;
+} blink1_probejob;
+
+static pthread_mutex_t blink1_probe_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  blink1_probe_cond  = PTHREAD_COND_INITIALIZER;
+
+static void* blink1_probeWorker( void* arg )
+{
+    blink1_probejob* job = (blink1_probejob*)arg;
+    int rc = -1;
+    // talk to hidapi directly, the shared cache isn't ours to touch here
+    hid_device* dev = hid_open_path( job->path );
+    if( dev != NULL ) {
+        rc = blink1_getVersion( dev );
+        hid_close( dev );
+    }
+    pthread_mutex_lock( &blink1_probe_mutex );
+    job->fwversion = (rc > 0) ? rc : -1;
+    job->done = 1;
+    int abandoned = job->abandoned;
+    pthread_cond_broadcast( &blink1_probe_cond );
+    pthread_mutex_unlock( &blink1_probe_mutex );
+    if( abandoned ) free( job );
+    return NULL;
+}
+
+//
+int blink1_probeAll( int timeoutMillis )
+{
+    int count = blink1_getCachedCount();
+    blink1_probejob* jobs[cache_max] = { NULL };
+    int okcount = 0;
+
+    for( int i=0; i<count; i++ ) {
+        if( blink1_infos[i].fwversion > 0 ) continue; // already known
+        blink1_probejob* job = calloc( 1, sizeof(blink1_probejob) );
+        if( job == NULL ) continue;
+        strncpy( job->path, blink1_infos[i].path, sizeof(job->path)-1 );
+        pthread_t thread;
+        if( pthread_create( &thread, NULL, blink1_probeWorker, job ) != 0 ) {
+            LOG("blink1_probeAll: no thread for %d, probing inline\n", i);
+            free( job );
+            blink1_probe( i );
+            continue;
+        }
+        pthread_detach( thread );
+        jobs[i] = job;
+    }
+
+    struct timeval now;
+    gettimeofday( &now, NULL );
+    long long deadline_us = (long long)now.tv_sec * 1000000 + now.tv_usec +
+        (long long)timeoutMillis * 1000;
+    struct timespec deadline;
+    deadline.tv_sec  = deadline_us / 1000000;
+    deadline.tv_nsec = (deadline_us % 1000000) * 1000;
+
+    pthread_mutex_lock( &blink1_probe_mutex );
+    for( int i=0; i<count; i++ ) {
+        if( jobs[i] == NULL ) continue;
+        int rc = 0;
+        while( !jobs[i]->done && rc != ETIMEDOUT ) {
+            rc = pthread_cond_timedwait( &blink1_probe_cond,
+                                         &blink1_probe_mutex, &deadline );
+        }
+        if( jobs[i]->done ) {
+            blink1_setCachedVersion( i, jobs[i]->fwversion );
+            free( jobs[i] );
+        }
+        else {
+            LOG("blink1_probeAll: %s timed out\n", blink1_infos[i].serial);
+            blink1_setCachedVersion( i, -1 );
+            jobs[i]->abandoned = 1;
+        }
+        jobs[i] = NULL;
+    }
+    pthread_mutex_unlock( &blink1_probe_mutex );
+
+    for( int i=0; i<count; i++ ) {
+        if( blink1_infos[i].fwversion > 0 ) okcount++;
+    }
+    return okcount;
+}
+
+#else
+
+//
+int blink1_probeAll( int timeoutMillis )
+{
+    int okcount = 0;
+    for( int i=0; i<blink1_getCachedCount(); i++ ) {
+        if( blink1_probe(i) > 0 ) okcount++;
+    }
+    return okcount;
+}
+
+#endif
+
 
 //
 int blink1_getVersion(blink1_device *dev)
@@ -333,6 +569,14 @@ int blink1_readRGB(blink1_device *dev, uint16_t* fadeMillis,
     if( ! blink1_isMk2(dev) ) { 
         return blink1_readRGB_mk1( dev, fadeMillis, r,g,b);
     }
+    return blink1_readRGB_mk2( dev, fadeMillis, r,g,b, ledn);
+}
+
+// mk2 & mk3 devices
+int blink1_readRGB_mk2(blink1_device *dev, uint16_t* fadeMillis, 
+                       uint8_t* r, uint8_t* g, uint8_t* b, 
+                       uint8_t ledn)
+{
     uint8_t buf[blink1_buf_size] = { blink1_report_id, 'r', 0,0,0, 0,0,ledn };
 
     int rc = blink1_read(dev, buf, sizeof(buf) );
@@ -377,6 +621,205 @@ int blink1_serverdown(blink1_device *dev, uint8_t on, uint32_t millis, uint8_t s
     return rc;
 }
 
+//----------------------------------------------------------------------------
+// server-tickle keepalive engine
+//
+// devices sit on a timer wheel of blink1_keepalive_slots slots, each
+// blink1_keepalive_tick millis wide.  every tickle interval is shorter than
+// the span of the wheel, so anything found in a slot is due this time around.
+
+typedef struct blink1_keepalive_ {
+    char path[pathstrmax];
+    blink1_device* dev;   // kept open between tickles, NULL if not open
+    uint32_t millis;      // watchdog timeout
+    uint32_t interval;    // time between tickles
+    uint64_t due;         // when next tickle is due
+    uint64_t last;        // when last good tickle was sent, 0 if never
+    uint8_t st;
+    uint8_t startpos;
+    uint8_t endpos;
+    int next;             // next entry in same wheel slot, -1 if none
+} blink1_keepalive;
+
+static blink1_keepalive* blink1_keepalives = NULL;
+static int blink1_keepalive_count = 0;
+static int blink1_keepalive_wheel[blink1_keepalive_slots]; // slot list heads
+static uint64_t blink1_keepalive_nexttick; // next wheel tick to process
+static uint32_t blink1_keepalive_tickles, blink1_keepalive_late;
+static uint32_t blink1_keepalive_missed, blink1_keepalive_errors;
+
+// monotonic millis, for scheduling
+static uint64_t blink1_millis(void)
+{
+#ifdef _WIN32
+    return GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+//
+int blink1_keepaliveAdd( const char* path, uint32_t millis, 
+                         uint8_t st, uint8_t startpos, uint8_t endpos )
+{
+    if( path == NULL || strlen(path) == 0 ) return -1;
+
+    if( millis > blink1_serverdown_max_millis ) 
+        millis = blink1_serverdown_max_millis;
+    if( millis < 3 * blink1_keepalive_tick ) 
+        millis = 3 * blink1_keepalive_tick;
+
+    blink1_keepalive* kas = realloc( blink1_keepalives, 
+                        (blink1_keepalive_count+1) * sizeof(blink1_keepalive));
+    if( kas == NULL ) return -1;
+    blink1_keepalives = kas;
+
+    blink1_keepalive* ka = &blink1_keepalives[ blink1_keepalive_count ];
+    memset( ka, 0, sizeof(blink1_keepalive) );
+    strncpy( ka->path, path, sizeof(ka->path)-1 );
+    ka->millis   = millis;
+    ka->interval = millis / 3;
+    ka->st       = st;
+    ka->startpos = startpos;
+    ka->endpos   = endpos;
+    ka->next     = -1;
+
+    return ++blink1_keepalive_count;
+}
+
+// put entry i in the wheel slot for its due time
+static void blink1_keepaliveSchedule( int i )
+{
+    int slot = (blink1_keepalives[i].due / blink1_keepalive_tick) % 
+        blink1_keepalive_slots;
+    blink1_keepalives[i].next = blink1_keepalive_wheel[slot];
+    blink1_keepalive_wheel[slot] = i;
+}
+
+//
+void blink1_keepaliveStart(void)
+{
+    uint64_t now = blink1_millis();
+
+    for( int s=0; s < blink1_keepalive_slots; s++ ) 
+        blink1_keepalive_wheel[s] = -1;
+    blink1_keepalive_nexttick = now / blink1_keepalive_tick;
+    blink1_keepalive_tickles = blink1_keepalive_late = 0;
+    blink1_keepalive_missed  = blink1_keepalive_errors = 0;
+
+    // device i of n goes i/n of the way into its interval
+    for( int i=0; i < blink1_keepalive_count; i++ ) { 
+        blink1_keepalive* ka = &blink1_keepalives[i];
+        ka->due  = now + ((uint64_t)ka->interval * i) / blink1_keepalive_count;
+        ka->last = 0;
+        blink1_keepaliveSchedule( i );
+    }
+}
+
+// send one tickle and put the device back on the wheel
+static void blink1_keepaliveTickle( int i, uint64_t now )
+{
+    blink1_keepalive* ka = &blink1_keepalives[i];
+
+    if( now > ka->due + blink1_keepalive_tick ) {
+        blink1_keepalive_late++;
+    }
+    if( ka->last && now > ka->last + ka->millis ) { 
+        blink1_keepalive_missed++;
+        LOG("blink1_keepalive: %s missed deadline by %d millis\n", ka->path,
+            (int)(now - (ka->last + ka->millis)));
+    }
+
+    if( ka->dev == NULL ) { 
+        ka->dev = blink1_openByPath( ka->path );
+    }
+    if( ka->dev == NULL || 
+        blink1_serverdown( ka->dev, 1, ka->millis, 
+                           ka->st, ka->startpos, ka->endpos ) == -1 ) {
+        LOG("blink1_keepalive: %s tickle failed\n", ka->path);
+        blink1_keepalive_errors++;
+        blink1_close( ka->dev ); // reopen on next go-round
+        ka->dev = NULL;
+    }
+    else { 
+        blink1_keepalive_tickles++;
+        ka->last = now;
+    }
+
+    // keep our place in the spread, unless we've fallen a whole interval behind
+    ka->due += ka->interval;
+    if( ka->due <= now ) ka->due = now + ka->interval;
+    if( ka->due / blink1_keepalive_tick <= blink1_keepalive_nexttick ) // slot in hand
+        ka->due = (blink1_keepalive_nexttick + 1) * blink1_keepalive_tick;
+    blink1_keepaliveSchedule( i );
+}
+
+//
+int blink1_keepalivePoll(void)
+{
+    uint64_t now = blink1_millis();
+    uint64_t nowtick = now / blink1_keepalive_tick;
+
+    // after a long stall, each slot only needs visiting once
+    if( nowtick >= blink1_keepalive_nexttick + blink1_keepalive_slots ) 
+        blink1_keepalive_nexttick = nowtick - blink1_keepalive_slots + 1;
+
+    while( blink1_keepalive_nexttick <= nowtick ) { 
+        int slot = blink1_keepalive_nexttick % blink1_keepalive_slots;
+        int i = blink1_keepalive_wheel[slot];
+        blink1_keepalive_wheel[slot] = -1;
+        while( i != -1 ) { 
+            int next = blink1_keepalives[i].next;
+            if( blink1_keepalives[i].due / blink1_keepalive_tick > 
+                blink1_keepalive_nexttick ) { // not this time around
+                blink1_keepaliveSchedule( i );
+            } else { 
+                blink1_keepaliveTickle( i, now );
+            }
+            i = next;
+        }
+        blink1_keepalive_nexttick++;
+    }
+
+    // find next occupied slot
+    uint64_t t = blink1_keepalive_nexttick;
+    for( int s=0; s < blink1_keepalive_slots; s++, t++ ) { 
+        if( blink1_keepalive_wheel[ t % blink1_keepalive_slots ] != -1 ) 
+            break;
+    }
+    uint64_t when = t * blink1_keepalive_tick;
+    now = blink1_millis();
+    return (when > now) ? (int)(when - now) : 0;
+}
+
+//
+void blink1_keepaliveStats( uint32_t* tickles, uint32_t* late, 
+                            uint32_t* missed, uint32_t* errors )
+{
+    if( tickles ) *tickles = blink1_keepalive_tickles;
+    if( late )    *late    = blink1_keepalive_late;
+    if( missed )  *missed  = blink1_keepalive_missed;
+    if( errors )  *errors  = blink1_keepalive_errors;
+}
+
+//
+void blink1_keepaliveStop( int disarm )
+{
+    for( int i=0; i < blink1_keepalive_count; i++ ) { 
+        blink1_keepalive* ka = &blink1_keepalives[i];
+        if( disarm ) { 
+            if( ka->dev == NULL ) ka->dev = blink1_openByPath( ka->path );
+            if( ka->dev ) blink1_serverdown( ka->dev, 0, 0, 0, 0, 0 );
+        }
+        blink1_close( ka->dev );
+    }
+    free( blink1_keepalives );
+    blink1_keepalives = NULL;
+    blink1_keepalive_count = 0;
+}
+
 //
 int blink1_play(blink1_device *dev, uint8_t play, uint8_t startpos)
 {
@@ -817,7 +1260,6 @@ int parsePattern( char* str, int* repeats, patternline_t* pattern )
     int i=0;
     s = strtok(NULL, ","); // prep next parse
     while( s != NULL ) {
-      printf("s:'%s'\n",s);
         parsecolor( &pattern[i].color, s );
         
         s = strtok(NULL, ",");
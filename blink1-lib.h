@@ -21,8 +21,9 @@ extern "C" {
 
 #define blink1_max_devices 32
 
-#define cache_max blink1_max_devices
-//#define cache_max 16  
+// devices remembered by blink1_enumerate(). only the first
+// blink1_max_devices can be opened by index, the rest by serial or path
+#define cache_max 512
 #define serialstrmax (8 + 1) 
 #define pathstrmax 128
 
@@ -48,6 +49,19 @@ typedef enum  {
     BLINK1_MK3    // 2018 one (unreleased as of yet)
 } blink1Type_t;
 
+// capability bits, as derived from device type & firmware version
+typedef enum {
+    BLINK1_CAP_NONE     = 0,
+    BLINK1_CAP_LEDN     = 0x01, // per-LED addressing (mk2+)
+    BLINK1_CAP_PLAYLOOP = 0x02, // pattern sub-loops & play state (mk2+)
+    BLINK1_CAP_SETLEDN  = 0x04, // ledn on pattern lines (fw 204+)
+    BLINK1_CAP_STARTUP  = 0x08, // startup params (fw 206+ or mk3)
+    BLINK1_CAP_NOTES    = 0x10, // user notes (mk3)
+    BLINK1_CAP_BOOTLOAD = 0x20  // reset to bootloader (mk3)
+} blink1Caps_t;
+
+#define blink1_probe_timeout_default 1000
+
 struct blink1_device_;
 
 #if USE_HIDAPI
@@ -209,6 +223,16 @@ int blink1_readRGB(blink1_device *dev, uint16_t* fadeMillis,
  */
 int blink1_readRGB_mk1(blink1_device *dev, uint16_t* fadeMillis,
                        uint8_t* r, uint8_t* g, uint8_t* b);
+/**
+ * Read current RGB value on specified LED of mk2 & mk3 devices.
+ * @note Called by blink1_readRGB() if device isn't mk1.  Calling it
+ *       directly skips looking up the device type in the device cache.
+ * @param n which LED to get (0=1st, 1=1st LED, 2=2nd LED)
+ * @return -1 on error, 0 on success
+ */
+int blink1_readRGB_mk2(blink1_device *dev, uint16_t* fadeMillis,
+                       uint8_t* r, uint8_t* g, uint8_t* b,
+                       uint8_t ledn);
 
 /** 
  * Read eeprom on mk1 devices
@@ -247,6 +271,53 @@ int blink1_serialnumwrite(blink1_device *dev, uint8_t* serialnumstr);
 int blink1_serverdown(blink1_device *dev, uint8_t on, uint32_t millis, 
                       uint8_t st, uint8_t startpos, uint8_t endpos);
 
+// server-tickle keepalive engine: keeps the serverdown watchdog of many
+// blink1s fed from one thread, spreading the tickles evenly over time 
+// so a large fleet is never written to all at once.
+// the firmware's watchdog tops out around 62 secs (see blink1_serverdown())
+
+#define blink1_serverdown_max_millis  62000
+#define blink1_keepalive_tick         50    // timer wheel slot, in millis
+#define blink1_keepalive_slots        2048  // must span > max_millis/tick
+
+/**
+ * Add a device to the keepalive engine.
+ * Device is opened on its first tickle and kept open afterwards.
+ * @param path platform-specific device path (e.g. blink1_getCachedPath())
+ * @param millis watchdog timeout, clamped to blink1_serverdown_max_millis.
+ *        devices are tickled every millis/3, so two lost tickles in a row
+ *        can be survived without the watchdog firing
+ * @param st, startpos, endpos as in blink1_serverdown()
+ * @return number of devices in engine, or -1 on error
+ */
+int blink1_keepaliveAdd( const char* path, uint32_t millis, 
+                         uint8_t st, uint8_t startpos, uint8_t endpos );
+/**
+ * Schedule the first tickle of every added device, spread evenly 
+ * over each device's tickle interval.
+ */
+void blink1_keepaliveStart(void);
+/**
+ * Tickle every device whose turn has come. Call this in a loop.
+ * @return milliseconds until the next tickle is due
+ */
+int blink1_keepalivePoll(void);
+/**
+ * Get keepalive counters since blink1_keepaliveStart().
+ * @param tickles number of tickles sent
+ * @param late tickles sent more than a tick after their due time
+ * @param missed tickles sent after the watchdog timeout had already passed,
+ *        i.e. the device's serverdown pattern has likely been triggered
+ * @param errors failed opens or writes
+ */
+void blink1_keepaliveStats( uint32_t* tickles, uint32_t* late, 
+                            uint32_t* missed, uint32_t* errors );
+/**
+ * Stop the keepalive engine and close its devices.
+ * @param disarm if 1, turn off serverdown on each device before closing
+ */
+void blink1_keepaliveStop( int disarm );
+
 /**
  * Play color pattern stored in blink1.
  * @param dev blink1 device to command
@@ -442,6 +513,26 @@ int          blink1_getCacheIndexByDev( blink1_device* dev );
  */
 int          blink1_clearCacheDev( blink1_device* dev );
 
+/**
+ * Save blink1 device cache (paths, serials, types, firmware versions)
+ * to a file, so a later process can skip enumeration.
+ * @param filename file to write
+ * @return number of entries written or -1 on error
+ */
+int          blink1_saveCache( const char* filename );
+
+/**
+ * Load blink1 device cache written by blink1_saveCache(), instead of
+ * doing a blink1_enumerate().
+ * @note Devices opened from a loaded cache are checked against their
+ *       USB serial number, a mismatch means the cache is stale and the
+ *       open fails, so callers should then fall back to blink1_enumerate().
+ * @param filename file to read
+ * @param maxAgeSecs ignore cache files older than this many seconds
+ * @return number of devices loaded or -1 if no usable cache
+ */
+int          blink1_loadCache( const char* filename, int maxAgeSecs );
+
 /**
  * Return serial number string for give blink1 device.
  * @param dev blink device to lookup
@@ -471,6 +562,48 @@ int          blink1_isMk2ById(int i);
  */
 int          blink1_isMk2(blink1_device* dev);
 
+/**
+ * Return device type for given cache index.
+ * @param i cache index
+ * @return BLINK1_MK1, BLINK1_MK2, BLINK1_MK3, or BLINK1_UNKNOWN
+ */
+blink1Type_t blink1_getCachedType(int i);
+
+/**
+ * Return firmware version for given cache index, as found by
+ * blink1_probe() or blink1_probeAll().
+ * @param i cache index
+ * @return version (e.g. 204), 0 if not yet probed, -1 if probe failed
+ */
+int          blink1_getCachedVersion(int i);
+
+/**
+ * Return capabilities for given cache index.
+ * @note Only fully known after device has been probed.
+ * @param i cache index
+ * @return bitmask of blink1Caps_t
+ */
+int          blink1_getCachedCaps(int i);
+
+/**
+ * Open device at cache index, read its firmware version and close it,
+ * storing version & capabilities in the cache.
+ * @note Does nothing if device was already probed.
+ * @param i cache index
+ * @return firmware version or -1 on error
+ */
+int          blink1_probe(int i);
+
+/**
+ * Probe all cached devices concurrently (see blink1_probe()).
+ * A device that does not answer within timeoutMillis is marked failed,
+ * so one wedged device cannot stall the others.
+ * @note HIDDATA and Windows builds probe one device at a time.
+ * @param timeoutMillis per-device timeout in milliseconds
+ * @return number of devices successfully probed
+ */
+int          blink1_probeAll(int timeoutMillis);
+
 
 /**
  *
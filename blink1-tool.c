@@ -26,6 +26,14 @@
 #include <getopt.h>    // for getopt_long()
 #include <time.h>
 #include <unistd.h>    // getuid()
+#include <sys/time.h>  // gettimeofday()
+
+#ifdef _WIN32
+#include <fcntl.h>     // _setmode()
+#include <io.h>
+#else
+#include <sys/select.h> // select() for --stream
+#endif
 
 #include "blink1-lib.h"
 extern int blink1_lib_verbose;
@@ -47,10 +55,22 @@ const int32_t delayMillisDefault = 500;
 int millis = -1;
 int32_t delayMillis = -1;
 int numDevicesToUse = 1;
+int allDevices = 0;  // '-d all', may be more than deviceIds holds
+int probeTimeout = blink1_probe_timeout_default;
+int json = 0;
+
+const int cacheMaxAgeDefault = 300; // seconds
+char* cacheFile = NULL;   // on-disk enumeration cache, if enabled
+char* devicePath = NULL;  // open this path directly, no enumeration
+int benchStartup = 0;
+int streamFps = 30;
 
 blink1_device* dev;
 uint32_t  deviceIds[blink1_max_devices];
 
+int count = 0;       // number of devices known
+int enumerated = 0;  // did a real USB enumeration happen
+
 int verbose;
 int quiet=0;
 
@@ -104,6 +124,8 @@ static void usage(char *myName)
 "  --chase, --chase=<num,start,stop> Multi-LED chase effect. <num>=0 runs forever\n"
 "  --random, --random=<num>    Flash a number of random colors, num=1 if omitted \n"
 "  --glimmer, --glimmer=<num>  Glimmer a color with --rgb (num times)\n"
+"  --stream                    Stream binary RGB frames from stdin (see Notes)\n"
+"  --keepalive[=st,start,end]  Keep servertickle of all -d devices fed (-t msec)\n"
 " Nerd functions: \n"
 "  --fwversion                 Display blink(1) firmware version \n"
 "  --version                   Display blink1-tool version info \n"
@@ -119,6 +141,12 @@ static void usage(char *myName)
 "  -l <led>, --led=<led>       Which LED to use, 0=all/1=top/2=bottom (mk2)\n"
 "  --ledn 1,3,5,7              Specify a list of LEDs to light\n"
 "  -v, --verbose               verbose debugging msgs\n"
+"  --json                      Output --list & --fwversion as JSON\n"
+"  --probetimeout=millis       Per-device timeout for --list (default 1000)\n"
+"  --path=<devpath>            Open blink(1) at this USB path, skip enumeration\n"
+"  --cache, --cache=<file>     Use on-disk device cache (or $BLINK1_TOOL_CACHE)\n"
+"  --bench-startup             Print how long startup & device open took\n"
+"  --fps=<num>                 Frame rate for --stream (default 30)\n"
 "\n"
 "Examples \n"
 "  blink1-tool -m 100 --rgb=255,0,255    # Fade to #FF00FF in 0.1 seconds \n"
@@ -153,6 +181,15 @@ static void usage(char *myName)
 "   blink1-tool -t 200 -m 100 --rgb ff00ff --blink 5 \n"
 " - If using several blink(1)s, use '-d all' or '-d 0,2' to select 1st,3rd: \n"
 "   blink1-tool -d all -t 50 -m 50 -rgb 00ff00 --blink 10 \n"
+" - For fast startup from scripts, cache device enumeration between runs:\n"
+"   blink1-tool --cache -d 2000ABCD --red \n"
+" - '--stream' reads frames of 3 bytes (r,g,b) per target from stdin, where\n"
+"   targets are each device from '-d' times each LED from '--ledn':\n"
+"   myrenderer | blink1-tool -d 0,1 --ledn 1,2 --fps 40 --stream \n"
+"   (frame is 12 bytes: dev0/led1, dev0/led2, dev1/led1, dev1/led2)\n"
+" - '--keepalive' tickles many blink(1)s spread evenly over time, with the \n"
+"   watchdog timeout from '-t' (default 30000, max 62000). Runs until killed:\n"
+"   blink1-tool -d all -t 45000 --keepalive=1,0,3 \n"
 "\n"
             ,myName);
 //"  --hidread                  Read a blink(1) USB HID GetFeature report \n"
@@ -200,9 +237,62 @@ enum {
     CMD_GETSTARTUP,
     CMD_GOBOOTLOAD,
     CMD_SETRGB,
+    CMD_STREAM,
+    CMD_KEEPALIVE,
     CMD_TESTTEST
 };
 
+//
+static double millisNow(void)
+{
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+//
+// Do a real USB enumeration (only once), and remember it on disk if caching
+//
+static int enumerateDevices(void)
+{
+    if( !enumerated ) {
+        count = blink1_enumerate();
+        enumerated = 1;
+        if( cacheFile ) blink1_saveCache( cacheFile );
+    }
+    return count;
+}
+
+//
+// Learn what devices there are, from the on-disk cache if we can
+//
+static int loadDevices(void)
+{
+    if( cacheFile && !enumerated ) {
+        int n = blink1_loadCache( cacheFile, cacheMaxAgeDefault );
+        if( n > 0 ) return (count = n);
+    }
+    return enumerateDevices();
+}
+
+//
+// Open a device by id. If the device list came from a stale on-disk cache,
+// re-enumerate and try again.
+//
+static blink1_device* openDevice( uint32_t id )
+{
+    if( devicePath ) {
+        return blink1_openByPath( devicePath );
+    }
+    blink1_device* d = blink1_openById( id );
+    if( d == NULL && !enumerated ) {
+        if( verbose ) printf("device cache stale, re-enumerating\n");
+        enumerateDevices();
+        d = blink1_openById( id );
+    }
+    return d;
+}
+
 //
 // Fade to RGB for multiple blink1 devices.
 // Uses globals numDevicesToUse, deviceIds, quiet
@@ -211,7 +301,7 @@ int blink1_fadeToRGBForDevices( uint16_t mils, uint8_t rr,uint8_t gg, uint8_t bb
     blink1_device* d;
     int rc;
     for( int i=0; i< numDevicesToUse; i++ ) {
-        d = blink1_openById( deviceIds[i] );
+        d = openDevice( deviceIds[i] );
         if( d == NULL ) continue;
         msg("set dev:%X:%d to rgb:0x%2.2x,0x%2.2x,0x%2.2x over %d msec\n",
             deviceIds[i], nn, rr,gg,bb, mils, nn);
@@ -228,6 +318,204 @@ int blink1_fadeToRGBForDevices( uint16_t mils, uint8_t rr,uint8_t gg, uint8_t bb
     return 0; // FIXME
 }
 
+//
+// Feed the serverdown watchdog of every selected device, forever.
+// Uses globals numDevicesToUse, deviceIds, devicePath, allDevices
+//
+static int keepaliveRun( uint32_t timeoutMillis, uint8_t st, 
+                         uint8_t startpos, uint8_t endpos )
+{
+    int n = 0;
+    // '-d all' takes every enumerated device, not just those with an id
+    if( allDevices && devicePath == NULL ) { 
+        for( int i=0; i< blink1_getCachedCount(); i++ ) { 
+            n = blink1_keepaliveAdd( blink1_getCachedPath(i), timeoutMillis, 
+                                     st, startpos, endpos );
+        }
+    }
+    else for( int i=0; i< numDevicesToUse; i++ ) {
+        const char* path = devicePath;
+        if( path == NULL ) { 
+            int ci = blink1_getCacheIndexById( deviceIds[i] );
+            path = (ci >= 0) ? blink1_getCachedPath( ci ) : NULL;
+        }
+        if( path == NULL ) { 
+            msg("no blink(1) with id %X, skipping\n", deviceIds[i]);
+            continue;
+        }
+        n = blink1_keepaliveAdd( path, timeoutMillis, st, startpos, endpos );
+    }
+    if( n <= 0 ) return -1;
+
+    if( timeoutMillis > blink1_serverdown_max_millis ) { 
+        msg("servertickle timeout limited to %d millis\n", blink1_serverdown_max_millis);
+        timeoutMillis = blink1_serverdown_max_millis;
+    }
+    msg("keepalive: %d devices, %ld millis timeout, tickle every %ld millis\n",
+        n, (long)timeoutMillis, (long)timeoutMillis/3);
+
+    blink1_keepaliveStart();
+    uint32_t tickles, late, missed, errors, lastMissed = 0;
+    double lastStats = millisNow();
+    while( 1 ) { 
+        int wait = blink1_keepalivePoll();
+        blink1_keepaliveStats( &tickles, &late, &missed, &errors );
+        double now = millisNow();
+        // report missed deadlines promptly, otherwise once a minute
+        if( (missed != lastMissed && now - lastStats >= 1000) || 
+            now - lastStats >= 60000 ) { 
+            msg("keepalive: %u tickles, %u late, %u missed deadlines, %u errors\n",
+                tickles, late, missed, errors);
+            lastMissed = missed;
+            lastStats = now;
+        }
+        if( wait > 1000 ) wait = 1000;
+        if( wait > 0 ) blink1_sleep( wait );
+    }
+    return 0;
+}
+
+#define streamTargetsMax 256
+
+//
+// Stream raw RGB frames from stdin to many (device,ledn) targets.
+// Frames that arrive faster than 'fps' (or faster than USB keeps up) are
+// dropped in favor of the newest one, and only LEDs whose color changed
+// since the last written frame are sent, each with a short fade.
+// Uses globals numDevicesToUse, deviceIds
+//
+static int streamFrames( int fps, uint16_t fadeMillis, uint8_t* ledns, int ledns_cnt )
+{
+    int ntargets = numDevicesToUse * ledns_cnt;
+    if( ntargets > streamTargetsMax ) {
+        msg("too many stream targets (%d > %d)\n", ntargets, streamTargetsMax);
+        return -1;
+    }
+    int framesize = ntargets * 3;
+
+    blink1_device* devs[blink1_max_devices];
+    for( int i=0; i< numDevicesToUse; i++ ) {
+        devs[i] = openDevice( deviceIds[i] );
+        if( devs[i] == NULL ) {
+            msg("cannot open blink(1) %X\n", deviceIds[i]);
+            for( int j=0; j<i; j++ ) blink1_close( devs[j] );
+            return -1;
+        }
+    }
+
+#ifdef _WIN32
+    _setmode( _fileno(stdin), _O_BINARY );
+#endif
+
+    uint8_t inbuf[streamTargetsMax*3];   // frame being read
+    uint8_t frame[streamTargetsMax*3];   // newest complete frame
+    uint8_t shown[streamTargetsMax*3];   // last frame written to devices
+    int inlen = 0;
+    int pending = 0;   // 'frame' not yet written
+    int shownValid = 0;
+    int eof = 0;
+    long frames = 0, written = 0, dropped = 0, ledwrites = 0, errors = 0;
+    long statFrames = 0, statDropped = 0;
+
+    double period = 1000.0 / fps;
+    double next = millisNow();
+    double statStart = next;
+
+    msg("streaming %d-byte frames to %d targets at %d fps\n", framesize, ntargets, fps);
+
+    while( !eof || pending ) {
+        // pull in everything available, keeping only the newest frame
+        while( !eof ) {
+            double wait = next - millisNow();
+            if( pending || wait < 0 ) wait = 0;
+#ifndef _WIN32
+            fd_set rfds;
+            FD_ZERO( &rfds );
+            FD_SET( 0, &rfds );
+            struct timeval tv = { (long)(wait / 1000), (long)(wait * 1000) % 1000000 };
+            if( select( 1, &rfds, NULL, NULL, &tv ) <= 0 ) break;
+#else
+            if( pending ) break; // no select() on pipes, read one frame per tick
+#endif
+            int n = read( 0, inbuf + inlen, framesize - inlen );
+            if( n <= 0 ) { eof = 1; break; }
+            inlen += n;
+            if( inlen == framesize ) {
+                if( pending ) dropped++;
+                memcpy( frame, inbuf, framesize );
+                pending = 1;
+                frames++;
+                inlen = 0;
+            }
+        }
+
+        double now = millisNow();
+        if( pending && now >= next ) {
+            for( int t=0; t< ntargets; t++ ) {
+                uint8_t* c = frame + t*3;
+                if( shownValid && memcmp( c, shown + t*3, 3 ) == 0 ) continue;
+                int rc = blink1_fadeToRGBN( devs[t / ledns_cnt], fadeMillis,
+                                            c[0], c[1], c[2], ledns[t % ledns_cnt] );
+                if( rc == -1 ) errors++;
+                ledwrites++;
+            }
+            memcpy( shown, frame, framesize );
+            shownValid = 1;
+            pending = 0;
+            written++;
+            // if USB fell behind, don't try to catch up, just skip ticks
+            next += period;
+            if( next < millisNow() ) next = millisNow();
+        }
+        else if( !pending && eof ) {
+            break;
+        }
+
+        if( now - statStart >= 1000 ) {
+            msg("stream: %.1f fps, %ld dropped, %ld led writes\n",
+                (written - statFrames) * 1000.0 / (now - statStart),
+                dropped - statDropped, ledwrites);
+            statStart = now;
+            statFrames = written;
+            statDropped = dropped;
+        }
+    }
+
+    msg("stream done: %ld frames read, %ld written, %ld dropped, %ld led writes, %ld errors\n",
+        frames, written, dropped, ledwrites, errors);
+    for( int i=0; i< numDevicesToUse; i++ ) {
+        blink1_close( devs[i] );
+    }
+    return 0;
+}
+
+//
+static const char* blink1_typestr( blink1Type_t type )
+{
+    switch( type ) {
+    case BLINK1_MK1: return "mk1";
+    case BLINK1_MK2: return "mk2";
+    case BLINK1_MK3: return "mk3";
+    default:         return "unknown";
+    }
+}
+
+//
+// Print device cache (as filled out by blink1_probeAll()) as JSON
+//
+static void printDevicesJson( int count )
+{
+    printf("{\n  \"blink1_devices\": [");
+    for( int i=0; i< count; i++ ) {
+        printf("%s\n    { \"id\": %d, \"serial\": \"%s\", \"type\": \"%s\", "
+               "\"fwversion\": %d, \"caps\": %d }",
+               (i==0) ? "" : ",", i, blink1_getCachedSerial(i),
+               blink1_typestr( blink1_getCachedType(i) ),
+               blink1_getCachedVersion(i), blink1_getCachedCaps(i) );
+    }
+    printf("\n  ]\n}\n");
+}
+
 
 
 //
@@ -239,7 +527,7 @@ int main(int argc, char** argv)
     char*  argbuf[150]; // generic str arg for cmds that take an arg
     uint8_t chasebuf[3]; // could use other buf
 
-    uint8_t cmdbuf[blink1_buf_size]; 
+    uint8_t cmdbuf[blink1_buf_size] = {0}; 
     rgb_t rgbbuf = {0,0,0};
     
     int ledn = 0;  // deprecated, soon to be removed
@@ -318,6 +606,14 @@ int main(int argc, char** argv)
         {"notestr",    required_argument, 0,      'n'},
         {"gobootload", no_argument,       &cmd,   CMD_GOBOOTLOAD},
         {"setrgb",     required_argument, &cmd,   CMD_SETRGB },
+        {"json",       no_argument,       0,      'j' },
+        {"probetimeout", required_argument, 0,    'T' },
+        {"path",       required_argument, 0,      'P' },
+        {"cache",      optional_argument, 0,      'C' },
+        {"bench-startup", no_argument,    0,      'B' },
+        {"stream",     no_argument,       &cmd,   CMD_STREAM },
+        {"keepalive",  optional_argument, &cmd,   CMD_KEEPALIVE },
+        {"fps",        required_argument, 0,      'F' },
         {NULL,         0,                 0,      0}
     };
     while(1) {
@@ -344,6 +640,9 @@ int main(int argc, char** argv)
             case CMD_SETSTARTUP: // FIXME
                 hexread(cmdbuf, optarg, sizeof(cmdbuf));  // cmd w/ hexlist arg
                 break;
+            case CMD_KEEPALIVE:
+                if(optarg) hexread(cmdbuf, optarg, sizeof(cmdbuf));
+                break;
             case CMD_BLINK:
             case CMD_WRITENOTE:
             case CMD_READNOTE:
@@ -417,22 +716,50 @@ int main(int argc, char** argv)
                 fprintf(stderr,"going REALLY verbose\n");
             }
             break;
+        case 'j':
+            json = 1;
+            break;
+        case 'T':
+            probeTimeout = strtol(optarg,NULL,10);
+            break;
+        case 'P':
+            devicePath = optarg;
+            break;
+        case 'C':
+            cacheFile = optarg;
+            if( cacheFile == NULL ) {
+                static char cachebuf[256];
+                char* home = getenv("HOME");
+                snprintf(cachebuf, sizeof(cachebuf), "%s/.blink1-tool-cache",
+                         (home) ? home : ".");
+                cacheFile = cachebuf;
+            }
+            break;
+        case 'B':
+            benchStartup = 1;
+            break;
+        case 'F':
+            streamFps = strtol(optarg,NULL,10);
+            if( streamFps <= 0 ) streamFps = 1;
+            break;
         case 'i': // report id, for testing
           reportid = strtol(optarg,NULL,10);
           break;
         case 'd':  // devices to use
             if( strcmp(optarg,"all") == 0 ) {
                 numDevicesToUse = 0; //blink1_max_devices;
+                allDevices = 1;
                 for( int i=0; i< blink1_max_devices; i++) {
                     deviceIds[i] = i;
                 }
             } 
             else { // if( strcmp(optarg,",") != -1 ) { // comma-separated list
+                allDevices = 0;
                 char* pch;
                 //int base = 0;
                 pch = strtok( optarg, " ,");
                 numDevicesToUse = 0;
-                while( pch != NULL ) { 
+                while( pch != NULL && numDevicesToUse < blink1_max_devices ) { 
                     int base = (strlen(pch)==8) ? 16:0;
                     deviceIds[numDevicesToUse++] = strtol(pch,NULL,base);
                     pch = strtok(NULL, " ,");
@@ -455,49 +782,95 @@ int main(int argc, char** argv)
         exit(1);
     }
 
-    // get a list of all devices and their paths
-    int count = blink1_enumerate();
+    double startMillis = millisNow();
+    if( cacheFile == NULL ) cacheFile = getenv("BLINK1_TOOL_CACHE");
 
     if( cmd == CMD_VERSION ) { 
         char verbuf[40] = "";
-        if( count ) { 
-            dev = blink1_openById( deviceIds[0] );
-            rc = blink1_getVersion(dev);
-            blink1_close(dev);
+        if( loadDevices() ) { 
+            rc = blink1_getCachedVersion( blink1_getCacheIndexById(deviceIds[0]) );
+            if( rc <= 0 ) { 
+                dev = openDevice( deviceIds[0] );
+                rc = blink1_getVersion(dev);
+                blink1_close(dev);
+            }
             snprintf(verbuf, sizeof(verbuf), ", fw version: %d", rc);
         }
         msg("blink1-tool version: %s%s\n",BLINK1_VERSION,verbuf);
         exit(0);
     }
 
+    // when streaming, fade over one frame unless told otherwise
+    if( cmd == CMD_STREAM && millis == -1 ) millis = 1000 / streamFps;
+    // a watchdog timeout of 'delayMillisDefault' would be far too twitchy
+    if( cmd == CMD_KEEPALIVE && delayMillis == -1 ) delayMillis = 30000;
+
     // rationalize various options to known-good state
     if( delayMillis==-1 ) delayMillis = delayMillisDefault;
     if( millis == -1 ) millis = millisDefault;
     if( ledns_cnt == 0 ) { ledns[0] = 0; ledns_cnt = 1;  }
 
+    // get a list of all devices and their paths, unless given a path.
+    // listing & keepalive always go to USB, everything else can use the cache
+    if( cmd == CMD_LIST || cmd == CMD_FWVERSION || 
+        (cmd == CMD_KEEPALIVE && !devicePath) ) {
+        enumerateDevices();
+    }
+    else if( devicePath ) {
+        count = 1;
+        numDevicesToUse = 1;
+    }
+    else {
+        loadDevices();
+    }
+    double enumMillis = millisNow();
+
     if( count == 0  ) {
         msg("no blink(1) devices found\n");
         exit(1);
     }
 
-    if( numDevicesToUse == 0 ) numDevicesToUse = count; 
+    if( numDevicesToUse == 0 ) { 
+        numDevicesToUse = (count < blink1_max_devices) ? count : blink1_max_devices;
+    }
 
     if( verbose ) { 
         printf("deviceId[0] = %X\n", deviceIds[0]);
-        printf("cached list:\n");
-        for( int i=0; i< count; i++ ) { 
+        printf("cached list%s:\n", (enumerated) ? "" : " (from cache)");
+        for( int i=0; i< blink1_getCachedCount(); i++ ) { 
             printf("%d: serial: '%s' '%s'\n", 
                    i, blink1_getCachedSerial(i), blink1_getCachedPath(i) );
         }
     }
 
+    // these commands open devices as they go, the rest use global 'dev'
+    int opensOwn = ( cmd == CMD_LIST || cmd == CMD_FWVERSION ||
+                     cmd == CMD_RGB || cmd == CMD_ON  || cmd == CMD_OFF ||
+                     cmd == CMD_RED || cmd == CMD_BLU || cmd == CMD_GRN ||
+                     cmd == CMD_CYAN || cmd == CMD_MAGENTA || cmd == CMD_YELLOW ||
+                     cmd == CMD_BLINK || cmd == CMD_PLAYPATTERN || cmd == CMD_STREAM ||
+                     cmd == CMD_KEEPALIVE ||
+                     (cmd == CMD_RANDOM && count > 1) );
+
     // actually open up the device to start talking to it
-    if(verbose) printf("openById: %X\n", deviceIds[0]);
-    dev = blink1_openById( deviceIds[0] );
+    if( !opensOwn ) {
+        if(verbose) printf("openById: %X\n", deviceIds[0]);
+        dev = openDevice( deviceIds[0] );
 
-    if( dev == NULL ) { 
-        msg("cannot open blink(1), bad id or serial number\n");
-        exit(1);
+        if( dev == NULL ) { 
+            msg("cannot open blink(1), bad id or serial number\n");
+            exit(1);
+        }
+    }
+
+    if( benchStartup ) {
+        double openMillis = millisNow();
+        fprintf(stderr, "startup: %s %.2f ms, open %.2f ms%s, total %.2f ms\n",
+                (devicePath) ? "no enumeration" :
+                (enumerated) ? "enumerate" : "cache load",
+                enumMillis - startMillis, openMillis - enumMillis,
+                (opensOwn) ? " (deferred to command)" : "",
+                openMillis - startMillis);
     }
 
     // FIXME: verify mk2 does better gamma correction 
@@ -528,14 +901,17 @@ int main(int argc, char** argv)
     // begin command processing
 
     if( cmd == CMD_LIST ) {
-        blink1_close(dev);
-        printf("blink(1) list: \n");
-        for( int i=0; i< count; i++ ) {
-            dev = blink1_openBySerial( blink1_getCachedSerial(i) );
-            rc = blink1_getVersion(dev);
-            blink1_close(dev);
-            printf("id:%d - serialnum:%s %s fw version:%d\n", i, blink1_getCachedSerial(i), 
-                   (blink1_isMk2ById(i)) ? "(mk2)":"", rc);
+        blink1_probeAll( probeTimeout ); // all devices at once
+        if( cacheFile ) blink1_saveCache( cacheFile ); // now w/ fw versions
+        if( json ) {
+            printDevicesJson( count );
+        }
+        else {
+            printf("blink(1) list: \n");
+            for( int i=0; i< count; i++ ) {
+                printf("id:%d - serialnum:%s %s fw version:%d\n", i, blink1_getCachedSerial(i), 
+                       (blink1_isMk2ById(i)) ? "(mk2)":"", blink1_getCachedVersion(i));
+            }
         }
 #ifdef USE_HIDDATA
         printf("(Listing not supported in HIDDATA builds)\n"); 
@@ -559,22 +935,23 @@ int main(int argc, char** argv)
         }
     }
     else if( cmd == CMD_FWVERSION ) {
-        blink1_close(dev);
-        for( int i=0; i<count; i++ ) {
-            dev = blink1_openById( deviceIds[i] );
-            if( dev == NULL ) continue;
-            rc = blink1_getVersion(dev);
-            printf("id:%d - firmware:%d serialnum:%s %s\n", i, rc,
-                   blink1_getCachedSerial(i),
-                   (blink1_isMk2ById(i)) ? "(mk2)":"");
-            blink1_close(dev);
+        blink1_probeAll( probeTimeout );
+        if( cacheFile ) blink1_saveCache( cacheFile );
+        if( json ) {
+            printDevicesJson( count );
+        }
+        else {
+            for( int i=0; i<count; i++ ) {
+                printf("id:%d - firmware:%d serialnum:%s %s\n", i,
+                       blink1_getCachedVersion(i),
+                       blink1_getCachedSerial(i),
+                       (blink1_isMk2ById(i)) ? "(mk2)":"");
+            }
         }
     }
     else if( cmd == CMD_RGB || cmd == CMD_ON  || cmd == CMD_OFF ||
              cmd == CMD_RED || cmd == CMD_BLU || cmd == CMD_GRN ||
              cmd == CMD_CYAN || cmd == CMD_MAGENTA || cmd == CMD_YELLOW ) { 
-        blink1_close(dev); // close global device, open as needed
-        
         uint8_t r = rgbbuf.r;
         uint8_t g = rgbbuf.g;
         uint8_t b = rgbbuf.b;
@@ -658,20 +1035,20 @@ int main(int argc, char** argv)
     }
     else if( cmd == CMD_RANDOM ) { 
         int cnt = blink1_getCachedCount();
+        if( cnt > blink1_max_devices ) cnt = blink1_max_devices; // by index
         if( arg==0 ) arg = 1;
-        if( cnt>1 ) blink1_close(dev); // close global device, open as needed
         msg("random %d times: \n", arg);
         for( int i=0; i<arg; i++ ) { 
             uint8_t r = rand()%255;
             uint8_t g = rand()%255;
             uint8_t b = rand()%255 ;
-            uint8_t id = rand() % blink1_getCachedCount();
+            uint8_t id = rand() % cnt;
 
             msg("%d: %d/%d : %2.2x,%2.2x,%2.2x \n", 
-                i, id, blink1_getCachedCount(), r,g,b);
+                i, id, cnt, r,g,b);
 
             blink1_device* mydev = dev;
-            if( cnt > 1 ) mydev = blink1_openById( id );
+            if( cnt > 1 ) mydev = openDevice( id );
             if( ledn == 0 ) { 
                 rc = blink1_fadeToRGB(mydev, millis,r,g,b);
             } else {
@@ -748,7 +1125,6 @@ int main(int argc, char** argv)
         if( r == 0 && b == 0 && g == 0 ) {
             r = g = b = 255;
         }
-        blink1_close(dev);
         msg("blink %d times rgb:%x,%x,%x: \n", n,r,g,b);
         if( n == 0 ) n = -1; // repeat forever
         while( n==-1 || n-- ) { 
@@ -790,7 +1166,6 @@ int main(int argc, char** argv)
         blink1_serverdown( dev, on, delayMillis, st, startpos,endpos );
     }
     else if( cmd == CMD_PLAYPATTERN ) {
-        blink1_close(dev);
         msg("play pattern: %s\n",argbuf);
 
         int repeats = -1;
@@ -907,6 +1282,14 @@ int main(int argc, char** argv)
         msg("error triggering bootloader\n");
       }
     }
+    else if( cmd == CMD_STREAM ) {
+        rc = streamFrames( streamFps, millis, ledns, ledns_cnt );
+        if( rc == -1 ) exit(1);
+    }
+    else if( cmd == CMD_KEEPALIVE ) {
+        rc = keepaliveRun( delayMillis, cmdbuf[0], cmdbuf[1], cmdbuf[2] );
+        if( rc == -1 ) exit(1);
+    }
     else if( cmd == CMD_TESTTEST ) {
       msg("test test reportid:%d\n",reportid);
       rc = blink1_testtest(dev, reportid);
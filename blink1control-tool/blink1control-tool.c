@@ -17,6 +17,7 @@
 #include <getopt.h>    // for getopt_long()
 #include <unistd.h>    // usleep
 #include <time.h>
+#include <sys/time.h>  // gettimeofday
 
 #include <curl/curl.h>
 
@@ -60,6 +61,16 @@ struct curlMemoryStruct {
   size_t size;
 };
 
+// one handle for all single requests, so the connection to Blink1Control
+// is opened once and kept alive instead of once per request
+CURL* curl_shared = NULL;
+// for fanning a request out to several devices at once, handles are kept
+// between calls so their connections are reused too
+CURLM* curl_multi = NULL;
+CURL* curl_multiHandles[blink1_max_devices];
+
+int curl_requests = 0;  // for the wall time report
+
 
 // printf that can be shut up
 void msg(char* fmt, ...)
@@ -132,57 +143,143 @@ json_value* json_convert_value( json_value* jv)
     return NULL;
 }
 
-// do the actual fetch using curl lib
-char* curl_fetch( char* baseUrl, char* urlbuf)
+// combine baseUrl & urlbuf into urlstr, making sure not to double-up forward-slashes
+static void curl_makeUrl( char* urlstr, int urlmaxsize, char* baseUrl, char* urlbuf )
 {
-    CURL *curl_handle;
-    CURLcode res;
-
-    const int urlmaxsize = 1024; // 
-    char urlstr[urlmaxsize];
-    // combine baseUrl to urltsr, making sure not to double-up forward-slashes
-    if( baseUrl[strlen(baseUrl) - 1] == '/' ) { // ends in a slash
+    if( baseUrl[strlen(baseUrl) - 1] == '/' && urlbuf[0] == '/' ) {
       urlbuf++;
     }
     snprintf(urlstr, urlmaxsize, "%s%s", baseUrl, urlbuf);
+}
 
-    printf("curl_fetch:%s\n", urlstr);
-    
-    struct curlMemoryStruct chunk;
-
-    chunk.memory = malloc(1);  /* will be grown as needed by the realloc above */
-    chunk.size = 0;    /* no data at this point */
-    chunk.memory[0] = '\0';
-    curl_handle = curl_easy_init();  /* init the curl session */
+// set up a handle for a fetch into chunk
+static void curl_setup( CURL* curl_handle, char* urlstr, struct curlMemoryStruct* chunk )
+{
+    chunk->memory = malloc(1);  /* will be grown as needed by the realloc above */
+    chunk->size = 0;    /* no data at this point */
+    chunk->memory[0] = '\0';
     curl_easy_setopt(curl_handle, CURLOPT_URL, urlstr);  /* specify URL to get */
     /* send all data to this function  */
     curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, curlWriteMemoryCallback);
     /* we pass our 'chunk' struct to the callback function */
-    curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *)&chunk);
+    curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *)chunk);
     /* some servers don't like requests that are made without a user-agent
        field, so we provide one */
     curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, "blink1control-tool/1.0");
-    res = curl_easy_perform(curl_handle);    /* get it! */
+    curl_easy_setopt(curl_handle, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_requests++;
+}
+
+// print what came back, if really verbose
+static void curl_dump( struct curlMemoryStruct* chunk )
+{
+    // Now, our chunk.memory points to a memory block that is chunk.size
+    // bytes big and contains the remote file.
+    if( verbose > 1 ) {
+        msg("%lu bytes retrieved\n", (long)chunk->size);
+        for( int i=0; i<chunk->size; i++ ){
+            msg("%c",chunk->memory[i]);
+        }
+    }
+}
+
+// do the actual fetch using curl lib
+char* curl_fetch( char* baseUrl, char* urlbuf)
+{
+    CURLcode res;
+
+    const int urlmaxsize = 1024; // 
+    char urlstr[urlmaxsize];
+    curl_makeUrl( urlstr, urlmaxsize, baseUrl, urlbuf );
+
+    printf("curl_fetch:%s\n", urlstr);
+    
+    struct curlMemoryStruct chunk;
+
+    if( curl_shared == NULL ) {
+        curl_shared = curl_easy_init();  /* init the curl session */
+    }
+    curl_setup( curl_shared, urlstr, &chunk );
+    res = curl_easy_perform(curl_shared);    /* get it! */
     if(res != CURLE_OK) {   /* check for errors */
         fprintf(stderr, "curl_fetch failed: %s\n", curl_easy_strerror(res));
+        free(chunk.memory);
         return NULL;
     }
-    else {
-        // Now, our chunk.memory points to a memory block that is chunk.size
-        // bytes big and contains the remote file.
-        if( verbose > 1 ) {
-            msg("%lu bytes retrieved\n", (long)chunk.size);
-            for( int i=0; i<chunk.size; i++ ){
-                msg("%c",chunk.memory[i]);
-            }
+    curl_dump( &chunk );
+
+    return chunk.memory;
+}
+
+// fetch several urls at once, e.g. the same request for different devices
+// results[i] is the reply to urlbufs[i], or NULL if that one failed
+// returns number that failed
+int curl_fetchMany( char* baseUrl, char** urlbufs, char** results, int count )
+{
+    const int urlmaxsize = 1024; // 
+    char urlstrs[blink1_max_devices][urlmaxsize];
+    struct curlMemoryStruct chunks[blink1_max_devices];
+    int failed = 0;
+
+    if( count > blink1_max_devices ) count = blink1_max_devices;
+    if( curl_multi == NULL ) {
+        curl_multi = curl_multi_init();
+    }
+    for( int i=0; i < count; i++ ) {
+        curl_makeUrl( urlstrs[i], urlmaxsize, baseUrl, urlbufs[i] );
+        printf("curl_fetch:%s\n", urlstrs[i]);
+        if( curl_multiHandles[i] == NULL ) {
+            curl_multiHandles[i] = curl_easy_init();
         }
+        curl_setup( curl_multiHandles[i], urlstrs[i], &chunks[i] );
+        curl_easy_setopt(curl_multiHandles[i], CURLOPT_PRIVATE, (void*)(intptr_t)i);
+        curl_multi_add_handle( curl_multi, curl_multiHandles[i] );
+        results[i] = NULL;
     }
 
-    curl_easy_cleanup(curl_handle);   /* cleanup curl stuff */
-    //if(chunk.memory)
-    //    free(chunk.memory);
-    //return 0;
-    return chunk.memory;
+    int running = 0;
+    do {
+        CURLMcode mc = curl_multi_perform( curl_multi, &running );
+        if( mc == CURLM_OK && running ) {
+            mc = curl_multi_wait( curl_multi, NULL, 0, 1000, NULL );
+        }
+        if( mc != CURLM_OK ) {
+            fprintf(stderr, "curl_fetchMany failed: %s\n", curl_multi_strerror(mc));
+            break;
+        }
+    } while( running );
+
+    CURLMsg* m;
+    int left;
+    while( (m = curl_multi_info_read( curl_multi, &left )) != NULL ) {
+        if( m->msg != CURLMSG_DONE ) continue;
+        intptr_t i;
+        curl_easy_getinfo( m->easy_handle, CURLINFO_PRIVATE, (char**)&i );
+        if( m->data.result != CURLE_OK ) {
+            fprintf(stderr, "curl_fetch failed: %s\n", curl_easy_strerror(m->data.result));
+            continue;
+        }
+        curl_dump( &chunks[i] );
+        results[i] = chunks[i].memory;
+        chunks[i].memory = NULL;
+    }
+
+    for( int i=0; i < count; i++ ) {
+        curl_multi_remove_handle( curl_multi, curl_multiHandles[i] );
+        if( results[i] == NULL ) failed++;
+        free( chunks[i].memory );  // only those that didn't finish
+    }
+    return failed;
+}
+
+//
+void curl_fetchCleanup()
+{
+    for( int i=0; i < blink1_max_devices; i++ ) {
+        if( curl_multiHandles[i] ) curl_easy_cleanup( curl_multiHandles[i] );
+    }
+    if( curl_multi ) curl_multi_cleanup( curl_multi );
+    if( curl_shared ) curl_easy_cleanup( curl_shared );
 }
 
 //
@@ -227,15 +324,34 @@ int blink1control_fadeToRGBN( int tmillis, int r, int g, int b, char* idstr, int
         sprintf(idarg, "id=%s",idstr);
     }
     sprintf(urlbuf,
-            "/blink1/fadeToRGB?rgb=%%23%2.2x%2.2x%2.2x&time=%2.2f&ledn=%d&%s",
-            r,g,b, (tmillis/1000.0), ledn, idarg);
+            "/blink1/fadeToRGB?rgb=%%23%2.2x%2.2x%2.2x&time=%2.2f&ledn=%d&",
+            r,g,b, (tmillis/1000.0), ledn);
+
+    if( numDevicesToUse > 1 ) {  // one request per device, all at once
+        char devurls[blink1_max_devices][sizeof(urlbuf)+serialstrmax+4];
+        char* urls[blink1_max_devices];
+        char* results[blink1_max_devices];
+        for( int i=0; i < numDevicesToUse; i++ ) {
+            snprintf(devurls[i], sizeof(devurls[i]), "%sid=%s", urlbuf, deviceIds[i]);
+            urls[i] = devurls[i];
+            if( verbose > 0 ) msg("url: %s -- %s\n",baseUrl, urls[i]);
+        }
+        int failed = curl_fetchMany( baseUrl, urls, results, numDevicesToUse );
+        for( int i=0; i < numDevicesToUse; i++ ) {
+            free(results[i]);
+        }
+        return (failed) ? -1 : 0;
+    }
+
+    strcat(urlbuf, idarg);
     if( verbose > 0 ) msg("url: %s -- %s\n",baseUrl, urlbuf);
 
     char* js = curl_fetch( baseUrl, urlbuf );
+    if( js == NULL ) return -1;
 
     free(js);
 
-    return 0;  // FIXME:
+    return 0;
 }
 
 // simple cross-platform millis sleep func
@@ -569,13 +685,16 @@ int main(int argc, char** argv)
 
     char idstr[100] = "";
 
-    for( int i=0; i< numDevicesToUse; i++ ) {
-        sprintf(idstr, "%s,", deviceIds[i]);
+    if( numDevicesToUse == 1 ) {  // more than one are each sent on their own
+        strcpy(idstr, deviceIds[0]);
     }
     //printf("idstr: %s\n",idstr);
 
     curl_global_init(CURL_GLOBAL_ALL);
 
+    struct timeval tstart, tend;
+    gettimeofday(&tstart, NULL);
+
     if( cmd == CMD_VERSION ) {
         // FIXME: do something here
       msg("blink1control-tool version "BLINK1_VERSION"\n");
@@ -660,6 +779,15 @@ int main(int argc, char** argv)
         blink1control_printIds();
     }
 
+    gettimeofday(&tend, NULL);
+    if( curl_requests > 0 ) {
+        double ms = (tend.tv_sec - tstart.tv_sec) * 1000.0 +
+                    (tend.tv_usec - tstart.tv_usec) / 1000.0;
+        msg("%d request%s in %.1f ms\n", curl_requests,
+            (curl_requests==1) ? "" : "s", ms);
+    }
+
+    curl_fetchCleanup();
     curl_global_cleanup();   // we're done with libcurl, so clean it up
 
 }
@@ -0,0 +1,255 @@
+/*
+ * hidapi "fake" backend -- a hardware-free stand-in for blink(1) devices
+ *
+ * Implements the hidapi API with an in-memory emulation of the blink(1)
+ * feature-report protocol, so blink1-lib, blink1-tool and
+ * blink1-tiny-server can be built and exercised without lights attached.
+ *
+ * Environment variables:
+ *  BLINK1_FAKE_DEVICES  -- number of devices to pretend are plugged in (default 1)
+ *  BLINK1_FAKE_LATENCY  -- microseconds each feature report takes (default 1000)
+ *  BLINK1_FAKE_WEDGED   -- index of a device whose reports never complete
+ *  BLINK1_FAKE_ENUM_LATENCY -- microseconds an enumeration takes (default 20000)
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <unistd.h>
+
+#include "hidapi.h"
+
+#define FAKE_VID 0x27B8
+#define FAKE_PID 0x01ED
+#define FAKE_MAX_DEVICES 512
+#define FAKE_NUM_LEDS 18
+#define FAKE_PATT_LEN 32
+
+struct hid_device_ {
+    int index;
+    unsigned char reply[64];
+    unsigned char leds[FAKE_NUM_LEDS+1][3];
+    unsigned char patt[FAKE_PATT_LEN][6];  // r,g,b,dms_hi,dms_lo,ledn
+    unsigned char play[5];                  // playing,start,end,count,pos
+    unsigned char ledn;
+};
+
+static int fake_count = -1;
+static int fake_latency = 1000;
+static int fake_wedged = -1;
+static int fake_enum_latency = 20000;
+
+static void fake_serial(int i, char* buf, size_t len)
+{
+    snprintf(buf, len, "%8.8X", 0x20000000 + i + 1);
+}
+
+int HID_API_EXPORT hid_init(void)
+{
+    if( fake_count >= 0 ) return 0;
+    char* s;
+    fake_count = (s = getenv("BLINK1_FAKE_DEVICES")) ? atoi(s) : 1;
+    if( fake_count > FAKE_MAX_DEVICES ) fake_count = FAKE_MAX_DEVICES;
+    if( (s = getenv("BLINK1_FAKE_LATENCY")) ) fake_latency = atoi(s);
+    if( (s = getenv("BLINK1_FAKE_WEDGED")) )  fake_wedged  = atoi(s);
+    if( (s = getenv("BLINK1_FAKE_ENUM_LATENCY")) ) fake_enum_latency = atoi(s);
+    return 0;
+}
+
+int HID_API_EXPORT hid_exit(void)
+{
+    return 0;
+}
+
+struct hid_device_info HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+    struct hid_device_info *root = NULL, *prev = NULL;
+    hid_init();
+    if( (vendor_id && vendor_id != FAKE_VID) || (product_id && product_id != FAKE_PID) ) {
+        return NULL;
+    }
+    if( fake_enum_latency > 0 ) usleep(fake_enum_latency);
+    for( int i=0; i<fake_count; i++ ) {
+        struct hid_device_info* cur = calloc(1, sizeof(*cur));
+        char serial[16];
+        char path[32];
+        fake_serial(i, serial, sizeof(serial));
+        snprintf(path, sizeof(path), "fake:%d", i);
+        cur->path = strdup(path);
+        cur->vendor_id = FAKE_VID;
+        cur->product_id = FAKE_PID;
+        cur->serial_number = calloc(strlen(serial)+1, sizeof(wchar_t));
+        swprintf(cur->serial_number, strlen(serial)+1, L"%s", serial);
+        if( prev ) prev->next = cur; else root = cur;
+        prev = cur;
+    }
+    return root;
+}
+
+void HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
+{
+    while( devs ) {
+        struct hid_device_info* next = devs->next;
+        free(devs->path);
+        free(devs->serial_number);
+        free(devs);
+        devs = next;
+    }
+}
+
+static hid_device* fake_open(int i)
+{
+    hid_init();
+    if( i < 0 || i >= fake_count ) return NULL;
+    hid_device* dev = calloc(1, sizeof(*dev));
+    dev->index = i;
+    return dev;
+}
+
+hid_device * HID_API_EXPORT hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
+{
+    hid_init();
+    for( int i=0; i<fake_count; i++ ) {
+        char serial[16];
+        wchar_t wserial[16];
+        fake_serial(i, serial, sizeof(serial));
+        swprintf(wserial, 16, L"%s", serial);
+        if( serial_number == NULL || wcscmp(serial_number, wserial) == 0 ) {
+            return fake_open(i);
+        }
+    }
+    return NULL;
+}
+
+hid_device * HID_API_EXPORT hid_open_path(const char *path)
+{
+    if( path == NULL || strncmp(path, "fake:", 5) != 0 ) return NULL;
+    return fake_open( atoi(path+5) );
+}
+
+void HID_API_EXPORT hid_close(hid_device *dev)
+{
+    free(dev);
+}
+
+static void fake_delay(hid_device* dev)
+{
+    if( dev->index == fake_wedged ) {
+        for(;;) sleep(60);
+    }
+    if( fake_latency > 0 ) usleep(fake_latency);
+}
+
+// emulate the blink(1) mk2 command set
+int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
+{
+    if( dev == NULL || length < 8 ) return -1;
+    fake_delay(dev);
+    const unsigned char* b = data;
+    unsigned char* r = dev->reply;
+    memset(r, 0, sizeof(dev->reply));
+    memcpy(r, b, length < sizeof(dev->reply) ? length : sizeof(dev->reply));
+    switch( b[1] ) {
+    case 'v':
+        r[3] = '2'; r[4] = '5';
+        break;
+    case 'c':
+    case 'n': {
+        int n = (b[1]=='c') ? b[7] : 0;
+        for( int i=0; i<=FAKE_NUM_LEDS; i++ ) {
+            if( n == 0 || n == i ) {
+                dev->leds[i][0] = b[2]; dev->leds[i][1] = b[3]; dev->leds[i][2] = b[4];
+            }
+        }
+        break;
+    }
+    case 'r': {
+        int n = (b[7] <= FAKE_NUM_LEDS) ? b[7] : 0;
+        r[2] = dev->leds[n][0]; r[3] = dev->leds[n][1]; r[4] = dev->leds[n][2];
+        break;
+    }
+    case 'p':
+        dev->play[0] = b[2]; dev->play[1] = b[3]; dev->play[2] = b[4];
+        dev->play[3] = b[5]; dev->play[4] = b[3];
+        break;
+    case 'S':
+        memcpy(r+2, dev->play, 5);
+        break;
+    case 'l':
+        dev->ledn = b[2];
+        break;
+    case 'P':
+        if( b[7] < FAKE_PATT_LEN ) {
+            memcpy(dev->patt[b[7]], b+2, 5);
+            dev->patt[b[7]][5] = dev->ledn;
+        }
+        break;
+    case 'R':
+        if( b[7] < FAKE_PATT_LEN ) {
+            memcpy(r+2, dev->patt[b[7]], 5);
+            r[7] = dev->patt[b[7]][5];
+        }
+        break;
+    }
+    return (int)length;
+}
+
+int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data, size_t length)
+{
+    if( dev == NULL ) return -1;
+    fake_delay(dev);
+    memcpy(data, dev->reply, length < sizeof(dev->reply) ? length : sizeof(dev->reply));
+    return (int)length;
+}
+
+int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length)
+{
+    return -1;
+}
+
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+    return -1;
+}
+
+int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
+{
+    return -1;
+}
+
+int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
+{
+    return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_manufacturer_string(hid_device *dev, wchar_t *string, size_t maxlen)
+{
+    swprintf(string, maxlen, L"ThingM");
+    return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_product_string(hid_device *dev, wchar_t *string, size_t maxlen)
+{
+    swprintf(string, maxlen, L"blink(1) mk2 (fake)");
+    return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_serial_number_string(hid_device *dev, wchar_t *string, size_t maxlen)
+{
+    char serial[16];
+    fake_serial(dev->index, serial, sizeof(serial));
+    swprintf(string, maxlen, L"%s", serial);
+    return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index, wchar_t *string, size_t maxlen)
+{
+    return -1;
+}
+
+HID_API_EXPORT const wchar_t * HID_API_CALL hid_error(hid_device *dev)
+{
+    return L"fake device error";
+}
@@ -0,0 +1,41 @@
+#!/bin/bash
+#
+# batch-bench.sh -- compare one /blink1/batch request against N single requests
+#
+# Usage: batch-bench.sh [host:port] [ndevs] [rounds]
+#
+# Each round sets a color on ndevs blink(1)s, first with ndevs
+# '/blink1/fadeToRGB?id=i' requests over one keep-alive connection,
+# then with one POST to '/blink1/batch'.  Needs curl.
+#
+
+HOST=${1:-localhost:8000}
+NDEVS=${2:-8}
+ROUNDS=${3:-20}
+
+singles() {
+    urls=""
+    for (( i=0; i<NDEVS; i++ )); do
+        urls="$urls http://$HOST/blink1/fadeToRGB?id=$i&rgb=%23ff00ff&millis=0"
+    done
+    for (( r=0; r<ROUNDS; r++ )); do
+        curl -s $urls > /dev/null
+    done
+}
+
+batch() {
+    ops=""
+    for (( i=0; i<NDEVS; i++ )); do
+        ops="$ops${ops:+,}{\"op\":\"set\",\"id\":$i,\"rgb\":\"#ff00ff\"}"
+    done
+    for (( r=0; r<ROUNDS; r++ )); do
+        curl -s -X POST -d "[$ops]" http://$HOST/blink1/batch > /dev/null
+    done
+}
+
+TIMEFORMAT="%R"
+echo "$ROUNDS rounds of $NDEVS devices on $HOST"
+t=$( { time singles; } 2>&1 )
+awk -v t=$t -v n=$ROUNDS -v d=$NDEVS 'BEGIN { printf("  %3d single requests: %6.3fs total, %7.2f ms/round\n", d, t, t*1000/n) }'
+t=$( { time batch; } 2>&1 )
+awk -v t=$t -v n=$ROUNDS 'BEGIN { printf("    1 batch request:   %6.3fs total, %7.2f ms/round\n", t, t*1000/n) }'
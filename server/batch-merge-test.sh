@@ -0,0 +1,37 @@
+#!/bin/bash
+#
+# batch-merge-test.sh -- check a batch whose ops supersede each other
+#
+# Usage: batch-merge-test.sh [server] [port]
+#
+# With a slow device busy on one color, POSTs a batch whose second op
+# supersedes its first on the same device, so the first finishes while
+# the batch is still being queued.  Passes if the batch gets one
+# complete reply and the server keeps serving.  Build the server with
+# USBLIB_TYPE=HIDAPI_FAKE, and with CC="gcc -fsanitize=address" to
+# also catch memory errors.
+#
+
+SERVER=${1:-./blink1-tiny-server}
+PORT=${2:-8098}
+URL=http://localhost:$PORT
+
+BLINK1_FAKE_DEVICES=1 BLINK1_FAKE_LATENCY=300000 "$SERVER" -p $PORT > /dev/null &
+pid=$!
+trap "kill $pid 2>/dev/null" EXIT
+sleep 0.5
+
+fail=0
+curl -s -m 5 $URL/blink1/blue > /dev/null &   # keeps the device busy
+busy=$!
+sleep 0.1
+reply=$(curl -s -m 5 -X POST $URL/blink1/batch \
+        -d '[{"op":"fade","id":0,"rgb":"#ff0000"},{"op":"off","id":0}]')
+wait $busy
+echo "$reply"
+[ $(echo "$reply" | grep -c '"op": ') -eq 2 ] || fail=1
+curl -s -m 5 $URL/blink1 > /dev/null || fail=1
+kill -0 $pid 2>/dev/null || fail=1
+
+[ $fail -eq 0 ] && echo "ok" || echo "FAILED"
+exit $fail
@@ -0,0 +1,219 @@
+/*
+ * batch -- many blink(1) operations in one request
+ *
+ * see batch.h
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "devmgr.h"
+#include "jobs.h"
+#include "batch.h"
+#include "pool.h"
+
+// add devices named by a JSON number, string or array of those to set
+// returns -1 on an unknown id
+static int batch_parseIds( json_value* jv, devmgr_set* set )
+{
+    char idstr[200];
+    int i;
+    switch( jv->type ) {
+    case json_integer:
+        i = devmgr_indexById( jv->u.integer );
+        if( i < 0 ) return -1;
+        devmgr_set_add( set, i );
+        return 0;
+    case json_string:
+        snprintf(idstr, sizeof(idstr), "%s", jv->u.string.ptr);
+        return ( devmgr_parseIds( idstr, set ) < 0 ) ? -1 : 0;
+    case json_array:
+        for( unsigned int j=0; j < jv->u.array.length; j++ ) {
+            if( batch_parseIds( jv->u.array.values[j], set ) < 0 ) return -1;
+        }
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+// get a number from a JSON int or double
+static double batch_num( json_value* jv )
+{
+    if( jv->type == json_integer ) return jv->u.integer;
+    if( jv->type == json_double )  return jv->u.dbl;
+    return 0;
+}
+
+//
+int batch_parseOp( json_value* jv, batch_op* bop, char* errstr, int errlen )
+{
+    json_value* idv = NULL;
+    rgb_t rgb = {0,0,0};
+    double millis = 100;
+    double ledn = 0;
+    int start = 0, end = 0, count = 0;
+
+    if( jv->type != json_object ) {
+        snprintf(errstr, errlen, "op is not an object");
+        return -1;
+    }
+    memset( bop, 0, sizeof(batch_op) );
+    for( unsigned int i=0; i < jv->u.object.length; i++ ) {
+        const char* name = jv->u.object.values[i].name;
+        json_value* v = jv->u.object.values[i].value;
+        if( strcmp(name, "op") == 0 && v->type == json_string ) {
+            const char* ops[] = { "fade", "set", "play", "stop", "off" };
+            for( int j=0; j < 5; j++ ) {
+                if( strcmp(v->u.string.ptr, ops[j]) == 0 ) bop->name = ops[j];
+            }
+        }
+        else if( strcmp(name, "id") == 0 )     idv = v;
+        else if( strcmp(name, "rgb") == 0 && v->type == json_string ) {
+            parsecolor( &rgb, v->u.string.ptr );
+        }
+        else if( strcmp(name, "millis") == 0 ) millis = batch_num(v);
+        else if( strcmp(name, "time") == 0 )   millis = 1000 * batch_num(v);
+        else if( strcmp(name, "ledn") == 0 )   ledn = batch_num(v);
+        else if( strcmp(name, "start") == 0 )  start = batch_num(v);
+        else if( strcmp(name, "end") == 0 )    end = batch_num(v);
+        else if( strcmp(name, "count") == 0 )  count = batch_num(v);
+        else if( strcmp(name, "delay") == 0 )  bop->delay = batch_num(v);
+    }
+    if( bop->name == NULL ) {
+        snprintf(errstr, errlen, "missing or unknown 'op'");
+        return -1;
+    }
+    if( idv == NULL ) {  // same default as single requests, first device
+        if( devmgr_count() > 0 ) devmgr_set_add( &bop->devs, 0 );
+    }
+    else if( batch_parseIds( idv, &bop->devs ) < 0 ) {
+        snprintf(errstr, errlen, "unknown blink1 id");
+        return -1;
+    }
+    for( int i=0; i < devmgr_max; i++ ) {
+        if( devmgr_set_has( &bop->devs, i ) ) bop->ndevs++;
+    }
+    if( bop->ndevs == 0 ) {
+        snprintf(errstr, errlen, "couldn't find blink1");
+        return -1;
+    }
+    if( ledn < 0 || ledn >= devmgr_leds_max || ledn != (int)ledn ) {
+        snprintf(errstr, errlen, "bad ledn, must be 0-%d", devmgr_leds_max - 1);
+        return -1;
+    }
+    bop->op.ledn = ledn;
+    if( millis < 0 ) millis = 0;
+    if( millis > 65535 ) millis = 65535;
+    if( bop->delay < 0 ) bop->delay = 0;
+
+    devop_t* op = &bop->op;
+    if( strcmp(bop->name, "play") == 0 || strcmp(bop->name, "stop") == 0 ) {
+        op->type = DEVOP_PLAY;
+        op->play = (bop->name[1] == 'l');
+        op->startpos = start;
+        op->endpos = end;
+        op->count = count;
+    } else {
+        op->type = DEVOP_FADE;
+        op->millis = (strcmp(bop->name, "set") == 0) ? 0 : millis;
+        if( strcmp(bop->name, "off") != 0 ) {
+            op->r = rgb.r; op->g = rgb.g; op->b = rgb.b;
+        }
+    }
+    return 0;
+}
+
+//
+int batch_parse( const char* json, size_t len, batch_t* b,
+                 char* errstr, int errlen )
+{
+    memset( b, 0, sizeof(batch_t) );
+    json_value* jv = pool_jsonParse( json, len );
+    if( jv == NULL || jv->type != json_array ) {
+        snprintf(errstr, errlen, "batch must be a JSON array of ops");
+        pool_jsonFree( jv );
+        return -1;
+    }
+    int rc = 0;
+    if( jv->u.array.length > batch_max ) {
+        snprintf(errstr, errlen, "too many ops, max %d", batch_max);
+        rc = -1;
+    }
+    for( unsigned int i=0; rc == 0 && i < jv->u.array.length; i++ ) {
+        char operr[100];
+        if( batch_parseOp( jv->u.array.values[i], &b->ops[i], operr, sizeof(operr) ) < 0 ) {
+            snprintf(errstr, errlen, "op %d: %s", i, operr);
+            rc = -1;
+        }
+        b->nops++;
+    }
+    pool_jsonFree( jv );
+    return (rc == 0) ? b->nops : -1;
+}
+
+//
+int batch_run( batch_t* b, unsigned long reqid )
+{
+    // count every op as pending up front: submitting a later op can
+    // finish an earlier one right away, if it supersedes it
+    b->pending = 0;
+    for( int i=0; i < b->nops; i++ ) {
+        batch_op* bop = &b->ops[i];
+        bop->pending = (bop->delay > 0) ? 0 : bop->ndevs;
+        b->pending += bop->pending;
+    }
+    b->submitting = 1;
+    for( int i=0; i < b->nops; i++ ) {
+        batch_op* bop = &b->ops[i];
+        if( bop->delay > 0 ) {
+            bop->jobid = jobs_schedule( &bop->op, &bop->devs, bop->delay );
+            if( bop->jobid < 0 ) bop->failed = bop->ndevs;
+            continue;
+        }
+        bop->op.reqid = reqid;
+        bop->op.tag = i;
+        for( int d=0; d < devmgr_max; d++ ) {
+            if( !devmgr_set_has( &bop->devs, d ) ) continue;
+            if( devmgr_submit( d, &bop->op ) != 0 ) {
+                bop->pending--;
+                b->pending--;
+                bop->failed++;
+            }
+        }
+    }
+    b->submitting = 0;
+    return b->pending;
+}
+
+//
+int batch_done( batch_t* b, devop_result* res )
+{
+    if( res->tag < 0 || res->tag >= b->nops ) return 0;
+    batch_op* bop = &b->ops[ res->tag ];
+    if( bop->pending == 0 ) return 0;
+    bop->pending--;
+    if( res->rc != 0 ) bop->failed++;
+    return ( --b->pending == 0 && !b->submitting );
+}
+
+//
+void batch_results( batch_t* b, jsonw* w )
+{
+    jsonw_arr( w );
+    for( int i=0; i < b->nops; i++ ) {
+        batch_op* bop = &b->ops[i];
+        const char* status = (bop->failed == bop->ndevs) ? "failed" :
+            (bop->jobid > 0) ? "scheduled" : (bop->failed) ? "partial" : "ok";
+        jsonw_obj( w );
+        jsonw_kstr( w, "op", bop->name );
+        jsonw_kint( w, "devices", bop->ndevs );
+        jsonw_kint( w, "failed", bop->failed );
+        jsonw_kstr( w, "status", status );
+        if( bop->jobid > 0 ) jsonw_kint( w, "job_id", bop->jobid );
+        jsonw_end( w );
+    }
+    jsonw_end( w );
+}
@@ -0,0 +1,80 @@
+/*
+ * batch -- many blink(1) operations in one request
+ *
+ * A batch is a JSON array of ops, e.g.:
+ *
+ *  [ {"op":"fade", "id":[0,1], "rgb":"#ff0000", "millis":500},
+ *    {"op":"set",  "id":"2000ABCD", "ledn":2, "rgb":"#00ff00"},
+ *    {"op":"play", "id":"all", "start":0, "end":3, "count":2},
+ *    {"op":"off",  "id":3, "delay":5000} ]
+ *
+ * The whole batch is parsed and checked before anything is sent, so a
+ * bad op means none are done.  Ops without a "delay" are queued on every
+ * device at once and run concurrently on the device workers; delayed ops
+ * become one-shot jobs.
+ *
+ */
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "json.h"  // https://github.com/udp/json-parser
+
+#include "devmgr.h"
+#include "jsonw.h"
+
+#define batch_max  64   // ops per batch
+
+typedef struct batch_op_ {
+    const char* name;    // "fade", "set", "play", "stop", "off"
+    devop_t op;
+    devmgr_set devs;
+    int ndevs;
+    int delay;           // millis before starting, 0 = now
+    int jobid;           // if delayed
+    int pending;         // devices not done yet
+    int failed;          // devices that errored
+} batch_op;
+
+typedef struct batch_ {
+    int nops;
+    int pending;         // total devices not done yet, over all ops
+    int submitting;      // in batch_run(), so not done even if pending hits 0
+    batch_op ops[batch_max];
+} batch_t;
+
+/**
+ * Parse a JSON array of ops into b.
+ * @param errstr filled in with reason if parse fails
+ * @return number of ops, or -1 on error
+ */
+int batch_parse( const char* json, size_t len, batch_t* b,
+                 char* errstr, int errlen );
+
+/**
+ * Parse one op object into bop.
+ * @return 0 on success, -1 with errstr filled in on error
+ */
+int batch_parseOp( json_value* jv, batch_op* bop, char* errstr, int errlen );
+
+/**
+ * Queue immediate ops on device workers and schedule delayed ones.
+ * Immediate ops notify with 'reqid' and their op index as the tag.
+ * @return number of device ops to wait for
+ */
+int batch_run( batch_t* b, unsigned long reqid );
+
+/**
+ * Account for a finished device op.  An op superseded by a later one in
+ * the same batch finishes while batch_run() is still going, that never
+ * counts as the last one.
+ * @return 1 if that was the last one the batch was waiting on
+ */
+int batch_done( batch_t* b, devop_result* res );
+
+/**
+ * Write per-op results as a JSON array.
+ */
+void batch_results( batch_t* b, jsonw* w );
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ * binproto -- compact binary command protocol for blink1-tiny-server
+ *
+ * see binproto.h
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mongoose.h"
+#include "devmgr.h"
+#include "metrics.h"
+#include "binproto.h"
+
+typedef struct binproto_tally_ {
+    int ops;
+    int coalesced;
+    int errors;
+    devmgr_set touched;
+} binproto_tally;
+
+// do one frame on device i
+static int binproto_applyDev( int i, const uint8_t* p )
+{
+    devop_t op;
+    memset( &op, 0, sizeof(op) );
+    switch( p[6] ) {
+    case 'c':
+    case 'q':
+        op.type = DEVOP_FADE;
+        op.ledn = p[5];
+        op.r = p[7]; op.g = p[8]; op.b = p[9];
+        op.millis = (p[10] << 8) | p[11];
+        return (p[6] == 'c') ? devmgr_stream( i, &op ) : devmgr_submit( i, &op );
+    case 'p':
+    case 's':
+        op.type = DEVOP_PLAY;
+        op.play = (p[6] == 'p');
+        op.startpos = p[7]; op.endpos = p[8]; op.count = p[9];
+        return devmgr_submit( i, &op );
+    default:
+        return -1;
+    }
+}
+
+// do frames in buf, return seq of last one
+static unsigned long binproto_apply( const uint8_t* buf, int len, binproto_tally* t )
+{
+    unsigned long seq = 0;
+    for( const uint8_t* p = buf; p + binproto_frame_size <= buf + len;
+         p += binproto_frame_size ) {
+        seq = ((unsigned long)p[0]<<24) | (p[1]<<16) | (p[2]<<8) | p[3];
+        int first = p[4], last = p[4];
+        if( p[4] == 255 ) {
+            first = 0;
+            last = devmgr_count() - 1;
+        }
+        else if( devmgr_get( p[4] ) == NULL ) {
+            t->errors++;
+            continue;
+        }
+        if( (p[6] == 'c' || p[6] == 'q') && p[5] >= devmgr_leds_max ) {
+            t->errors++;  // no such LED, don't send it anywhere
+            continue;
+        }
+        for( int i = first; i <= last; i++ ) {
+            int rc = binproto_applyDev( i, p );
+            if( rc < 0 ) t->errors++;
+            else if( rc == 1 ) t->coalesced++;
+            devmgr_set_add( &t->touched, i );
+        }
+        t->ops++;
+    }
+    return seq;
+}
+
+//
+static void binproto_udp( struct mg_connection* nc, int ev, void* ev_data )
+{
+    (void) ev_data;
+    if( ev != MG_EV_RECV ) return;
+    double start = mg_time();
+    struct mbuf* io = &nc->recv_mbuf;
+    if( io->len % binproto_frame_size == 0 &&
+        io->len <= binproto_frame_size * binproto_frames_max ) {
+        binproto_tally t;
+        memset( &t, 0, sizeof(t) );
+        binproto_apply( (const uint8_t*)io->buf, io->len, &t );
+    }
+    mbuf_remove( io, io->len );  // one datagram per event
+    metrics_request( "binary/udp", start );
+}
+
+// put a big-endian uint16 at p
+static void binproto_put16( uint8_t* p, int v )
+{
+    if( v > 0xffff ) v = 0xffff;
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+//
+static void binproto_tcp( struct mg_connection* nc, int ev, void* ev_data )
+{
+    (void) ev_data;
+    if( ev != MG_EV_RECV ) return;
+    struct mbuf* io = &nc->recv_mbuf;
+
+    // all the complete messages that have come in, acked in order
+    while( io->len >= 2 ) {
+        const uint8_t* b = (const uint8_t*) io->buf;
+        int len = (b[0] << 8) | b[1];
+        if( len % binproto_frame_size != 0 || len > binproto_frame_size * binproto_frames_max ) {
+            nc->flags |= MG_F_CLOSE_IMMEDIATELY;  // lost framing, can't recover
+            return;
+        }
+        if( (int)io->len < 2 + len ) break;
+
+        double start = mg_time();
+        binproto_tally t;
+        memset( &t, 0, sizeof(t) );
+        unsigned long seq = binproto_apply( b + 2, len, &t );
+        int backlog = 0;
+        for( int i=0; i < devmgr_count(); i++ ) {
+            if( devmgr_set_has( &t.touched, i ) ) backlog += devmgr_streamBacklog( i );
+        }
+        uint8_t ack[2 + binproto_ack_size];
+        binproto_put16( ack, binproto_ack_size );
+        ack[2] = seq >> 24; ack[3] = seq >> 16; ack[4] = seq >> 8; ack[5] = seq;
+        binproto_put16( ack+6, t.ops );
+        binproto_put16( ack+8, t.coalesced );
+        binproto_put16( ack+10, backlog );
+        binproto_put16( ack+12, t.errors );
+        mg_send( nc, ack, sizeof(ack) );
+        mbuf_remove( io, 2 + len );
+        metrics_request( "binary/tcp", start );
+    }
+}
+
+//
+int binproto_bind( struct mg_mgr* mgr, const char* port, const char** errstr )
+{
+    char addr[100];
+    struct mg_bind_opts opts;
+    memset( &opts, 0, sizeof(opts) );
+    opts.error_string = errstr;
+
+    snprintf(addr, sizeof(addr), "udp://%s", port);
+    struct mg_connection* nc = mg_bind_opt( mgr, addr, binproto_udp, opts );
+    if( nc == NULL ) return -1;
+    // room for bursts while the loop is busy, colors that don't fit are lost
+    int rcvbuf = binproto_udp_rcvbuf;
+    setsockopt( nc->sock, SOL_SOCKET, SO_RCVBUF, (const char*)&rcvbuf, sizeof(rcvbuf) );
+
+    snprintf(addr, sizeof(addr), "tcp://%s", port);
+    if( mg_bind_opt( mgr, addr, binproto_tcp, opts ) == NULL ) return -1;
+    return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * binproto -- compact binary command protocol for blink1-tiny-server
+ *
+ * For producers that send colors in tight loops and don't want HTTP
+ * parsing or replies.  Commands are fixed-size 12-byte frames:
+ *
+ *   offset  size
+ *    0      4     seq, big-endian, echoed in TCP acks
+ *    4      1     device index, 255 = all devices
+ *    5      1     ledn, 0 = all LEDs
+ *    6      1     command:
+ *                   'c' fade, only the latest color per LED is written
+ *                   'q' fade, queued so every color is written
+ *                   'p' play pattern, r = start, g = end, b = count
+ *                   's' stop pattern
+ *    7      3     r, g, b
+ *   10      2     fade millis, big-endian
+ *
+ * Over UDP a datagram holds one or more frames and nothing is sent back.
+ * Over TCP each message is a 2-byte big-endian length then that many
+ * bytes of frames; messages can be pipelined, and each is answered in
+ * order with a 2-byte length (12) and a 12-byte ack:
+ *
+ *    0      4     seq of the message's last frame
+ *    4      2     frames applied
+ *    6      2     coalesced, frames that replaced a color not yet written
+ *    8      2     backlog, LEDs still waiting to be written on those devices
+ *   10      2     errors, frames for unknown devices, full queues or bad commands
+ *
+ * 'c' frames go through devmgr_stream(), the same path as /blink1/ws.
+ *
+ */
+
+#ifndef __BINPROTO_H__
+#define __BINPROTO_H__
+
+#include "mongoose.h"
+
+#define binproto_frame_size   12
+#define binproto_ack_size     12
+#define binproto_frames_max   256   // per datagram or TCP message
+#define binproto_udp_rcvbuf   (1024*1024)
+
+/**
+ * Listen for binary frames on UDP and TCP on port.
+ * @return 0 on success, -1 with errstr set if either couldn't be bound
+ */
+int binproto_bind( struct mg_mgr* mgr, const char* port, const char** errstr );
+
+#endif
@@ -0,0 +1,426 @@
+/*
+ *
+ * blink1-server-bench -- load generator & latency report for blink1-tiny-server
+ *
+ * Opens a number of keep-alive connections to a running server and keeps
+ * one request outstanding on each, picking URIs from a weighted mix,
+ * then reports throughput and latency percentiles overall and per URI.
+ *
+ * To measure the server without lights attached, build it with the
+ * fake HID backend and tell it how many devices to pretend it has:
+ *
+ *   make clean && make USBLIB_TYPE=HIDAPI_FAKE blink1-tiny-server blink1-server-bench
+ *   BLINK1_FAKE_DEVICES=8 ./blink1-tiny-server -p 8000 &
+ *   ./blink1-server-bench -c 16 -t 10
+ *
+ * or to compare with the server's Unix domain socket (see unixsock.h):
+ *
+ *   ./blink1-tiny-server -s /tmp/blink1.sock &
+ *   ./blink1-server-bench -s /tmp/blink1.sock -c 16 -t 10
+ *
+ * or its CoAP endpoint (see coap.h), each "connection" a UDP socket
+ * with one confirmable request outstanding:
+ *
+ *   ./blink1-tiny-server -C 5683 &
+ *   ./blink1-server-bench -u 127.0.0.1:5683 -c 16 -t 10
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mongoose.h"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+const char* blink1_server_bench_version = "0.99";
+
+#define bench_uris_max   16
+#define bench_conns_max  1024
+#define bench_coap_timeout  2.0   // secs before a CoAP request counts as lost
+
+static const char* s_default_mix =
+    "/blink1/fadeToRGB?rgb=%23ff00ff&millis=0:8,"
+    "/blink1/off:4,"
+    "/blink1/blink?rgb=%2300ff00&time=0.1&count=1:1,"
+    "/blink1/jobs:1";
+
+typedef struct bench_uri_ {
+    char uri[200];
+    int weight;
+    double* lat;       // latencies in millis
+    int nlat;
+    int maxlat;
+    int errors;        // non-2xx replies
+} bench_uri;
+
+typedef struct bench_conn_ {
+    int uri;           // index of uri in flight
+    double sent;       // mg_time() request was sent
+    uint16_t mid;      // CoAP message id in flight
+} bench_conn;
+
+static bench_uri uris[bench_uris_max];
+static int nuris = 0;
+static int total_weight = 0;
+
+static const char* s_host = "localhost:8000";
+static const char* s_unix_path = NULL;
+static const char* s_coap_host = NULL;
+static int s_conns = 8;
+static double s_secs = 10;
+static double s_end = 0;
+static int s_open = 0;        // connections still open
+static int s_failed = 0;      // connections that errored
+static int s_rejected = 0;    // 429 replies
+
+// parse "uri:weight,uri:weight,..." into uris
+static int parse_mix( const char* mixstr )
+{
+    char buf[2000];
+    snprintf(buf, sizeof(buf), "%s", mixstr);
+    for( char* tok = strtok(buf, ","); tok != NULL && nuris < bench_uris_max;
+         tok = strtok(NULL, ",") ) {
+        bench_uri* u = &uris[nuris];
+        char* colon = strrchr(tok, ':');
+        u->weight = 1;
+        if( colon ) {
+            *colon = '\0';
+            u->weight = strtol(colon+1, NULL, 10);
+            if( u->weight < 1 ) u->weight = 1;
+        }
+        snprintf(u->uri, sizeof(u->uri), "%s", tok);
+        total_weight += u->weight;
+        nuris++;
+    }
+    return nuris;
+}
+
+//
+static int pick_uri(void)
+{
+    int w = rand() % total_weight;
+    for( int i=0; i < nuris; i++ ) {
+        if( w < uris[i].weight ) return i;
+        w -= uris[i].weight;
+    }
+    return 0;
+}
+
+//
+static void record( bench_uri* u, double millis )
+{
+    if( u->nlat == u->maxlat ) {
+        u->maxlat = (u->maxlat) ? u->maxlat * 2 : 4096;
+        u->lat = realloc( u->lat, u->maxlat * sizeof(double) );
+    }
+    u->lat[ u->nlat++ ] = millis;
+}
+
+//
+static void send_request( struct mg_connection* nc )
+{
+    bench_conn* c = (bench_conn*) nc->user_data;
+    c->uri = pick_uri();
+    c->sent = mg_time();
+    mg_printf(nc, "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n", uris[c->uri].uri, s_host);
+}
+
+// length of the complete reply at the front of buf, or 0 if not all here yet.
+// Replies are parsed by hand since mongoose's client side doesn't reset its
+// chunked-encoding state between replies on a keep-alive connection.
+static int reply_len( const char* buf, int len, int* status )
+{
+    const char* hdrend = c_strnstr( buf, "\r\n\r\n", len );  // not NUL-terminated
+    if( hdrend == NULL ) return 0;
+    int hlen = hdrend - buf + 4;
+    *status = (len > 12) ? strtol(buf+9, NULL, 10) : 0;
+
+    const char* cl = c_strnstr( buf, "Content-Length:", hlen );
+    if( cl ) {
+        int blen = strtol(cl+15, NULL, 10);
+        return (len >= hlen + blen) ? hlen + blen : 0;
+    }
+    if( c_strnstr( buf, "chunked", hlen ) ) {
+        const char* end = c_strnstr( buf + hlen, "\r\n0\r\n\r\n", len - hlen );
+        if( end == NULL && len - hlen >= 5 && memcmp(buf+hlen, "0\r\n\r\n", 5) == 0 ) {
+            return hlen + 5;
+        }
+        return (end) ? (end - buf) + 7 : 0;
+    }
+    return hlen;  // no body
+}
+
+static void ev_handler( struct mg_connection* nc, int ev, void* ev_data )
+{
+    bench_conn* c = (bench_conn*) nc->user_data;
+    int status, n;
+
+    switch( ev ) {
+    case MG_EV_CONNECT:
+        if( *(int*) ev_data != 0 ) {
+            s_failed++;
+            break;
+        }
+        send_request( nc );
+        break;
+    case MG_EV_RECV:
+        while( (n = reply_len( nc->recv_mbuf.buf, nc->recv_mbuf.len, &status )) > 0 ) {
+            mbuf_remove( &nc->recv_mbuf, n );
+            bench_uri* u = &uris[c->uri];
+            if( status == 429 ) s_rejected++;
+            if( status < 200 || status > 299 ) {
+                u->errors++;
+            } else {
+                record( u, (mg_time() - c->sent) * 1000 );
+            }
+            if( mg_time() < s_end ) {
+                send_request( nc );
+            } else {
+                nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+            }
+        }
+        break;
+    case MG_EV_CLOSE:
+        if( mg_time() < s_end ) s_failed++;
+        free( c );
+        nc->user_data = NULL;
+        s_open--;
+        break;
+    }
+}
+
+// send a confirmable CoAP request for a URI picked from the mix,
+// path segments & query args as Uri-Path & Uri-Query options
+static void send_coap( struct mg_connection* nc )
+{
+    bench_conn* c = (bench_conn*) nc->user_data;
+    struct mg_coap_message cm;
+    char uri[200];
+    c->uri = pick_uri();
+    snprintf(uri, sizeof(uri), "%s", uris[c->uri].uri);
+    memset( &cm, 0, sizeof(cm) );
+    cm.msg_type = MG_COAP_MSG_CON;
+    cm.code_class = MG_COAP_CODECLASS_REQUEST;
+    cm.code_detail = 1;  // GET
+    cm.msg_id = ++c->mid;
+    cm.token = mg_mk_str_n( (const char*)&c->mid, sizeof(c->mid) );
+
+    char* query = strchr( uri, '?' );
+    if( query ) *query++ = '\0';
+    for( char* seg = strtok( uri, "/" ); seg; seg = strtok( NULL, "/" ) ) {
+        mg_coap_add_option( &cm, 11, seg, strlen(seg) );
+    }
+    for( char* arg = (query) ? strtok( query, "&" ) : NULL; arg; arg = strtok( NULL, "&" ) ) {
+        mg_coap_add_option( &cm, 15, arg, strlen(arg) );
+    }
+    c->sent = mg_time();
+    mg_coap_send_message( nc, &cm );
+    mg_coap_free_options( &cm );
+}
+
+static void coap_handler( struct mg_connection* nc, int ev, void* ev_data )
+{
+    bench_conn* c = (bench_conn*) nc->user_data;
+    struct mg_coap_message* cm = (struct mg_coap_message*) ev_data;
+
+    switch( ev ) {
+    case MG_EV_CONNECT:
+        if( *(int*) ev_data != 0 ) {
+            s_failed++;
+            break;
+        }
+        send_coap( nc );
+        break;
+    case MG_EV_COAP_ACK:
+        if( cm->msg_id != c->mid ) break;  // late reply to a lost request
+        if( cm->code_class == 4 && cm->code_detail == 29 ) s_rejected++;
+        if( cm->code_class != MG_COAP_CODECLASS_RESP_OK ) {
+            uris[c->uri].errors++;
+        } else {
+            record( &uris[c->uri], (mg_time() - c->sent) * 1000 );
+        }
+        if( mg_time() < s_end ) {
+            send_coap( nc );
+        } else {
+            nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+        }
+        break;
+    case MG_EV_POLL:
+        if( c->sent > 0 && mg_time() - c->sent > bench_coap_timeout ) {
+            uris[c->uri].errors++;  // no retransmits, just move on
+            if( mg_time() < s_end ) send_coap( nc );
+            else nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+        }
+        break;
+    case MG_EV_CLOSE:
+        free( c );
+        nc->user_data = NULL;
+        s_open--;
+        break;
+    }
+}
+
+// connect to the server's Unix domain socket, NULL if that fails
+static struct mg_connection* connect_unix( struct mg_mgr* mgr, const char* path )
+{
+#ifdef _WIN32
+    (void) mgr; (void) path;
+    return NULL;
+#else
+    struct sockaddr_un sun;
+    memset( &sun, 0, sizeof(sun) );
+    sun.sun_family = AF_UNIX;
+    snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", path);
+    int sock = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( sock < 0 ) return NULL;
+    if( connect( sock, (struct sockaddr*) &sun, sizeof(sun) ) < 0 ) {
+        close( sock );
+        return NULL;
+    }
+    return mg_add_sock( mgr, sock, ev_handler );
+#endif
+}
+
+//
+static int cmp_double( const void* a, const void* b )
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x < y) ? -1 : (x > y);
+}
+
+//
+static double percentile( double* lat, int n, double p )
+{
+    if( n == 0 ) return 0;
+    int i = (int)(p * n);
+    if( i >= n ) i = n-1;
+    return lat[i];
+}
+
+//
+static void report( const char* name, double* lat, int n, int errors, double secs )
+{
+    qsort( lat, n, sizeof(double), cmp_double );
+    printf("%8d %9.1f %8.2f %8.2f %8.2f %8.2f %8.2f %6d  %s\n",
+           n, n / secs,
+           percentile(lat, n, 0.50), percentile(lat, n, 0.95),
+           percentile(lat, n, 0.99), percentile(lat, n, 0.999),
+           (n) ? lat[n-1] : 0, errors, name);
+}
+
+//
+static void usage( const char* progname )
+{
+    fprintf(stderr,
+            "Usage: \n"
+            "  %s [options]\n"
+            "where options are:\n"
+            "  -h <host:port>   server to test (default localhost:8000)\n"
+            "  -s <path>        test server on Unix domain socket instead\n"
+            "  -u <host:port>   test server's CoAP endpoint instead\n"
+            "  -c <conns>       concurrent connections (default 8)\n"
+            "  -t <secs>        how long to run (default 10)\n"
+            "  -m <mix>         URIs & weights, as 'uri:weight,uri:weight,...'\n"
+            "                   (default '%s')\n"
+            "\n"
+            "Each connection keeps one request in flight. Latencies are in millis.\n",
+            progname, s_default_mix);
+}
+
+int main( int argc, char* argv[] )
+{
+    struct mg_mgr mgr;
+    const char* mixstr = s_default_mix;
+
+    for( int i = 1; i < argc; i++ ) {
+        if( strcmp(argv[i], "-h") == 0 && i + 1 < argc ) {
+            s_host = argv[++i];
+        }
+        else if( strcmp(argv[i], "-s") == 0 && i + 1 < argc ) {
+            s_unix_path = argv[++i];
+        }
+        else if( strcmp(argv[i], "-u") == 0 && i + 1 < argc ) {
+            s_coap_host = argv[++i];
+        }
+        else if( strcmp(argv[i], "-c") == 0 && i + 1 < argc ) {
+            s_conns = strtol(argv[++i], NULL, 10);
+        }
+        else if( strcmp(argv[i], "-t") == 0 && i + 1 < argc ) {
+            s_secs = strtod(argv[++i], NULL);
+        }
+        else if( strcmp(argv[i], "-m") == 0 && i + 1 < argc ) {
+            mixstr = argv[++i];
+        }
+        else {
+            usage( "blink1-server-bench" );
+            exit(1);
+        }
+    }
+    if( s_conns < 1 ) s_conns = 1;
+    if( s_conns > bench_conns_max ) s_conns = bench_conns_max;
+    if( parse_mix( mixstr ) == 0 ) {
+        usage( "blink1-server-bench" );
+        exit(1);
+    }
+
+    mg_mgr_init( &mgr, NULL );
+    srand( time(NULL) );
+
+    double start = mg_time();
+    s_end = start + s_secs;
+    char coapaddr[200];
+    const char* target = (s_unix_path) ? s_unix_path : s_host;
+    if( s_coap_host ) {
+        snprintf(coapaddr, sizeof(coapaddr), "udp://%s", s_coap_host);
+        target = coapaddr;
+    }
+    for( int i=0; i < s_conns; i++ ) {
+        struct mg_connection* nc = (s_unix_path) ? connect_unix( &mgr, s_unix_path ) :
+            (s_coap_host) ? mg_connect( &mgr, coapaddr, coap_handler ) :
+            mg_connect( &mgr, s_host, ev_handler );
+        if( nc == NULL ) {
+            fprintf(stderr, "couldn't connect to %s\n", target);
+            exit(1);
+        }
+        if( s_coap_host ) mg_set_protocol_coap( nc );
+        nc->user_data = calloc( 1, sizeof(bench_conn) );
+        s_open++;
+        if( s_unix_path ) send_request( nc );  // already connected
+    }
+    printf("blink1-server-bench: %d connections to %s for %g secs\n",
+           s_conns, target, s_secs);
+
+    while( s_open > 0 && mg_time() < s_end + 10 ) {
+        mg_mgr_poll( &mgr, 100 );
+    }
+    double secs = mg_time() - start;
+    mg_mgr_free( &mgr );
+
+    // all URIs together
+    int n = 0, errors = 0;
+    for( int i=0; i < nuris; i++ ) {
+        n += uris[i].nlat;
+        errors += uris[i].errors;
+    }
+    double* all = malloc( (n+1) * sizeof(double) );
+    for( int i=0, k=0; i < nuris; i++ ) {
+        memcpy( all+k, uris[i].lat, uris[i].nlat * sizeof(double) );
+        k += uris[i].nlat;
+    }
+
+    printf("%8s %9s %8s %8s %8s %8s %8s %6s  %s\n",
+           "reqs", "req/s", "p50", "p95", "p99", "p99.9", "max", "errors", "uri");
+    for( int i=0; i < nuris; i++ ) {
+        report( uris[i].uri, uris[i].lat, uris[i].nlat, uris[i].errors, secs );
+    }
+    report( "(all)", all, n, errors, secs );
+    if( s_rejected ) printf("%d requests rejected with 429\n", s_rejected);
+    if( s_failed )   printf("%d connections failed\n", s_failed);
+    free( all );
+    return (s_failed) ? 1 : 0;
+}
@@ -6,6 +6,7 @@
  *
  * Supported URLs:
  *
+ *  localhost:8000/blink1         -- status of all blink(1)s, ?fresh=1 to read from devices
  *  localhost:8000/blink1/on
  *  localhost:8000/blink1/off
  *  localhost:8000/blink1/red
@@ -13,196 +14,1193 @@
  *  localhost:8000/blink1/blue
  *  localhost:8000/blink1/blink?rgb=%23ff0ff&time=1.0&count=3
  *  localhost:8000/blink1/fadeToRGB?rgb=%23ff00ff&time=1.0
+ *  localhost:8000/blink1/random?time=0.5&count=10
+ *  localhost:8000/blink1/jobs
+ *  localhost:8000/blink1/jobs/cancel?id=3
+ *  localhost:8000/blink1/pattern/upload?pattern=0,%23ff0000,0.5,0,%230000ff,0.5,0
+ *  localhost:8000/blink1/pattern/play?start=0&end=1&count=3
+ *  localhost:8000/blink1/pattern/stop
+ *  localhost:8000/blink1/pattern/state
+ *  localhost:8000/blink1/batch  -- POST a JSON array of ops, see batch.h
+ *  localhost:8000/blink1/schedule?every=300 -- POST a batch to run later or repeatedly, see sched.h
+ *  localhost:8000/blink1/schedule?id=2 -- GET one schedule with its batch
+ *  localhost:8000/blink1/schedule/cancel?id=2
+ *  ws://localhost:8000/blink1/ws -- WebSocket stream of updates, see stream.h
+ *  localhost:8000/blink1/events  -- Server-Sent Events of state changes, see events.h
+ *  localhost:8000/metrics        -- Prometheus / OpenMetrics stats, see metrics.h
+ *
+ * Color, blink & random URLs also take:
+ *  id=all  or  id=0,2  or  id=2000ABCD  -- which blink(1)s (default 0)
+ *  ledn=2  -- which LED (default 0 = all)
  *
  *
  */
 
+#include <pthread.h>
+#include <signal.h>
+
 #include "mongoose.h"
 
 #include "blink1-lib.h"
+#include "devmgr.h"
+#include "jobs.h"
+#include "batch.h"
+#include "stream.h"
+#include "events.h"
+#include "metrics.h"
+#include "pattern.h"
+#include "unixsock.h"
+#include "binproto.h"
+#ifndef BLINK1_SERVER_TINY
+#include "broker.h"
+#endif
+#include "coap.h"  // also for REQUEST_WAITING, so in the tiny build too
+#include "jsonw.h"
+#include "query.h"
+#include "pool.h"
+#include "sched.h"
 
 const char* blink1_server_version = "0.99";
 
-static const char *s_http_port = "8000";
+static const char *s_http_port = "8000";   // "off" for no TCP listener
+static const char *s_unix_path = NULL;     // Unix domain socket to listen on too
+static const char *s_bin_port = NULL;      // UDP & TCP port for binary frames
+static const char *s_sched_path = NULL;    // schedule journal
+#ifndef BLINK1_SERVER_TINY
+static const char *s_mqtt_port = NULL;     // MQTT broker address
+static const char *s_coap_port = NULL;     // CoAP UDP address
+#endif
+static int s_unix_mode = unixsock_mode_default;
+static volatile sig_atomic_t s_signo = 0;
+static int s_rescan_millis = devmgr_rescan_default;
+
+// what to do with color requests when a device is behind
+typedef enum {
+    POLICY_QUEUE = 0,  // wait for the write, superseded colors are merged
+    POLICY_ACK,        // reply at once, only the latest color per LED is written
+    POLICY_REJECT      // 429 if device couldn't get to it within devmgr_wait_max
+} policy_t;
+static policy_t s_policy = POLICY_QUEUE;
+#if MG_ENABLE_FILESYSTEM
 static struct mg_serve_http_opts s_http_server_opts;
+#endif
+
+
+static struct mg_mgr s_mgr;
+static pthread_t s_main_thread;
+
+// replies are built & sent one at a time on the event loop, all in here
+// status of every device fits, or every job
+#define extra_max  ((devmgr_max*300 > jobs_max*150) ? devmgr_max*300 : jobs_max*150)
+#define reply_max  (extra_max + 4096)
+static char s_reply_buf[reply_max];
+
+#ifdef BLINK1_SERVER_TINY
+// pools are sized for this many clients at once, each with a full reply
+// waiting to go out; more are turned away rather than cut off mid-reply
+#define conns_max  16
+static int s_conns = 0;
+#endif
+
+// a request waiting on device workers, hung off its connection's user_data
+typedef struct request_ {
+    unsigned long id;
+    int ndevs;            // devices the request went to
+    int pending;          // ops not done yet
+    int failed;           // ops that errored
+    int superseded;       // ops replaced by a later color before being written
+    char uristr[200];
+    char result[200];
+    uint16_t millis;
+    uint8_t r, g, b;
+    batch_t* batch;       // if a batch request
+    double start;         // mg_time() request arrived
+    devopType_t type;     // DEVOP_FADE for colors, else a pattern request
+    int written;          // pattern lines written
+    int skipped;          // pattern lines devices already had
+    devop_result* states; // DEVOP_READPLAY results, one per device
+    int nstates;
+    devmgr_set devs;      // devices the request went to
+} request_t;
+
+static unsigned long s_last_reqid = 0;
+
+//
+static void request_free( request_t* req )
+{
+    pool_free( req->batch );
+    pool_free( req->states );
+    pool_free( req );
+}
+
+// REQUEST_WAITING (coap.h) marks a user_data that is a request_t.  Other
+// connections in the manager (MQTT clients) keep their own state there.
+
+// hang req off nc until its devices are done
+static void request_attach( struct mg_connection* nc, request_t* req )
+{
+    nc->user_data = req;
+    nc->flags |= REQUEST_WAITING;
+}
+
+//
+static void request_detach( struct mg_connection* nc )
+{
+    nc->user_data = NULL;
+    nc->flags &= ~REQUEST_WAITING;
+}
+
+// @return request nc is waiting on, or NULL
+static request_t* request_of( struct mg_connection* nc )
+{
+    return (nc->flags & REQUEST_WAITING) ? (request_t*) nc->user_data : NULL;
+}
+
+// send JSON reply with the members every reply has, plus those in extra.
+// sized with Content-Length, or as a CoAP response to CoAP clients
+static void send_reply( struct mg_connection *nc, int status, const char* uristr, 
+                        const char* result, uint16_t millis, 
+                        uint8_t r, uint8_t g, uint8_t b, const jsonw* extra )
+{
+    char rgbstr[8];
+    char millisstr[8];
+    jsonw w;
+    sprintf(rgbstr, "#%2.2x%2.2x%2.2x", r,g,b );
+    sprintf(millisstr, "%d", millis );
+    jsonw_init( &w, s_reply_buf, sizeof(s_reply_buf) );
+    jsonw_obj( &w );
+    jsonw_kstr( &w, "uri", uristr );
+    jsonw_kstr( &w, "result", result );
+    jsonw_kstr( &w, "millis", millisstr );
+    jsonw_kstr( &w, "rgb", rgbstr );
+    if( extra ) jsonw_members( &w, extra );
+    jsonw_kstr( &w, "version", blink1_server_version );
+    jsonw_end( &w );
+    if( w.overflow ) {
+        fprintf(stderr, "reply to %.100s too big\n", uristr);
+        status = 500;
+        jsonw_init( &w, s_reply_buf, sizeof(s_reply_buf) );
+        jsonw_obj( &w );
+        jsonw_kstr( &w, "uri", uristr );
+        jsonw_kstr( &w, "result", "reply too big" );
+        jsonw_kstr( &w, "version", blink1_server_version );
+        jsonw_end( &w );
+    }
+
+#ifndef BLINK1_SERVER_TINY
+    if( nc->flags & COAP_PEER ) {
+        coap_reply( nc, status, w.buf, w.len );
+        return;
+    }
+#endif
+    mg_printf(nc, "HTTP/1.1 %s\r\n%s"
+              "Content-Type: application/json\r\n"
+              "Content-Length: %d\r\n\r\n",
+              (status == 405) ? "405 Method Not Allowed" :
+              (status == 429) ? "429 Too Many Requests" :
+              (status == 500) ? "500 Internal Server Error" : "200 OK",
+              (status == 429) ? "Retry-After: 1\r\n" : "",
+              w.len);
+    mg_send( nc, w.buf, w.len );
+}
+
+// list state of devices in set as JSON, from devmgr's state shadow
+static void format_status( jsonw* w, devmgr_set* devs )
+{
+    char state[600];
+    jsonw_key( w, "blink1s" );
+    jsonw_arr( w );
+    for( int i=0; i < devmgr_count(); i++ ) {
+        if( !devmgr_set_has( devs, i ) ) continue;
+        int n = events_formatState( state, sizeof(state), devmgr_get(i), i );
+        jsonw_raw( w, state, (n < (int)sizeof(state)) ? n : (int)sizeof(state)-1 );
+    }
+    jsonw_end( w );
+}
+
+// reply to a pattern or status request once its device ops are all done
+static void reply_ops( struct mg_connection *nc, request_t* req )
+{
+    char result[300];
+    char extrabuf[extra_max];
+    jsonw extra;
+    snprintf(result, sizeof(result), "%s%s", req->result,
+             (req->failed) ? "; couldn't find blink1" : "");
+    jsonw_initMembers( &extra, extrabuf, sizeof(extrabuf) );
+    jsonw_kint( &extra, "devices", req->ndevs );
+    jsonw_kint( &extra, "failed", req->failed );
+    if( req->type == DEVOP_PATTLINE ) {
+        jsonw_kint( &extra, "written", req->written );
+        jsonw_kint( &extra, "skipped", req->skipped );
+    }
+    if( req->type == DEVOP_READPLAY ) {
+        jsonw_key( &extra, "states" );
+        jsonw_arr( &extra );
+        for( int i=0; i < req->nstates; i++ ) {
+            devop_result* st = &req->states[i];
+            jsonw_obj( &extra );
+            jsonw_kstr( &extra, "serial", st->serial );
+            if( st->rc != 0 ) {
+                jsonw_kstr( &extra, "error", "couldn't read" );
+            } else {
+                jsonw_kint( &extra, "playing", st->playing );
+                jsonw_kint( &extra, "start", st->startpos );
+                jsonw_kint( &extra, "end", st->endpos );
+                jsonw_kint( &extra, "count", st->count );
+                jsonw_kint( &extra, "pos", st->pos );
+            }
+            jsonw_end( &extra );
+        }
+        jsonw_end( &extra );
+    }
+    if( req->type == DEVOP_READSTATE ) {
+        format_status( &extra, &req->devs );
+    }
+    send_reply( nc, 200, req->uristr, result, 0, 0,0,0, &extra );
+}
+
+// runs on event loop for each connection, after a device worker is done
+static void devop_done(struct mg_connection *nc, int ev, void *ev_data)
+{
+    devop_result* res = (devop_result*) ev_data;
+    request_t* req = request_of( nc );
+    if( req == NULL || req->id != res->reqid ) return;
+
+    if( req->batch ) {
+        if( !batch_done( req->batch, res ) ) return;
+        char extrabuf[batch_max*128];
+        jsonw extra;
+        jsonw_initMembers( &extra, extrabuf, sizeof(extrabuf) );
+        jsonw_key( &extra, "results" );
+        batch_results( req->batch, &extra );
+        send_reply( nc, 200, req->uristr, req->result, 0, 0,0,0, &extra );
+        metrics_request( req->uristr, req->start );
+        request_detach( nc );
+        request_free( req );
+        return;
+    }
+
+    req->pending--;
+    if( res->rc != 0 ) req->failed++;
+    if( res->merged ) req->superseded++;
+    if( res->tag == DEVOP_PATTLINE && res->rc == 0 ) {
+        if( res->skipped ) req->skipped++; else req->written++;
+    }
+    if( res->tag == DEVOP_READPLAY && req->states ) {
+        req->states[ req->nstates++ ] = *res;
+    }
+    if( res->tag == DEVOP_READSTATE ) {
+        devmgr_refresh( res );
+    }
+    if( req->pending > 0 ) return;
+
+    if( req->type != DEVOP_FADE ) {
+        reply_ops( nc, req );
+        metrics_request( req->uristr, req->start );
+        request_detach( nc );
+        request_free( req );
+        return;
+    }
+
+    char result[300];
+    char extrabuf[150];
+    jsonw extra;
+    if( req->failed ) {
+        fprintf(stderr, "blink1 device error\n");
+        snprintf(result, sizeof(result), "%s; couldn't find blink1", req->result);
+    } else {
+        sprintf(result, "blink1 set color #%2.2x%2.2x%2.2x%s", req->r,req->g,req->b,
+                (req->superseded) ? "; superseded" : "");
+    }
+    jsonw_initMembers( &extra, extrabuf, sizeof(extrabuf) );
+    jsonw_kint( &extra, "devices", req->ndevs );
+    jsonw_kint( &extra, "failed", req->failed );
+    jsonw_kint( &extra, "superseded", req->superseded );
+    send_reply( nc, 200, req->uristr, result, req->millis, req->r,req->g,req->b, &extra );
+    metrics_request( req->uristr, req->start );
+    request_detach( nc );
+    request_free( req );
+}
+
+// called from device worker threads, or from the main loop for merged ops
+static void devop_notify( devop_result* res )
+{
+    if( pthread_equal( pthread_self(), s_main_thread ) ) {
+        // mg_broadcast() waits on the main loop, so can't be used from it
+        for( struct mg_connection* c = mg_next(&s_mgr, NULL); c != NULL;
+             c = mg_next(&s_mgr, c) ) {
+            devop_done( c, MG_EV_POLL, res );
+        }
+        return;
+    }
+#if MG_ENABLE_BROADCAST
+    mg_broadcast( &s_mgr, devop_done, res, sizeof(devop_result) );
+#endif
+}
+
+// called on main loop when devices are commanded or come & go
+static void device_changed( devmgr_change_t change, devmgr_dev* d,
+                            int i, uint8_t ledn )
+{
+    events_deviceChanged( change, d, i, ledn );
+#ifndef BLINK1_SERVER_TINY
+    broker_deviceChanged( change, d, i, ledn );
+#endif
+    metrics_deviceChanged( change, d->serial );
+}
+
+//
+static void send_metrics( struct mg_connection *nc )
+{
+    struct mbuf buf;
+    mbuf_init( &buf, 16384 );
+    metrics_format( &buf );
+    mg_printf(nc, "HTTP/1.1 200 OK\r\n"
+              "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+              "Content-Length: %d\r\n\r\n", (int)buf.len);
+    mg_send( nc, buf.buf, buf.len );
+    mbuf_free( &buf );
+}
+
+// queue color change on devices, all at once so they run concurrently.
+// reply is sent by devop_done() when they're all done, or right away
+// for POLICY_ACK & POLICY_REJECT rejections.
+// returns 0 if queued, -1 to reply now with 'result' & 'status'
+static int queue_color( struct mg_connection *nc, const char* uristr, 
+                        char* result, int* status, devmgr_set* devs, int ndevs,
+                        uint8_t ledn, uint16_t millis, uint8_t r, uint8_t g, uint8_t b )
+{
+    if( request_of( nc ) != NULL ) {
+        strcat(result, "; request already pending");
+        return -1;
+    }
+    if( ndevs <= 0 ) {
+        strcat(result, "; couldn't find blink1");
+        return -1;
+    }
+    if( s_policy == POLICY_REJECT ) {
+        for( int i=0; i < devmgr_max; i++ ) {
+            if( devmgr_set_has( devs, i ) && devmgr_admit( i ) < 0 ) {
+                strcat(result, "; blink1 busy, try again");
+                *status = 429;
+                return -1;
+            }
+        }
+    }
+    if( s_policy == POLICY_ACK ) {
+        devop_t op = { DEVOP_FADE, millis, r, g, b, ledn, 0 };
+        int n = 0;
+        for( int i=0; i < devmgr_max; i++ ) {
+            if( devmgr_set_has( devs, i ) && devmgr_stream( i, &op ) >= 0 ) n++;
+        }
+        sprintf(result, (n) ? "blink1 set color #%2.2x%2.2x%2.2x; accepted" :
+                "blink1 set color #%2.2x%2.2x%2.2x; couldn't find blink1", r,g,b);
+        return -1;
+    }
+    request_t* req = pool_calloc( 1, sizeof(request_t) );
+    if( req == NULL ) return -1;
+    req->id = ++s_last_reqid;
+    snprintf(req->uristr, sizeof(req->uristr), "%s", uristr);
+    snprintf(req->result, sizeof(req->result), "%s", result);
+    req->type = DEVOP_FADE;
+    req->millis = millis;
+    req->r = r; req->g = g; req->b = b;
+    req->ndevs = ndevs;
+
+    devop_t op = { DEVOP_FADE, millis, r, g, b, ledn, req->id };
+    int rc = 0;
+    for( int i=0; i < devmgr_max; i++ ) {
+        if( !devmgr_set_has( devs, i ) ) continue;
+        if( (rc = devmgr_submit( i, &op )) == 0 ) {
+            req->pending++;
+        } else {
+            req->failed++;
+        }
+    }
+    if( req->pending == 0 ) {
+        strcat(result, (rc == -2) ? "; blink1 busy" : "; couldn't find blink1");
+        request_free( req );
+        return -1;
+    }
+    request_attach( nc, req );
+    return 0;
+}
+
+// queue the same ops on each device, in order, for pattern & status requests.
+// 'type' says what the reply reports, see reply_ops().
+// reply is sent by devop_done() when they're all done.
+// returns 0 if queued, -1 to reply now with 'result'
+static int queue_ops( struct mg_connection *nc, const char* uristr, char* result,
+                      devmgr_set* devs, int ndevs, devopType_t type,
+                      devop_t* ops, int nops )
+{
+    if( request_of( nc ) != NULL ) {
+        strcat(result, "; request already pending");
+        return -1;
+    }
+    if( ndevs <= 0 ) {
+        strcat(result, "; couldn't find blink1");
+        return -1;
+    }
+    request_t* req = pool_calloc( 1, sizeof(request_t) );
+    if( req == NULL ) return -1;
+    if( type == DEVOP_READPLAY ) {
+        req->states = pool_calloc( ndevs, sizeof(devop_result) );
+        if( req->states == NULL ) {
+            request_free( req );
+            return -1;
+        }
+    }
+    req->id = ++s_last_reqid;
+    req->type = type;
+    req->ndevs = ndevs;
+    req->devs = *devs;
+    snprintf(req->uristr, sizeof(req->uristr), "%s", uristr);
+    snprintf(req->result, sizeof(req->result), "%s", result);
+
+    for( int i=0; i < devmgr_max; i++ ) {
+        if( !devmgr_set_has( devs, i ) ) continue;
+        devmgr_dev* d = devmgr_get(i);
+        for( int j=0; j < nops; j++ ) {
+            devop_t op = ops[j];
+            op.reqid = req->id;
+            op.tag = op.type;  // so devop_done() knows what finished
+            if( (op.type == DEVOP_READPLAY || op.type == DEVOP_PATTSAVE) &&
+                d->type == BLINK1_MK1 ) {
+                req->failed++;  // mk1 can't
+                continue;
+            }
+            if( devmgr_submit( i, &op ) == 0 ) {
+                req->pending++;
+            } else {
+                req->failed++;
+            }
+        }
+    }
+    if( req->pending == 0 ) {
+        strcat(result, "; couldn't find blink1");
+        request_free( req );
+        return -1;
+    }
+    request_attach( nc, req );
+    return 0;
+}
+
+// upload a pattern, from the 'pattern' arg or POST body, and/or play it.
+// 'start' is the first pattern line to write & play from.
+// returns 0 if queued, -1 to reply now with 'result'
+static int queue_pattern( struct mg_connection *nc, struct http_message *hm,
+                          const query_t* q, const char* uristr, char* result,
+                          devmgr_set* devs, int ndevs, int play )
+{
+    char errstr[100];
+    pattern_t patt;
+    devop_t ops[pattern_lines_max + 2];
+    int nops = 0;
+    int start = q->start, end = q->end, count = q->count, save = q->save;
+    int has_end = (q->has & QUERY_END), has_count = (q->has & QUERY_COUNT);
+
+    if( start < 0 || start >= pattern_lines_max ) start = 0;
+
+    const char* str = q->pattern;
+    int len = q->patternlen;  // -1 = none
+    if( len == -1 && hm->body.len > 0 ) {
+        len = (hm->body.len < query_pattern_max) ? (int)hm->body.len : -2;
+        str = hm->body.p;
+    }
+    if( len == -2 ) {
+        strcat(result, "; pattern too long");
+        return -1;
+    }
+    if( len > 0 ) {
+        if( pattern_parse( str, len, &patt, errstr, sizeof(errstr) ) < 0 ) {
+            snprintf(result, 200, "blink1 pattern; %s", errstr);
+            return -1;
+        }
+        if( start + patt.len > pattern_lines_max ) {
+            snprintf(result, 200, "blink1 pattern; doesn't fit, max %d lines", pattern_lines_max);
+            return -1;
+        }
+        for( int i=0; i < patt.len; i++ ) {
+            pattern_lineOp( &patt, i, start+i, &ops[nops++] );
+        }
+        if( save ) {
+            memset( &ops[nops], 0, sizeof(devop_t) );
+            ops[nops++].type = DEVOP_PATTSAVE;
+        }
+        if( !has_end )   end = start + patt.len - 1;
+        if( !has_count ) count = patt.repeats;
+        sprintf(result, "blink1 pattern %s: %d lines", (play) ? "play" : "upload", patt.len);
+    }
+    else if( !play ) {
+        strcat(result, "; no pattern given");
+        return -1;
+    }
+    if( play ) {
+        devop_t* op = &ops[nops++];
+        memset( op, 0, sizeof(devop_t) );
+        op->type = DEVOP_PLAY;
+        op->play = 1;
+        op->startpos = start;
+        op->endpos = end;
+        op->count = count;
+    }
+    return queue_ops( nc, uristr, result, devs, ndevs,
+                      (len > 0) ? DEVOP_PATTLINE : DEVOP_PLAY, ops, nops );
+}
+
+// parse POSTed batch of ops and queue them all at once.
+// if anything is left to wait on, reply is sent by devop_done().
+// returns 0 if waiting, -1 with 'result' & 'extra' filled in if not
+static int queue_batch( struct mg_connection *nc, struct http_message *hm,
+                        const char* uristr, char* result, jsonw* extra )
+{
+    char errstr[200];
+    sprintf(result, "blink1 batch");
+    if( mg_vcmp( &hm->method, "POST") != 0 ) {
+        strcat(result, "; POST a JSON array of ops");
+        return -1;
+    }
+    if( request_of( nc ) != NULL ) {
+        strcat(result, "; request already pending");
+        return -1;
+    }
+    request_t* req = pool_calloc( 1, sizeof(request_t) );
+    batch_t* batch = pool_calloc( 1, sizeof(batch_t) );
+    if( req == NULL || batch == NULL ) {
+        pool_free( req ); pool_free( batch );
+        strcat(result, "; out of memory");
+        return -1;
+    }
+    req->batch = batch;
+    if( batch_parse( hm->body.p, hm->body.len, batch, errstr, sizeof(errstr) ) < 0 ) {
+        snprintf(result, 200, "blink1 batch; %s", errstr);
+        request_free( req );
+        return -1;
+    }
+    req->id = ++s_last_reqid;
+    snprintf(req->uristr, sizeof(req->uristr), "%s", uristr);
+    snprintf(req->result, sizeof(req->result), "blink1 batch: %d ops", batch->nops);
+
+    // attached first: an op superseded by a later one in the same batch
+    // is reported while the batch is still being submitted
+    request_attach( nc, req );
+    if( batch_run( batch, req->id ) == 0 ) {  // nothing to wait for
+        request_detach( nc );
+        strcpy(result, req->result);
+        jsonw_key( extra, "results" );
+        batch_results( batch, extra );
+        request_free( req );
+        return -1;
+    }
+    return 0;
+}
+
+// a request being routed: what handlers get, and fill in for the reply
+typedef struct route_ctx_ {
+    struct mg_connection* nc;
+    struct http_message* hm;
+    const struct route_* route;
+    query_t* q;
+    const char* uristr;
+    devmgr_set devs;      // from 'id', for routes with ROUTE_DEVS
+    int ndevs;
+    char result[1000];    // reply now if set, else reply comes later or not at all
+    int status;
+    uint16_t millis;
+    uint8_t r, g, b;
+    int jobid;
+    jsonw* extra;         // members the reply adds
+} route_ctx;
+
+typedef void (*route_func)( route_ctx* c );
+
+// methods a route takes
+#define ROUTE_GET     (1<<0)
+#define ROUTE_POST    (1<<1)
+#define ROUTE_PUT     (1<<2)
+#define ROUTE_DELETE  (1<<3)
+#define ROUTE_ANY     (ROUTE_GET|ROUTE_POST|ROUTE_PUT)
+
+// route flags
+#define ROUTE_DEVS     (1<<0)  // 'id' picks devices, default first one
+#define ROUTE_ALLDEVS  (1<<1)  // 'id' picks devices, default all
+
+typedef struct route_ {
+    const char* path;
+    int methods;
+    int flags;
+    route_func func;
+    const char* result;   // reply result, for handlers that share a func
+    int arg;              // handler specific
+} route_t;
+
+#define ROUTE_RGB_ARG  -1  // route_color() arg: color from 'rgb'
+
+//
+static void route_welcome( route_ctx* c )
+{
+    sprintf(c->result, "welcome to blink1-tiny-server api server. All URIs start with '/blink1', e.g. '/blink1/red', '/blink1/off', '/blink1/fadeToRGB?rgb=%%23FF00FF'");
+}
+
+// status from the state shadow, or read from devices with 'fresh'
+static void route_status( route_ctx* c )
+{
+    devop_t op = { DEVOP_READSTATE };
+    sprintf(c->result, "blink1 status");
+    c->millis = 0;
+    if( c->q->fresh && c->ndevs > 0 ) {
+        if( queue_ops( c->nc, c->uristr, c->result, &c->devs, c->ndevs,
+                       DEVOP_READSTATE, &op, 1 ) == 0 ) {
+            c->result[0] = '\0'; // reply when devices have been read
+        }
+    } else {
+        format_status( c->extra, &c->devs );
+    }
+}
 
+// fixed colors, arg is 0xRRGGBB, or fadeToRGB's from 'rgb'
+static void route_color( route_ctx* c )
+{
+    sprintf(c->result, "%s", c->route->result);
+    if( c->route->arg != ROUTE_RGB_ARG ) {
+        c->r = c->route->arg >> 16; c->g = c->route->arg >> 8; c->b = c->route->arg;
+    }
+    if( queue_color( c->nc, c->uristr, c->result, &c->status, &c->devs, c->ndevs,
+                     c->q->ledn, c->millis, c->r,c->g,c->b ) == 0 ) {
+        c->result[0] = '\0'; // reply when device is done
+    }
+}
+
+//
+static void route_blink( route_ctx* c )
+{
+    uint8_t count = (c->q->has & QUERY_COUNT) ? c->q->count : 1;
+    if( c->r==0 && c->g==0 && c->b==0 ) { c->r = 255; c->g = 255; c->b = 255; }
+    c->jobid = (c->ndevs > 0) ?
+        jobs_add( JOB_BLINK, &c->devs, c->q->ledn, c->millis, count, c->r,c->g,c->b ) : 0;
+    sprintf(c->result, (c->jobid > 0) ? "blink1 blink" : 
+            (c->ndevs > 0) ? "blink1 blink; too many jobs" : "blink1 blink; couldn't find blink1");
+}
+
+//
+static void route_random( route_ctx* c )
+{
+    uint8_t count = (c->q->has & QUERY_COUNT) ? c->q->count : 1;
+    c->jobid = (c->ndevs > 0) ?
+        jobs_add( JOB_RANDOM, &c->devs, c->q->ledn, c->millis, count, 0,0,0 ) : 0;
+    sprintf(c->result, (c->jobid > 0) ? "blink1 random" : 
+            (c->ndevs > 0) ? "blink1 random; too many jobs" : "blink1 random; couldn't find blink1");
+}
+
+//
+static void route_batch( route_ctx* c )
+{
+    if( queue_batch( c->nc, c->hm, c->uristr, c->result, c->extra ) == 0 ) {
+        c->result[0] = '\0'; // reply when devices are done
+    }
+}
+
+// upload, or play if arg
+static void route_pattern( route_ctx* c )
+{
+    sprintf(c->result, "%s", c->route->result);
+    if( queue_pattern( c->nc, c->hm, c->q, c->uristr, c->result,
+                       &c->devs, c->ndevs, c->route->arg ) == 0 ) {
+        c->result[0] = '\0'; // reply when devices are done
+    }
+}
+
+// stop (DEVOP_PLAY with play = 0) or read play state, arg is the op type
+static void route_patternOp( route_ctx* c )
+{
+    devop_t op = { c->route->arg };
+    sprintf(c->result, "%s", c->route->result);
+    if( queue_ops( c->nc, c->uristr, c->result, &c->devs, c->ndevs,
+                   op.type, &op, 1 ) == 0 ) {
+        c->result[0] = '\0';
+    }
+}
+
+//
+static void route_events( route_ctx* c )
+{
+    events_subscribe( c->nc );  // stays open, no reply
+}
+
+//
+static void route_metrics( route_ctx* c )
+{
+    send_metrics( c->nc );
+}
+
+//
+static void route_jobs( route_ctx* c )
+{
+    char rgbstr[8];
+    jsonw* extra = c->extra;
+    sprintf(c->result, "blink1 jobs");
+    jsonw_key( extra, "jobs" );
+    jsonw_arr( extra );
+    for( int i=0; i < jobs_max; i++ ) {
+        job_t* j = jobs_get(i);
+        if( j == NULL ) continue;
+        sprintf(rgbstr, "#%2.2x%2.2x%2.2x", j->r, j->g, j->b);
+        jsonw_obj( extra );
+        jsonw_kint( extra, "id", j->id );
+        jsonw_kstr( extra, "type", jobs_typestr(j->type) );
+        jsonw_kint( extra, "devices", jobs_devCount(j) );
+        jsonw_kint( extra, "ledn", j->ledn );
+        jsonw_kstr( extra, "rgb", rgbstr );
+        jsonw_kint( extra, "millis", j->millis );
+        jsonw_kint( extra, "count", j->count );
+        jsonw_kint( extra, "step", j->step );
+        jsonw_end( extra );
+    }
+    jsonw_end( extra );
+}
+
+// 'id' is the job here, not devices
+static void route_jobsCancel( route_ctx* c )
+{
+    int id = strtol( c->q->id, NULL, 10 );
+    if( jobs_cancel( id ) == 0 ) {
+        sprintf(c->result, "blink1 job %d cancelled", id);
+    } else {
+        sprintf(c->result, "blink1 job %d not found", id);
+    }
+}
 
-// used in ev_handler below
-#define do_blink1_color() \
-    blink1_device* dev = blink1_open(); \
-    if( blink1_fadeToRGB( dev, millis, r,g,b ) == -1 ) { \
-        fprintf(stderr, "off: blink1 device error\n"); \
-        sprintf(result, "%s; couldn't find blink1", result); \
-    } \
-    else { \
-        sprintf(result, "blink1 set color #%2.2x%2.2x%2.2x", r,g,b);  \
-    } \
-    blink1_close(dev); 
+// a schedule as JSON, with its batch only if 'ops', as a batch can be
+// up to sched_body_max and only one of those fits in a reply
+static void schedule_json( jsonw* w, sched_entry* e, int ops )
+{
+    jsonw_obj( w );
+    jsonw_kint( w, "id", e->id );
+    jsonw_kstr( w, sched_typestr(e->type), e->spec );
+    jsonw_kint( w, "next", (long) e->due );
+    jsonw_kint( w, "runs", e->runs );
+    if( ops ) {
+        jsonw_key( w, "ops" );
+        jsonw_raw( w, e->body, strlen(e->body) );
+    } else {
+        jsonw_kint( w, "ops_bytes", strlen(e->body) );
+    }
+    jsonw_end( w );
+}
+
+// listed schedules without their batch are under this many bytes each
+#define schedule_list_entry_max  256
 
+// POST adds a schedule for the batch in the body, GET lists them,
+// or shows the one with 'id'
+static void route_schedule( route_ctx* c )
+{
+    char errstr[200];
+    query_t* q = c->q;
+    jsonw* extra = c->extra;
+
+    if( mg_vcmp( &c->hm->method, "POST" ) != 0 && (q->has & QUERY_ID) ) {
+        int id = strtol( q->id, NULL, 10 );
+        sched_entry* e = sched_find( id );
+        if( e == NULL ) {
+            sprintf(c->result, "blink1 schedule %d not found", id);
+            return;
+        }
+        sprintf(c->result, "blink1 schedule %d", id);
+        jsonw_key( extra, "schedule" );
+        schedule_json( extra, e, 1 );
+        return;
+    }
+    if( mg_vcmp( &c->hm->method, "POST" ) != 0 ) {
+        int skip = q->start;
+        int count = (q->has & QUERY_COUNT) ? q->count : 20;
+        if( count > extra_max / schedule_list_entry_max ) {
+            count = extra_max / schedule_list_entry_max;
+        }
+        sprintf(c->result, "blink1 schedules");
+        jsonw_kint( extra, "total", sched_count() );
+        jsonw_key( extra, "schedules" );
+        jsonw_arr( extra );
+        for( int i=0; i < sched_max && count > 0; i++ ) {
+            sched_entry* e = sched_get(i);
+            if( e == NULL || skip-- > 0 ) continue;
+            count--;
+            schedule_json( extra, e, 0 );
+        }
+        jsonw_end( extra );
+        return;
+    }
+
+    int n = !!(q->has & QUERY_AT) + !!(q->has & QUERY_EVERY) + !!(q->has & QUERY_CRON);
+    if( n != 1 ) {
+        sprintf(c->result, "blink1 schedule; give one of 'at', 'every' or 'cron'");
+        return;
+    }
+    schedType_t type = (q->has & QUERY_AT) ? SCHED_AT :
+                       (q->has & QUERY_EVERY) ? SCHED_EVERY : SCHED_CRON;
+    const char* spec = (type == SCHED_AT) ? q->at : (type == SCHED_EVERY) ? q->every : q->cron;
+    int id = sched_add( type, spec, c->hm->body.p, c->hm->body.len, errstr, sizeof(errstr) );
+    if( id < 0 ) {
+        snprintf(c->result, sizeof(c->result), "blink1 schedule; %s", errstr);
+        return;
+    }
+    sprintf(c->result, "blink1 schedule %d added", id);
+    jsonw_kint( extra, "schedule_id", id );
+    jsonw_kint( extra, "next", (long) sched_find(id)->due );
+}
+
+// 'id' is the schedule here, not devices
+static void route_scheduleCancel( route_ctx* c )
+{
+    int id = strtol( c->q->id, NULL, 10 );
+    if( sched_cancel( id ) == 0 ) {
+        sprintf(c->result, "blink1 schedule %d cancelled", id);
+    } else {
+        sprintf(c->result, "blink1 schedule %d not found", id);
+    }
+}
+
+static const route_t s_routes[] = {
+    { "/",                      ROUTE_ANY,  0,             route_welcome },
+    { "/blink1",                ROUTE_ANY,  ROUTE_ALLDEVS, route_status },
+    { "/blink1/",               ROUTE_ANY,  ROUTE_ALLDEVS, route_status },
+    { "/blink1/status",         ROUTE_ANY,  ROUTE_ALLDEVS, route_status },
+    { "/blink1/off",            ROUTE_ANY,  ROUTE_DEVS,    route_color, "blink1 off",   0x000000 },
+    { "/blink1/on",             ROUTE_ANY,  ROUTE_DEVS,    route_color, "blink1 on",    0xffffff },
+    { "/blink1/red",            ROUTE_ANY,  ROUTE_DEVS,    route_color, "blink1 red",   0xff0000 },
+    { "/blink1/green",          ROUTE_ANY,  ROUTE_DEVS,    route_color, "blink1 green", 0x00ff00 },
+    { "/blink1/blue",           ROUTE_ANY,  ROUTE_DEVS,    route_color, "blink1 blue",  0x0000ff },
+    { "/blink1/fadeToRGB",      ROUTE_ANY,  ROUTE_DEVS,    route_color, "blink1 fadeToRGB", ROUTE_RGB_ARG },
+    { "/blink1/blink",          ROUTE_ANY,  ROUTE_DEVS,    route_blink },
+    { "/blink1/random",         ROUTE_ANY,  ROUTE_DEVS,    route_random },
+    { "/blink1/batch",          ROUTE_POST, 0,             route_batch },
+    { "/blink1/pattern/upload", ROUTE_ANY,  ROUTE_DEVS,    route_pattern, "blink1 pattern upload", 0 },
+    { "/blink1/pattern/play",   ROUTE_ANY,  ROUTE_DEVS,    route_pattern, "blink1 pattern play", 1 },
+    { "/blink1/pattern/stop",   ROUTE_ANY,  ROUTE_DEVS,    route_patternOp, "blink1 pattern stop", DEVOP_PLAY },
+    { "/blink1/pattern/state",  ROUTE_ANY,  ROUTE_DEVS,    route_patternOp, "blink1 pattern state", DEVOP_READPLAY },
+    { "/blink1/events",         ROUTE_GET,  0,             route_events },
+    { "/metrics",               ROUTE_GET,  0,             route_metrics },
+    { "/blink1/jobs",           ROUTE_ANY,  0,             route_jobs },
+    { "/blink1/jobs/cancel",    ROUTE_ANY|ROUTE_DELETE, 0, route_jobsCancel },
+    { "/blink1/schedule",       ROUTE_GET|ROUTE_POST, 0,   route_schedule },
+    { "/blink1/schedule/cancel", ROUTE_ANY|ROUTE_DELETE, 0, route_scheduleCancel },
+};
+#define nroutes  (int)(sizeof(s_routes)/sizeof(s_routes[0]))
+
+// open-addressed index of s_routes by path hash, filled by routes_init(),
+// so finding a route costs one hash of the path whatever the number of routes
+#define route_slots  64   // power of 2, at least twice nroutes
+static uint8_t s_route_slot[route_slots];  // index into s_routes + 1, 0 = empty
+
+// FNV-1a
+static uint32_t route_hash( const char* p, size_t len )
+{
+    uint32_t h = 2166136261u;
+    for( size_t i=0; i < len; i++ ) {
+        h = (h ^ (uint8_t)p[i]) * 16777619u;
+    }
+    return h;
+}
+
+//
+static void routes_init(void)
+{
+    for( int i=0; i < nroutes; i++ ) {
+        uint32_t h = route_hash( s_routes[i].path, strlen(s_routes[i].path) );
+        while( s_route_slot[ h & (route_slots-1) ] ) h++;
+        s_route_slot[ h & (route_slots-1) ] = i + 1;
+    }
+}
+
+// @return route for path, or NULL
+static const route_t* route_find( const struct mg_str* path )
+{
+    uint32_t h = route_hash( path->p, path->len );
+    for( int n=0; n < route_slots; n++, h++ ) {
+        int i = s_route_slot[ h & (route_slots-1) ];
+        if( i == 0 ) return NULL;
+        if( mg_vcmp( path, s_routes[i-1].path ) == 0 ) return &s_routes[i-1];
+    }
+    return NULL;
+}
+
+//
+static int route_method( const struct mg_str* method )
+{
+    switch( method->len ) {
+    case 3: return (mg_vcmp( method, "GET" ) == 0) ? ROUTE_GET :
+                   (mg_vcmp( method, "PUT" ) == 0) ? ROUTE_PUT : 0;
+    case 4: return (mg_vcmp( method, "POST" ) == 0) ? ROUTE_POST : 0;
+    case 6: return (mg_vcmp( method, "DELETE" ) == 0) ? ROUTE_DELETE : 0;
+    }
+    return 0;
+}
 
 static void ev_handler(struct mg_connection *nc, int ev, void *ev_data)
 {
     struct http_message *hm = (struct http_message *) ev_data;
 
+#ifdef BLINK1_SERVER_TINY
+    if( ev == MG_EV_ACCEPT && ++s_conns > conns_max ) {
+        mg_printf(nc, "%s", "HTTP/1.1 503 Service Unavailable\r\n"
+                  "Retry-After: 1\r\nContent-Length: 0\r\n\r\n");
+        nc->flags |= MG_F_SEND_AND_CLOSE;
+        return;
+    }
+    if( ev == MG_EV_CLOSE && nc->listener != NULL ) s_conns--;
+#endif
+    if( ev == MG_EV_CLOSE ) {
+        events_closed( nc );
+    }
+    if( ev == MG_EV_CLOSE && request_of( nc ) != NULL ) {
+        request_free( request_of( nc ) );  // still waiting on a device, nobody to tell
+        request_detach( nc );
+        return;
+    }
+    if( ev == MG_EV_WEBSOCKET_HANDSHAKE_REQUEST ) {
+        if( mg_vcmp( &hm->uri, "/blink1/ws") != 0 ) {
+            mg_printf(nc, "%s", "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+            nc->flags |= MG_F_SEND_AND_CLOSE;
+        }
+        return;
+    }
+    if( ev == MG_EV_WEBSOCKET_FRAME ) {
+        double start = mg_time();
+        stream_frame( nc, (struct websocket_message *) ev_data );
+        metrics_request( "/blink1/ws", start );
+        return;
+    }
     if( ev != MG_EV_HTTP_REQUEST ) {
         return;
     }
 
-    static uint8_t r,g,b;
-    char result[1000];  result[0] = 0;
     char uristr[1000];
-    char tmpstr[1000];
-    int rc;
-    uint16_t millis = 100;
-    rgb_t rgb = {0,0,0};
-    uint8_t count = 1;
-
-    struct mg_str* uri = &hm->uri;
-    struct mg_str* querystr = &hm->query_string;
-
-    snprintf(uristr, uri->len+1, "%s", uri->p);
-
-    if( mg_get_http_var(querystr, "millis", tmpstr, sizeof(tmpstr)) > 0 ) {
-        millis = strtod(tmpstr,NULL);
-    }
-    if( mg_get_http_var(querystr, "time", tmpstr, sizeof(tmpstr)) > 0 ) {
-        millis = 1000 * strtof(tmpstr,NULL);
-    }
-    if( mg_get_http_var(querystr, "rgb", tmpstr, sizeof(tmpstr)) > 0 ) {
-        //parse_rgbstr( rgb, tmpstr);
-        parsecolor( &rgb, tmpstr);
-        r = rgb.r; g = rgb.g; b = rgb.b;
-    }
-    if( mg_get_http_var(querystr, "count", tmpstr, sizeof(tmpstr)) > 0 ) {
-        count = strtod(tmpstr,NULL);
-    }
-
-    if( mg_vcmp( uri, "/") == 0 ) {
-        sprintf(result, "welcome to blink1-tiny-server api server. All URIs start with '/blink1', e.g. '/blink1/red', '/blink1/off', '/blink1/fadeToRGB?rgb=%%23FF00FF'");
-    }
-    else if( mg_vcmp( uri, "/blink1") == 0 ||
-             mg_vcmp( uri, "/blink1/") == 0  ) {
-        sprintf(result, "blink1 status");
-    }
-    else if( mg_vcmp( uri, "/blink1/off") == 0 ) {
-        sprintf(result, "blink1 off");
-        r = 0; g = 0; b = 0;
-        do_blink1_color();
-    }
-    else if( mg_vcmp( uri, "/blink1/on") == 0 ) {
-        sprintf(result, "blink1 on");
-        r = 255; g = 255; b = 255;
-        do_blink1_color();
-    }
-    else if( mg_vcmp( uri, "/blink1/red") == 0 ) {
-        sprintf(result, "blink1 red");
-        r = 255; g = 0; b = 0;
-        do_blink1_color();
-    }
-    else if( mg_vcmp( uri, "/blink1/green") == 0 ) {
-        sprintf(result, "blink1 green");
-        r = 0; g = 255; b = 0;
-        do_blink1_color();
-    }
-    else if( mg_vcmp( uri, "/blink1/blue") == 0 ) {
-        sprintf(result, "blink1 on");
-        r = 0; g = 0; b = 255;
-        do_blink1_color();
-    }
-    else if( mg_vcmp( uri, "/blink1/fadeToRGB") == 0 ) {
-        sprintf(result, "blink1 fadeToRGB");
-        do_blink1_color();
-    }
-    else if( mg_vcmp( uri, "/blink1/blink") == 0 ) {
-        sprintf(result, "blink1 blink");
-        if( r==0 && g==0 && b==0 ) { r = 255; g = 255; b = 255; }
-        blink1_device* dev = blink1_open();
-        for( int i=0; i<count; i++ ) {
-            blink1_fadeToRGB( dev, millis/2, r,g,b );
-            blink1_sleep( millis/2 ); // fixme
-            blink1_fadeToRGB( dev, millis/2, 0,0,0 );
-            blink1_sleep( millis/2 ); // fixme
-        }
-        blink1_close(dev);
-    }
-    else if( mg_vcmp( uri, "/blink1/random") == 0 ) {
-        sprintf(result, "blink1 random");
-        srand( time(NULL) * getpid() );
-        blink1_device* dev = blink1_open();
-        for( int i=0; i<count; i++ ) {
-            r = rand() % 255;
-            g = rand() % 255;
-            b = rand() % 255 ;
-            blink1_fadeToRGB( dev, millis/2, r,g,b );
-            blink1_sleep( millis/2 ); // fixme
-        }
-        blink1_close(dev);
+    char extrabuf[extra_max];
+    jsonw extra;
+    query_t q;
+    route_ctx c;
+    double start = mg_time();
+    const route_t* rt = route_find( &hm->uri );
+    const char* route = (rt) ? rt->path : "other";  // for metrics
+
+    snprintf(uristr, sizeof(uristr), "%.*s", (int)hm->uri.len, hm->uri.p);
+    jsonw_initMembers( &extra, extrabuf, sizeof(extrabuf) );
+    query_parse( &hm->query_string, &q );
+
+    memset( &c, 0, sizeof(c) );
+    c.nc = nc;
+    c.hm = hm;
+    c.route = rt;
+    c.q = &q;
+    c.uristr = uristr;
+    c.status = 200;
+    c.millis = (q.has & (QUERY_MILLIS|QUERY_TIME)) ? q.millis : 100;
+    c.r = q.rgb.r; c.g = q.rgb.g; c.b = q.rgb.b;
+    c.extra = &extra;
+
+    if( rt == NULL ) {
+        sprintf(c.result, "; unrecognized uri");
+        //mg_serve_http(nc, hm, s_http_server_opts); /* Serve static content */
+    }
+    else if( !(rt->methods & route_method( &hm->method )) ) {
+        c.status = 405;
+        snprintf(c.result, sizeof(c.result), "method not allowed");
     }
     else {
-        sprintf(result, "%s; unrecognized uri", result);
-        //mg_serve_http(nc, hm, s_http_server_opts); /* Serve static content */
+        if( (rt->flags & ROUTE_ALLDEVS) && !(q.has & QUERY_ID) ) {
+            c.ndevs = devmgr_parseIds( strcpy(q.id, "all"), &c.devs );
+        }
+        else if( rt->flags & (ROUTE_DEVS|ROUTE_ALLDEVS) ) {
+            if( q.has & QUERY_ID ) {
+                c.ndevs = devmgr_parseIds( q.id, &c.devs );
+            } else {
+                devmgr_set_add( &c.devs, 0 );  // default first device
+                c.ndevs = 1;
+            }
+        }
+        if( c.ndevs < 0 ) {
+            snprintf(c.result, sizeof(c.result), "unknown blink1 id '%s'", q.id);
+        } 
+        else if( q.ledn < 0 || q.ledn >= devmgr_leds_max ) {
+            snprintf(c.result, sizeof(c.result), "bad ledn, must be 0-%d", 
+                     devmgr_leds_max - 1);
+        } else {
+            rt->func( &c );
+        }
     }
 
-    if( result[0] != '\0' ) {
-        sprintf(tmpstr, "#%2.2x%2.2x%2.2x", r,g,b );
-        mg_printf(nc, "%s", "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
-        mg_printf_http_chunk(nc,
-                             "{\n"
-                             "\"uri\":  \"%s\",\n"
-                             "\"result\":  \"%s\",\n"
-                             "\"millis\": \"%d\",\n"
-                             "\"rgb\": \"%s\",\n"
-                             "\"version\": \"%s\"\n"
-                             "}\n",
-                             uristr,
-                             result,
-                             millis,
-                             tmpstr,
-                             blink1_server_version
-                             );
-        mg_send_http_chunk(nc, "", 0); /* Send empty chunk, the end of response */
+    if( c.result[0] != '\0' ) {
+        if( c.jobid > 0 ) {
+            jsonw_kint( &extra, "job_id", c.jobid );
+        }
+        send_reply( nc, c.status, uristr, c.result, c.millis, c.r,c.g,c.b, &extra );
+        metrics_request( route, start );
+    }
+    else if( request_of( nc ) != NULL ) {  // counted when devices are done
+        request_of( nc )->start = start;
     }
+    else {  // events & metrics
+        metrics_request( route, start );
+    }
+}
 
+//
+static void signal_handler( int signo )
+{
+    s_signo = signo;
 }
 
 int main(int argc, char *argv[]) {
-    struct mg_mgr mgr;
     struct mg_connection *nc;
     struct mg_bind_opts bind_opts;
     int i;
     char *cp;
     const char *err_str;
 
-    mg_mgr_init(&mgr, NULL);
+    mg_mgr_init(&s_mgr, NULL);
+    routes_init();
+    s_main_thread = pthread_self();
 
   /* Process command line options to customize HTTP server */
   for (i = 1; i < argc; i++) {
       if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
           s_http_port = argv[++i];
       }
+      else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+          s_unix_path = argv[++i];
+      }
+      else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+          s_bin_port = argv[++i];
+      }
+#ifndef BLINK1_SERVER_TINY
+      else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+          s_coap_port = argv[++i];
+      }
+      else if (strcmp(argv[i], "-M") == 0 && i + 1 < argc) {
+          s_mqtt_port = argv[++i];
+      }
+#endif
+      else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+          s_unix_mode = strtol(argv[++i], NULL, 8);
+      }
+      else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+          s_sched_path = argv[++i];
+      }
+      else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+          s_rescan_millis = strtol(argv[++i], NULL, 10);
+      }
+      else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) {
+          devmgr_setRate( strtod(argv[++i], NULL) );
+      }
+      else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+          i++;
+          s_policy = (strcmp(argv[i], "ack") == 0) ? POLICY_ACK :
+                     (strcmp(argv[i], "reject") == 0) ? POLICY_REJECT : POLICY_QUEUE;
+      }
   }
 
   /* Set HTTP server options */
     memset(&bind_opts, 0, sizeof(bind_opts));
     bind_opts.error_string = &err_str;
 
-    nc = mg_bind_opt(&mgr, s_http_port, ev_handler, bind_opts);
-    if (nc == NULL) {
-        fprintf(stderr, "Error starting server on port %s: %s\n", s_http_port,
-                *bind_opts.error_string);
+    if( strcmp(s_http_port, "off") != 0 ) {
+        nc = mg_bind_opt(&s_mgr, s_http_port, ev_handler, bind_opts);
+        if (nc == NULL) {
+            fprintf(stderr, "Error starting server on port %s: %s\n", s_http_port,
+                    *bind_opts.error_string);
+            exit(1);
+        }
+        mg_set_protocol_http_websocket(nc);
+    }
+    else if( s_unix_path == NULL ) {
+        fprintf(stderr, "Error: no port or socket to listen on\n");
         exit(1);
     }
+    if( s_unix_path ) {
+        nc = unixsock_bind(&s_mgr, s_unix_path, s_unix_mode, ev_handler, &err_str);
+        if (nc == NULL) {
+            fprintf(stderr, "Error starting server on socket %s: %s\n", s_unix_path, err_str);
+            exit(1);
+        }
+        mg_set_protocol_http_websocket(nc);
+    }
+    if( s_bin_port ) {
+        if( binproto_bind(&s_mgr, s_bin_port, &err_str) != 0 ) {
+            fprintf(stderr, "Error starting binary protocol on port %s: %s\n", s_bin_port, err_str);
+            exit(1);
+        }
+    }
+#ifndef BLINK1_SERVER_TINY
+    if( s_mqtt_port ) {
+        if( broker_bind(&s_mgr, s_mqtt_port, &err_str) != 0 ) {
+            fprintf(stderr, "Error starting MQTT broker on %s: %s\n", s_mqtt_port, err_str);
+            exit(1);
+        }
+    }
+    if( s_coap_port ) {
+        if( coap_bind(&s_mgr, s_coap_port, ev_handler, &err_str) != 0 ) {
+            fprintf(stderr, "Error starting CoAP on %s: %s\n", s_coap_port, err_str);
+            exit(1);
+        }
+    }
+#endif
 
-    mg_set_protocol_http_websocket(nc);
-
+#if MG_ENABLE_FILESYSTEM
     s_http_server_opts.enable_directory_listing = "no";
+#endif
+
+    events_init( &s_mgr );
+    devmgr_onChange( device_changed );
+    int n = devmgr_init( s_rescan_millis, devop_notify );
+    printf("blink1-server: %d device%s found\n", n, (n==1) ? "" : "s");
+    if( s_sched_path ) {
+        n = sched_init( s_sched_path );
+        if( n < 0 ) {
+            fprintf(stderr, "Error opening schedule journal %s\n", s_sched_path);
+            exit(1);
+        }
+        printf("blink1-server: %d schedule%s from %s\n", n, (n==1) ? "" : "s", s_sched_path);
+    }
+
+    if( strcmp(s_http_port, "off") != 0 ) {
+        printf("blink1-server: running on port %s\n", s_http_port);
+    }
+    if( s_unix_path ) {
+        printf("blink1-server: running on socket %s\n", s_unix_path);
+    }
+    if( s_bin_port ) {
+        printf("blink1-server: binary protocol on udp & tcp port %s\n", s_bin_port);
+    }
+#ifndef BLINK1_SERVER_TINY
+    if( s_mqtt_port ) {
+        printf("blink1-server: MQTT broker on %s\n", s_mqtt_port);
+    }
+    if( s_coap_port ) {
+        printf("blink1-server: CoAP on udp %s\n", s_coap_port);
+    }
+#endif
+    signal( SIGINT, signal_handler );
+    signal( SIGTERM, signal_handler );
 
-    printf("blink1-server: running on port %s\n", s_http_port);
+    srand( time(NULL) * getpid() );
 
-    for (;;) {
-        mg_mgr_poll(&mgr, 1000);
+    while( s_signo == 0 ) {
+        int wait = jobs_run();  // timed effects are stepped from here
+        int devwait = devmgr_work();  // device writes, if no worker threads
+        if( devwait >= 0 && (wait < 0 || devwait < wait) ) wait = devwait;
+        int schedwait = sched_run();  // scheduled batches, checked each second
+        if( schedwait >= 0 && (wait < 0 || schedwait < wait) ) wait = schedwait;
+        mg_mgr_poll(&s_mgr, (wait >= 0 && wait < 1000) ? wait : 1000);
+        devmgr_poll();
+        events_poll();
+#ifndef BLINK1_SERVER_TINY
+        broker_poll();
+#endif
     }
-    mg_mgr_free(&mgr);
+    devmgr_close();
+    mg_mgr_free(&s_mgr);
+    if( s_unix_path ) unixsock_close( s_unix_path );
 
     return 0;
 }
@@ -0,0 +1,460 @@
+/*
+ * broker -- small MQTT 3.1.1 broker inside blink1-tiny-server
+ *
+ * see broker.h
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mongoose.h"
+#include "blink1-lib.h"
+#include "devmgr.h"
+#include "metrics.h"
+#include "broker.h"
+
+typedef struct broker_client_ {
+    int connected;          // got CONNECT
+    int nsubs;
+    char subs[broker_subs_max][broker_topic_max];
+} broker_client;
+
+typedef struct broker_retained_ {
+    char topic[broker_topic_max];
+    char payload[broker_payload_max];
+    int len;
+} broker_retained;
+
+static struct mg_mgr* broker_mgr = NULL;
+static int clients = 0;
+static broker_retained retained[broker_retained_max];
+static int retained_count = 0;
+static uint32_t dirty[devmgr_max];  // per device, bit per ledn with unpublished state
+static int dirty_any = 0;
+
+static void broker_handler( struct mg_connection* nc, int ev, void* ev_data );
+
+// send a packet: fixed header, remaining length, then a and b
+static void broker_send( struct mg_connection* nc, uint8_t hdr,
+                         const void* a, int alen, const void* b, int blen )
+{
+    uint8_t h[5];
+    int n = 0, len = alen + blen;
+    h[n++] = hdr;
+    do {
+        h[n] = len % 128;
+        len /= 128;
+        if( len > 0 ) h[n] |= 0x80;
+        n++;
+    } while( len > 0 );
+    mg_send( nc, h, n );
+    if( alen ) mg_send( nc, a, alen );
+    if( blen ) mg_send( nc, b, blen );
+}
+
+// send a packet that's just a message id
+static void broker_ack( struct mg_connection* nc, uint8_t hdr, uint16_t msgid )
+{
+    uint8_t id[2] = { msgid >> 8, msgid & 0xff };
+    broker_send( nc, hdr, id, 2, NULL, 0 );
+}
+
+//
+static void broker_publishTo( struct mg_connection* nc, const char* topic,
+                              const void* payload, int len, int retain )
+{
+    uint8_t var[2 + broker_topic_max];
+    int tlen = strlen(topic);
+    var[0] = tlen >> 8;
+    var[1] = tlen & 0xff;
+    memcpy( var+2, topic, tlen );
+    broker_send( nc, (MG_MQTT_CMD_PUBLISH << 4) | (retain ? MG_MQTT_RETAIN : 0),
+                 var, 2+tlen, payload, len );
+}
+
+// MQTT topic filter matching, with '+' for one level & '#' for the rest
+static int broker_match( const char* filter, const char* topic )
+{
+    if( topic[0] == '$' && (filter[0] == '+' || filter[0] == '#') ) return 0;
+    while( *filter ) {
+        if( *filter == '#' ) return 1;
+        if( filter[0] == '/' && filter[1] == '#' && *topic == '\0' ) return 1;  // "a/#" matches "a"
+        if( *filter == '+' ) {
+            while( *topic && *topic != '/' ) topic++;
+            filter++;
+            continue;
+        }
+        if( *filter != *topic ) return 0;
+        filter++;
+        topic++;
+    }
+    return *topic == '\0';
+}
+
+//
+static int broker_subscribed( broker_client* bc, const char* topic )
+{
+    for( int i=0; i < bc->nsubs; i++ ) {
+        if( broker_match( bc->subs[i], topic ) ) return 1;
+    }
+    return 0;
+}
+
+// send to every client with a matching subscription, dropping ones that fell behind
+static void broker_publish( const char* topic, const void* payload, int len )
+{
+    for( struct mg_connection* c = mg_next(broker_mgr, NULL); c != NULL;
+         c = mg_next(broker_mgr, c) ) {
+        broker_client* bc = (broker_client*) c->user_data;
+        if( c->handler != broker_handler || bc == NULL ) continue;
+        if( !broker_subscribed( bc, topic ) ) continue;
+        if( c->send_mbuf.len > broker_sendbuf_max ) {
+            c->flags |= MG_F_CLOSE_IMMEDIATELY;
+            continue;
+        }
+        broker_publishTo( c, topic, payload, len, 0 );
+    }
+}
+
+// LEDs to publish state for, as in events_formatState()
+static int broker_nleds( devmgr_dev* d )
+{
+    int nleds = (d->type == BLINK1_MK1) ? 0 : devmgr_leds_hw;
+    if( d->state.ledn_max > nleds ) nleds = d->state.ledn_max;
+    return nleds;
+}
+
+//
+static int broker_state( devmgr_dev* d, int ledn, char* topic, char* payload )
+{
+    devmgr_led* l = &d->state.leds[ledn];
+    snprintf(topic, broker_topic_max, "blink1/%s/%d/state", d->serial, ledn);
+    return sprintf(payload, "#%2.2x%2.2x%2.2x", l->r, l->g, l->b);
+}
+
+// device state topics are made up from the state shadow, not stored
+static int broker_isState( const char* topic )
+{
+    return broker_match( "blink1/+/+/state", topic );
+}
+
+// keep, replace or (with an empty payload) forget a retained message
+static void broker_retain( const char* topic, const uint8_t* payload, int len )
+{
+    int i;
+    if( broker_isState( topic ) ) return;
+    for( i=0; i < retained_count; i++ ) {
+        if( strcmp( retained[i].topic, topic ) == 0 ) break;
+    }
+    if( len == 0 || len > broker_payload_max ) {
+        if( i < retained_count ) retained[i] = retained[--retained_count];
+        return;
+    }
+    if( i == retained_count ) {
+        if( retained_count == broker_retained_max ) return;
+        snprintf(retained[i].topic, broker_topic_max, "%s", topic);
+        retained_count++;
+    }
+    memcpy( retained[i].payload, payload, len );
+    retained[i].len = len;
+}
+
+// send retained messages & device states matching a new subscription
+static void broker_sendRetained( struct mg_connection* nc, const char* filter )
+{
+    char topic[broker_topic_max];
+    char payload[10];
+    for( int i=0; i < retained_count; i++ ) {
+        if( broker_match( filter, retained[i].topic ) ) {
+            broker_publishTo( nc, retained[i].topic, retained[i].payload, retained[i].len, 1 );
+        }
+    }
+    for( int i=0; i < devmgr_count(); i++ ) {
+        devmgr_dev* d = devmgr_get(i);
+        for( int l=0; l <= broker_nleds(d); l++ ) {
+            int len = broker_state( d, l, topic, payload );
+            if( broker_match( filter, topic ) ) broker_publishTo( nc, topic, payload, len, 1 );
+        }
+    }
+}
+
+// topic is blink1/<id>/<ledn>/set: fade those LEDs
+// @return 1 if it was a set, 0 if not
+static int broker_set( const char* topic, const uint8_t* payload, int len )
+{
+    char idstr[broker_topic_max];
+    char cmd[8];
+    char buf[64];
+    int ledn;
+    if( sscanf( topic, "blink1/%127[^/]/%d/%7s", idstr, &ledn, cmd ) != 3 ||
+        strcmp( cmd, "set" ) != 0 ) return 0;
+    if( ledn < 0 || ledn >= devmgr_leds_max || len == 0 || len >= (int)sizeof(buf) ) return 1;
+
+    memcpy( buf, payload, len );
+    buf[len] = '\0';
+    devop_t op;
+    memset( &op, 0, sizeof(op) );
+    char* millisstr = strchr( buf, ' ' );
+    if( millisstr ) {
+        *millisstr++ = '\0';
+        op.millis = strtol( millisstr, NULL, 10 );
+    }
+    rgb_t rgb = {0,0,0};
+    parsecolor( &rgb, buf );
+    op.type = DEVOP_FADE;
+    op.ledn = ledn;
+    op.r = rgb.r; op.g = rgb.g; op.b = rgb.b;
+
+    devmgr_set devs;
+    memset( &devs, 0, sizeof(devs) );
+    if( devmgr_parseIds( idstr, &devs ) <= 0 ) return 1;
+    for( int i=0; i < devmgr_count(); i++ ) {
+        if( devmgr_set_has( &devs, i ) ) devmgr_stream( i, &op );
+    }
+    return 1;
+}
+
+// read a length-prefixed string at *p into str
+static int broker_getStr( const uint8_t** p, const uint8_t* end, char* str, int max )
+{
+    if( end - *p < 2 ) return -1;
+    int len = ((*p)[0] << 8) | (*p)[1];
+    if( end - *p < 2 + len || len >= max ) return -1;
+    memcpy( str, *p + 2, len );
+    str[len] = '\0';
+    *p += 2 + len;
+    return len;
+}
+
+//
+static int broker_handlePublish( struct mg_connection* nc, uint8_t hdr,
+                                 const uint8_t* p, const uint8_t* end )
+{
+    char topic[broker_topic_max];
+    int qos = MG_MQTT_GET_QOS( hdr );
+    uint16_t msgid = 0;
+    double start = mg_time();
+
+    if( broker_getStr( &p, end, topic, sizeof(topic) ) <= 0 || qos == 3 ) return -1;
+    if( strpbrk( topic, "+#" ) ) return -1;
+    if( qos > 0 ) {
+        if( end - p < 2 ) return -1;
+        msgid = (p[0] << 8) | p[1];
+        p += 2;
+    }
+    int len = end - p;
+
+    if( broker_set( topic, p, len ) ) metrics_request( "mqtt/set", start );
+    if( hdr & MG_MQTT_RETAIN ) broker_retain( topic, p, len );
+    broker_publish( topic, p, len );
+
+    if( qos == 1 ) broker_ack( nc, MG_MQTT_CMD_PUBACK << 4, msgid );
+    if( qos == 2 ) broker_ack( nc, MG_MQTT_CMD_PUBREC << 4, msgid );
+    return 0;
+}
+
+//
+static int broker_handleSubscribe( struct mg_connection* nc, broker_client* bc,
+                                   const uint8_t* p, const uint8_t* end )
+{
+    char filter[broker_topic_max];
+    uint8_t codes[broker_packet_max / 4];
+    int n = 0;
+    if( end - p < 2 ) return -1;
+    uint16_t msgid = (p[0] << 8) | p[1];
+    const uint8_t* topics = p + 2;
+
+    for( p = topics; p < end; p++ ) {  // skip requested QoS, all are granted 0
+        if( broker_getStr( &p, end, filter, sizeof(filter) ) <= 0 || p >= end ) return -1;
+        int i;
+        for( i=0; i < bc->nsubs && strcmp( bc->subs[i], filter ) != 0; i++ ) ;
+        if( i == bc->nsubs && bc->nsubs < broker_subs_max ) {
+            snprintf(bc->subs[bc->nsubs++], broker_topic_max, "%s", filter);
+        }
+        codes[n++] = (i < bc->nsubs) ? 0 : 0x80;
+    }
+    if( n == 0 ) return -1;
+    uint8_t id[2] = { msgid >> 8, msgid & 0xff };
+    broker_send( nc, MG_MQTT_CMD_SUBACK << 4, id, 2, codes, n );
+
+    n = 0;
+    for( p = topics; p < end; p++ ) {
+        broker_getStr( &p, end, filter, sizeof(filter) );
+        if( codes[n++] == 0 ) broker_sendRetained( nc, filter );
+    }
+    return 0;
+}
+
+//
+static int broker_handleUnsubscribe( struct mg_connection* nc, broker_client* bc,
+                                     const uint8_t* p, const uint8_t* end )
+{
+    char filter[broker_topic_max];
+    if( end - p < 2 ) return -1;
+    uint16_t msgid = (p[0] << 8) | p[1];
+    for( p += 2; p < end; ) {
+        if( broker_getStr( &p, end, filter, sizeof(filter) ) <= 0 ) return -1;
+        for( int i=0; i < bc->nsubs; i++ ) {
+            if( strcmp( bc->subs[i], filter ) != 0 ) continue;
+            memcpy( bc->subs[i], bc->subs[--bc->nsubs], broker_topic_max );
+            break;
+        }
+    }
+    broker_ack( nc, MG_MQTT_CMD_UNSUBACK << 4, msgid );
+    return 0;
+}
+
+//
+static int broker_handleConnect( struct mg_connection* nc, broker_client* bc,
+                                 const uint8_t* p, const uint8_t* end )
+{
+    char proto[8];
+    uint8_t ack[2] = { 0, MG_EV_MQTT_CONNACK_ACCEPTED };
+    if( bc->connected ) return -1;
+    if( broker_getStr( &p, end, proto, sizeof(proto) ) < 0 || end - p < 4 ) return -1;
+    if( !(strcmp(proto, "MQTT") == 0 && p[0] == 4) &&
+        !(strcmp(proto, "MQIsdp") == 0 && p[0] == 3) ) {
+        ack[1] = MG_EV_MQTT_CONNACK_UNACCEPTABLE_VERSION;
+        nc->flags |= MG_F_SEND_AND_CLOSE;
+    }
+    broker_send( nc, MG_MQTT_CMD_CONNACK << 4, ack, 2, NULL, 0 );
+    bc->connected = 1;
+    return 0;
+}
+
+// size of the packet at the front of buf, 0 if not all here yet, -1 if bad
+static int broker_packetLen( const uint8_t* buf, int len, int* hlen )
+{
+    int rem = 0;
+    for( int i=1; i <= 4; i++ ) {
+        if( i >= len ) return 0;
+        rem |= (buf[i] & 0x7f) << (7 * (i-1));
+        if( buf[i] & 0x80 ) continue;
+        int total = i + 1 + rem;
+        if( total > broker_packet_max ) return -1;
+        *hlen = i + 1;
+        return (len >= total) ? total : 0;
+    }
+    return -1;
+}
+
+// handle one packet, -1 if the connection should be dropped
+static int broker_packet( struct mg_connection* nc, broker_client* bc,
+                          const uint8_t* buf, int hlen, int len )
+{
+    uint8_t hdr = buf[0];
+    const uint8_t* p = buf + hlen;
+    const uint8_t* end = buf + len;
+    int cmd = hdr >> 4;
+
+    if( !bc->connected && cmd != MG_MQTT_CMD_CONNECT ) return -1;
+    switch( cmd ) {
+    case MG_MQTT_CMD_CONNECT:
+        return broker_handleConnect( nc, bc, p, end );
+    case MG_MQTT_CMD_PUBLISH:
+        return broker_handlePublish( nc, hdr, p, end );
+    case MG_MQTT_CMD_PUBREL:
+        if( end - p < 2 ) return -1;
+        broker_ack( nc, MG_MQTT_CMD_PUBCOMP << 4, (p[0] << 8) | p[1] );
+        return 0;
+    case MG_MQTT_CMD_SUBSCRIBE:
+        return broker_handleSubscribe( nc, bc, p, end );
+    case MG_MQTT_CMD_UNSUBSCRIBE:
+        return broker_handleUnsubscribe( nc, bc, p, end );
+    case MG_MQTT_CMD_PINGREQ:
+        broker_send( nc, MG_MQTT_CMD_PINGRESP << 4, NULL, 0, NULL, 0 );
+        return 0;
+    case MG_MQTT_CMD_DISCONNECT:
+        nc->flags |= MG_F_SEND_AND_CLOSE;
+        return 0;
+    default:
+        return 0;  // acks for QoS we never send
+    }
+}
+
+//
+static void broker_handler( struct mg_connection* nc, int ev, void* ev_data )
+{
+    (void) ev_data;
+    broker_client* bc = (broker_client*) nc->user_data;
+    struct mbuf* io = &nc->recv_mbuf;
+    int hlen, len;
+
+    switch( ev ) {
+    case MG_EV_ACCEPT:
+        nc->user_data = calloc( 1, sizeof(broker_client) );
+        clients++;
+        break;
+    case MG_EV_RECV:
+        // every complete packet, a flood can arrive in one read
+        while( (len = broker_packetLen( (const uint8_t*)io->buf, io->len, &hlen )) != 0 ) {
+            if( len < 0 || broker_packet( nc, bc, (const uint8_t*)io->buf, hlen, len ) < 0 ) {
+                nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+                break;
+            }
+            mbuf_remove( io, len );
+            if( nc->flags & MG_F_SEND_AND_CLOSE ) break;
+        }
+        break;
+    case MG_EV_CLOSE:
+        if( bc ) {
+            free( bc );
+            nc->user_data = NULL;
+            clients--;
+        }
+        break;
+    }
+}
+
+//
+int broker_bind( struct mg_mgr* mgr, const char* address, const char** errstr )
+{
+    struct mg_bind_opts opts;
+    memset( &opts, 0, sizeof(opts) );
+    opts.error_string = errstr;
+    broker_mgr = mgr;
+    return ( mg_bind_opt( mgr, address, broker_handler, opts ) ) ? 0 : -1;
+}
+
+//
+void broker_deviceChanged( devmgr_change_t change, devmgr_dev* d,
+                           int i, uint8_t ledn )
+{
+    (void) d;
+    if( change == DEVMGR_COLOR && i >= 0 && i < devmgr_max ) {
+        dirty[i] |= (ledn == 0) ? 0xffffffff : (1u << ledn);
+    }
+    else if( change == DEVMGR_ADDED || change == DEVMGR_REMOVED ) {
+        memset( dirty, 0xff, sizeof(dirty) );  // indexes may have moved
+    }
+    dirty_any = 1;
+}
+
+//
+void broker_poll(void)
+{
+    char topic[broker_topic_max];
+    char payload[10];
+    if( !dirty_any ) return;
+    dirty_any = 0;
+    if( clients > 0 ) {
+        for( int i=0; i < devmgr_count(); i++ ) {
+            if( dirty[i] == 0 ) continue;
+            devmgr_dev* d = devmgr_get(i);
+            for( int l=0; l <= broker_nleds(d); l++ ) {
+                if( !(dirty[i] & (1u << l)) ) continue;
+                int len = broker_state( d, l, topic, payload );
+                broker_publish( topic, payload, len );
+            }
+        }
+    }
+    memset( dirty, 0, sizeof(dirty) );
+}
+
+//
+int broker_clients(void)
+{
+    return clients;
+}
@@ -0,0 +1,65 @@
+/*
+ * broker -- small MQTT 3.1.1 broker inside blink1-tiny-server
+ *
+ * Clients connect, publish & subscribe as with any broker, and topics
+ * under "blink1/" are tied to the devices:
+ *
+ *   blink1/<id>/<ledn>/set     publish a color to fade a device's LED to.
+ *                              <id> is a serial, index or "all", as the
+ *                              HTTP "id" arg, and ledn 0 is all LEDs.
+ *                              Payload is a color as the "rgb" arg, with
+ *                              an optional fade time: "#ff0000 250"
+ *
+ *   blink1/<serial>/<ledn>/state   published by the server with the
+ *                              LED's color, "#ff0000", whenever it
+ *                              changes.  Always retained, so subscribers
+ *                              get the last-known state at once.
+ *
+ * Sets go through devmgr_stream(), so a flood of QoS 0 publishes leaves
+ * only the latest color per LED waiting for the device.  State changes
+ * are collected and published from the main loop, at most once per LED
+ * per loop, so subscribers see the same collapsing.
+ *
+ * Other topics are forwarded to matching subscribers ('+' & '#' work)
+ * and retained messages are kept in memory.  Publishes may be QoS 0-2,
+ * subscriptions are granted QoS 0.  There are no persistent sessions,
+ * wills or authentication; bind to localhost if that matters.
+ *
+ */
+
+#ifndef __BROKER_H__
+#define __BROKER_H__
+
+#include "mongoose.h"
+#include "devmgr.h"
+
+#define broker_packet_max     4096   // bigger packets close the connection
+#define broker_topic_max      128
+#define broker_payload_max    256    // of retained messages
+#define broker_subs_max       16     // per client
+#define broker_retained_max   64
+#define broker_sendbuf_max    (256*1024) // drop subscriber past this backlog
+
+/**
+ * Listen for MQTT clients on address, e.g. "1883" or "127.0.0.1:1883".
+ * @return 0 on success, -1 with errstr set on failure
+ */
+int broker_bind( struct mg_mgr* mgr, const char* address, const char** errstr );
+
+/**
+ * devmgr_change_func that marks LED state to be published.
+ */
+void broker_deviceChanged( devmgr_change_t change, devmgr_dev* d,
+                           int i, uint8_t ledn );
+
+/**
+ * Publish changed LED states.  Call from the main loop.
+ */
+void broker_poll(void);
+
+/**
+ * @return number of connected clients
+ */
+int broker_clients(void);
+
+#endif
@@ -0,0 +1,216 @@
+/*
+ * coap -- CoAP over UDP front end for blink1-tiny-server
+ *
+ * see coap.h
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mongoose.h"
+#include "coap.h"
+
+#define COAP_OPT_URI_PATH        11
+#define COAP_OPT_CONTENT_FORMAT  12
+#define COAP_OPT_URI_QUERY       15
+#define COAP_FORMAT_JSON         50
+
+#define coap_uri_max   1000
+
+// per client address, hung off its connection's proto_data
+typedef struct coap_peer_ {
+    uint16_t mid;           // message id of last request
+    uint8_t type;           // of last request, MG_COAP_MSG_CON or _NOC
+    uint8_t token[8];
+    uint8_t toklen;
+    int have_mid;
+    int answered;           // reply to last request has been sent
+    struct mbuf reply;      // that reply, resent if a CON is retransmitted
+    double last;            // mg_time() of last request
+} coap_peer;
+
+static mg_event_handler_t s_http_handler = NULL;
+static uint16_t s_last_mid = 0;
+
+//
+static void coap_peer_free( void* proto_data )
+{
+    coap_peer* p = (coap_peer*) proto_data;
+    mbuf_free( &p->reply );
+    free( p );
+}
+
+// append a message to io, status is HTTP-style (404 = 4.04) or 0 for empty
+static void coap_compose( struct mbuf* io, uint8_t type, uint16_t mid,
+                          const uint8_t* token, int toklen, int status,
+                          const char* body, int len )
+{
+    struct mg_coap_message cm;
+    char format = COAP_FORMAT_JSON;
+    int code = (status == 200) ? 205 : status;  // 2.05 Content
+    memset( &cm, 0, sizeof(cm) );
+    cm.msg_type = type;
+    cm.msg_id = mid;
+    cm.token = mg_mk_str_n( (const char*)token, toklen );
+    cm.code_class = code / 100;
+    cm.code_detail = code % 100;
+    if( len > 0 ) {
+        mg_coap_add_option( &cm, COAP_OPT_CONTENT_FORMAT, &format, 1 );
+        cm.payload = mg_mk_str_n( body, len );
+    }
+    mg_coap_compose( &cm, io );
+    mg_coap_free_options( &cm );
+}
+
+// answer a message without making it the peer's current request
+static void coap_answer( struct mg_connection* nc, struct mg_coap_message* cm,
+                         uint8_t type, int status )
+{
+    struct mbuf io;
+    mbuf_init( &io, 0 );
+    coap_compose( &io, type, (type == MG_COAP_MSG_NOC) ? ++s_last_mid : cm->msg_id,
+                  (const uint8_t*)cm->token.p, cm->token.len, status, NULL, 0 );
+    mg_send( nc, io.buf, io.len );  // one datagram
+    mbuf_free( &io );
+}
+
+// paths passed on to the HTTP handler, ones that stream or aren't JSON aren't
+static int coap_served( const char* uri )
+{
+    return strncmp( uri, "/blink1", 7 ) == 0 &&
+        strcmp( uri, "/blink1/events" ) != 0 && strcmp( uri, "/blink1/ws" ) != 0;
+}
+
+//
+static void coap_request( struct mg_connection* nc, coap_peer* p,
+                          struct mg_coap_message* cm )
+{
+    static const char* methods[] = { "", "GET", "POST", "PUT", "DELETE" };
+    char uri[coap_uri_max];
+    char query[coap_uri_max];
+    int ulen = 0, qlen = 0;
+    int con = (cm->msg_type == MG_COAP_MSG_CON);
+
+    if( cm->flags & MG_COAP_ERROR ) {
+        if( con ) coap_answer( nc, cm, MG_COAP_MSG_RST, 0 );
+        return;
+    }
+    if( cm->code_class != MG_COAP_CODECLASS_REQUEST || cm->code_detail == 0 ||
+        cm->code_detail > 4 ) {
+        if( con ) coap_answer( nc, cm, MG_COAP_MSG_RST, 0 );  // includes CoAP ping
+        return;
+    }
+    p->last = mg_time();
+    if( p->have_mid && cm->msg_id == p->mid ) {  // retransmitted
+        if( p->answered ) mg_send( nc, p->reply.buf, p->reply.len );
+        return;
+    }
+    if( nc->flags & REQUEST_WAITING ) {  // earlier request still on devices
+        coap_answer( nc, cm, (con) ? MG_COAP_MSG_ACK : MG_COAP_MSG_NOC, 503 );
+        return;
+    }
+    p->mid = cm->msg_id;
+    p->have_mid = 1;
+    p->type = cm->msg_type;
+    p->toklen = cm->token.len;
+    memcpy( p->token, cm->token.p, cm->token.len );
+    p->answered = 0;
+
+    for( struct mg_coap_option* o = cm->options; o != NULL; o = o->next ) {
+        if( o->number == COAP_OPT_URI_PATH ) {
+            ulen += snprintf(uri+ulen, sizeof(uri)-ulen, "/%.*s", (int)o->value.len, o->value.p);
+        }
+        else if( o->number == COAP_OPT_URI_QUERY ) {
+            qlen += snprintf(query+qlen, sizeof(query)-qlen, "%s%.*s", (qlen) ? "&" : "",
+                             (int)o->value.len, o->value.p);
+        }
+        if( ulen >= (int)sizeof(uri) || qlen >= (int)sizeof(query) ) {
+            coap_reply( nc, 414, NULL, 0 );  // 4.14 Request-URI Too Long
+            return;
+        }
+    }
+    if( ulen == 0 ) ulen = sprintf(uri, "/");
+    if( !coap_served( uri ) ) {
+        coap_reply( nc, 404, NULL, 0 );
+        return;
+    }
+
+    struct http_message hm;
+    memset( &hm, 0, sizeof(hm) );
+    hm.method = mg_mk_str( methods[cm->code_detail] );
+    hm.uri = mg_mk_str_n( uri, ulen );
+    hm.query_string = mg_mk_str_n( query, qlen );
+    hm.body = cm->payload;
+    s_http_handler( nc, MG_EV_HTTP_REQUEST, &hm );
+}
+
+//
+static void coap_handler( struct mg_connection* nc, int ev, void* ev_data )
+{
+    coap_peer* p = (coap_peer*) nc->proto_data;
+
+    switch( ev ) {
+    case MG_EV_ACCEPT:
+        // keep the connection for replies that come after device writes
+        nc->flags &= ~MG_F_SEND_AND_CLOSE;
+        nc->flags |= COAP_PEER;
+        p = calloc( 1, sizeof(coap_peer) );
+        if( p == NULL ) {
+            nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+            break;
+        }
+        mbuf_init( &p->reply, 0 );
+        p->last = mg_time();
+        nc->proto_data = p;
+        nc->proto_data_destructor = coap_peer_free;
+        mg_set_timer( nc, p->last + coap_idle_secs );
+        break;
+    case MG_EV_TIMER:
+        if( !(nc->flags & REQUEST_WAITING) && mg_time() - p->last >= coap_idle_secs ) {
+            nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+        } else {
+            mg_set_timer( nc, mg_time() + coap_idle_secs );
+        }
+        break;
+    case MG_EV_COAP_CON:
+    case MG_EV_COAP_NOC:
+        if( p ) coap_request( nc, p, (struct mg_coap_message*) ev_data );
+        break;
+    case MG_EV_CLOSE:
+        s_http_handler( nc, ev, ev_data );  // frees a request still pending
+        break;
+    }
+}
+
+//
+void coap_reply( struct mg_connection* nc, int status, const char* body, int len )
+{
+    coap_peer* p = (coap_peer*) nc->proto_data;
+    if( !(nc->flags & COAP_PEER) || p == NULL || p->answered ) return;
+    int con = (p->type == MG_COAP_MSG_CON);
+    p->reply.len = 0;
+    coap_compose( &p->reply, (con) ? MG_COAP_MSG_ACK : MG_COAP_MSG_NOC,
+                  (con) ? p->mid : ++s_last_mid, p->token, p->toklen,
+                  status, body, len );
+    mg_send( nc, p->reply.buf, p->reply.len );
+    p->answered = 1;
+}
+
+//
+int coap_bind( struct mg_mgr* mgr, const char* address,
+               mg_event_handler_t http_handler, const char** errstr )
+{
+    char addr[100];
+    struct mg_bind_opts opts;
+    memset( &opts, 0, sizeof(opts) );
+    opts.error_string = errstr;
+    s_http_handler = http_handler;
+
+    snprintf(addr, sizeof(addr), "udp://%s", address);
+    struct mg_connection* nc = mg_bind_opt( mgr, addr, coap_handler, opts );
+    if( nc == NULL ) return -1;
+    mg_set_protocol_coap( nc );
+    return 0;
+}
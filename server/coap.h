@@ -0,0 +1,51 @@
+/*
+ * coap -- CoAP over UDP front end for blink1-tiny-server
+ *
+ * For microcontrollers where HTTP over TCP is too much.  A CoAP request
+ * is turned into the same request the HTTP API gets, so
+ *
+ *   coap://host:5683/blink1/fadeToRGB?rgb=%23ff0000&millis=200
+ *   coap://host:5683/blink1/blink?rgb=%2300ff00&count=3
+ *   coap://host:5683/blink1/pattern/play  (POST with pattern as payload)
+ *
+ * do what their HTTP counterparts do and answer with the same JSON
+ * (Content-Format 50).  Uri-Path options make the path, Uri-Query
+ * options the query string and the payload the body.  GET, POST and PUT
+ * are all accepted.  /blink1/events and /metrics aren't served.
+ *
+ * Confirmable requests get their response piggybacked on the ACK once
+ * the device has been written (or right away with "-q ack"), and a
+ * retransmitted request is answered again from the last response
+ * instead of being done twice.  Non-confirmable requests get a
+ * non-confirmable response.  Busy devices answer 4.29, unknown paths 4.04.
+ *
+ * Each client address keeps a mongoose connection, so device replies
+ * can find it, until it's been idle for coap_idle_secs.
+ *
+ */
+
+#ifndef __COAP_H__
+#define __COAP_H__
+
+#include "mongoose.h"
+
+#define COAP_PEER          MG_F_USER_2   // connection flag
+#define REQUEST_WAITING    MG_F_USER_3   // connection flag, request on devices
+#define coap_idle_secs     30
+
+/**
+ * Listen for CoAP requests on UDP address, e.g. "5683".
+ * @param http_handler handler requests are passed to as MG_EV_HTTP_REQUEST
+ * @return 0 on success, -1 with errstr set on failure
+ */
+int coap_bind( struct mg_mgr* mgr, const char* address,
+               mg_event_handler_t http_handler, const char** errstr );
+
+/**
+ * Send a reply to a CoAP client's last request.  Use instead of
+ * writing an HTTP response when nc has the COAP_PEER flag.
+ * @param status HTTP status, mapped to the CoAP response code
+ */
+void coap_reply( struct mg_connection* nc, int status, const char* body, int len );
+
+#endif
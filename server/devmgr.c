@@ -0,0 +1,791 @@
+/*
+ * devmgr -- blink1-tiny-server's device manager
+ *
+ * see devmgr.h
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mongoose.h"  // for mg_time()
+#include "devmgr.h"
+#include "pool.h"
+
+struct devmgr_worker_ {
+    pthread_t thread;
+    pthread_mutex_t lock;   // guards everything below but 'dev'
+    pthread_cond_t cond;
+    devop_t queue[devmgr_queue_max];
+    int head;
+    int count;
+    devop_t latest[devmgr_leds_max];  // streamed updates, by ledn
+    uint32_t latest_dirty;  // bitmask of unwritten 'latest'
+    char serial[serialstrmax];
+    char path[pathstrmax];
+    int reopen;             // path changed under us
+    int stop;               // device is gone, exit when queue is drained
+    uint32_t errors;
+    int type;               // from blink1Type_t
+    int fwversion;          // 0 until read
+    devmgr_stats stats;
+    double rate;            // writes/sec
+    double tokens;          // writes allowed now
+    double refilled;        // mg_time() tokens were last topped up
+    blink1_device* dev;     // only touched by the worker thread
+    devop_t patt[devmgr_patt_max];  // pattern lines written to dev
+    uint32_t patt_known;    // bitmask of valid 'patt', cleared on reopen
+    uint8_t patt_ledn;      // ledn last set for pattern lines
+};
+
+static devmgr_dev devs[devmgr_max];
+static int devs_count = 0;
+
+static devmgr_dev devs_prev[devmgr_max]; // scratch for devmgr_update()
+
+static int rescan_millis = devmgr_rescan_default;
+static volatile int rescan_needed = 0;  // set on device error, by any thread
+static double last_scan = 0;   // mg_time() of last scan
+
+static devmgr_notify_func notify_func = NULL;
+static devmgr_change_func change_func = NULL;
+
+static metrics_hist scan_millis;   // time per enumerate
+static double rate_override = 0;
+
+// blink1-lib's device cache isn't thread-safe, so enumerating, 
+// opening & closing are done one at a time.  writes don't need it.
+static pthread_mutex_t lib_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// don't rescan more often than this, even when devices are erroring
+#define devmgr_rescan_min  250
+
+enum { SCAN_IDLE = 0, SCAN_REQUESTED, SCAN_DONE };
+static pthread_mutex_t scan_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  scan_cond = PTHREAD_COND_INITIALIZER;
+static int scan_state = SCAN_IDLE;        // guarded by scan_lock
+static devmgr_dev scan_found[devmgr_max]; // written by scanner thread
+static int scan_found_count = 0;
+static int scanner_running = 0;
+
+//
+static void devmgr_closeDev( devmgr_worker* w )
+{
+    if( w->dev == NULL ) return;
+    pthread_mutex_lock( &lib_lock );
+    blink1_close( w->dev );
+    pthread_mutex_unlock( &lib_lock );
+    w->dev = NULL;
+    w->patt_known = 0;  // may be a different device, or replugged, next time
+    w->patt_ledn = 0;
+}
+
+// open dev if it isn't, reading its firmware version the first time
+static int devmgr_openDev( devmgr_worker* w, const char* path )
+{
+    if( w->dev != NULL ) return 0;
+    pthread_mutex_lock( &lib_lock );
+    w->dev = blink1_openByPath( path );
+    pthread_mutex_unlock( &lib_lock );
+    if( w->dev == NULL ) return -1;
+    if( w->fwversion == 0 ) {
+        int v = blink1_getVersion( w->dev );
+        pthread_mutex_lock( &w->lock );
+        w->fwversion = (v > 0) ? v : 0;
+        pthread_mutex_unlock( &w->lock );
+    }
+    return 0;
+}
+
+// read each LED's color & the play state into res
+static int devmgr_readState( devmgr_worker* w, devop_result* res )
+{
+    devmgr_led* l = res->leds;
+    memset( res->leds, 0, sizeof(res->leds) );
+    res->playing = res->startpos = res->endpos = res->count = res->pos = 0;
+    if( w->type == BLINK1_MK1 ) {
+        return blink1_readRGB_mk1( w->dev, &l[0].millis, &l[0].r, &l[0].g, &l[0].b );
+    }
+    for( int n=1; n <= devmgr_leds_hw; n++ ) {
+        int rc = blink1_readRGB_mk2( w->dev, &l[n].millis, &l[n].r, &l[n].g, &l[n].b, n );
+        if( rc == -1 ) return -1;
+    }
+    l[0] = l[1];
+    return blink1_readPlayState( w->dev, &res->playing, &res->startpos,
+                                 &res->endpos, &res->count, &res->pos );
+}
+
+// does the device already have this pattern line?
+static int devmgr_pattHas( devmgr_worker* w, devop_t* op )
+{
+    int pos = op->startpos;
+    if( op->type != DEVOP_PATTLINE || pos >= devmgr_patt_max ) return 0;
+    if( !(w->patt_known & (1u << pos)) ) return 0;
+    devop_t* p = &w->patt[pos];
+    return ( p->r == op->r && p->g == op->g && p->b == op->b &&
+             p->millis == op->millis && p->ledn == op->ledn );
+}
+
+// write a pattern line, setting ledn first if it's not what was last used
+static int devmgr_writePattLine( devmgr_worker* w, devop_t* op )
+{
+    if( op->ledn != w->patt_ledn ) {
+        if( blink1_setLEDN( w->dev, op->ledn ) == -1 ) return -1;
+        w->patt_ledn = op->ledn;
+    }
+    int rc = blink1_writePatternLine( w->dev, op->millis, op->r, op->g, op->b, op->startpos );
+    if( rc != -1 && op->startpos < devmgr_patt_max ) {
+        w->patt[ op->startpos ] = *op;
+        w->patt_known |= (1u << op->startpos);
+    }
+    return rc;
+}
+
+// do an op, retrying once on a fresh handle if the current one has gone bad
+static int devmgr_doOp( devmgr_worker* w, const char* path, devop_t* op,
+                        devop_result* res )
+{
+    for( int tries=0; tries < 2; tries++ ) {
+        if( devmgr_openDev( w, path ) < 0 ) break;
+        int rc = -1;
+        switch( op->type ) {
+        case DEVOP_FADE:
+            if( op->ledn ) {
+                rc = blink1_fadeToRGBN( w->dev, op->millis, 
+                                        op->r, op->g, op->b, op->ledn );
+            } else {
+                rc = blink1_fadeToRGB( w->dev, op->millis, op->r, op->g, op->b );
+            }
+            break;
+        case DEVOP_PLAY:
+            rc = blink1_playloop( w->dev, op->play, op->startpos, op->endpos, op->count );
+            break;
+        case DEVOP_PATTLINE:
+            rc = devmgr_writePattLine( w, op );
+            break;
+        case DEVOP_PATTSAVE:
+            rc = blink1_savePattern( w->dev );
+            break;
+        case DEVOP_READPLAY:
+            rc = blink1_readPlayState( w->dev, &res->playing, &res->startpos,
+                                       &res->endpos, &res->count, &res->pos );
+            break;
+        case DEVOP_READSTATE:
+            rc = devmgr_readState( w, res );
+            break;
+        default:
+            return -1;
+        }
+        if( rc != -1 ) return 0;
+        devmgr_closeDev( w );
+    }
+    rescan_needed = 1;
+    return -1;
+}
+
+// take a token for a write, call with w->lock held
+// returns 0 if taken, else millis until one will be ready
+static int devmgr_takeToken( devmgr_worker* w )
+{
+    double now = mg_time();
+    w->tokens += (now - w->refilled) * w->rate;
+    w->refilled = now;
+    if( w->tokens > devmgr_burst ) w->tokens = devmgr_burst;
+    if( w->tokens >= 1 ) {
+        w->tokens -= 1;
+        return 0;
+    }
+    return 1 + (int)( (1 - w->tokens) * 1000 / w->rate );
+}
+
+// do w's next op if the device may be written now.  call with w->lock held.
+// returns 0 if an op was done, -1 if there's nothing to do,
+// else millis until the device may be written
+static int devmgr_workerStep( devmgr_worker* w )
+{
+    char path[pathstrmax];
+    devop_result res;
+
+    if( w->count == 0 && w->latest_dirty == 0 ) return -1;
+
+    // lines the device already has need no write, so no token
+    int skip = (w->count) ? devmgr_pattHas( w, &w->queue[ w->head ] ) : 0;
+
+    // wait for a token with the op still queued, so it can be merged
+    int wait = (skip) ? 0 : devmgr_takeToken( w );
+    if( wait ) return wait;
+
+    devop_t op;
+    if( w->count ) {
+        op = w->queue[ w->head ];
+        w->head = (w->head + 1) % devmgr_queue_max;
+        w->count--;
+    } else {  // lowest ledn first, so an "all LEDs" update goes before the rest
+        int n = __builtin_ctz( w->latest_dirty );
+        op = w->latest[n];
+        w->latest_dirty &= ~(1u << n);
+    }
+    int reopen = w->reopen;
+    w->reopen = 0;
+    strcpy( path, w->path );
+    strcpy( res.serial, w->serial );
+    pthread_mutex_unlock( &w->lock );
+
+    if( reopen ) devmgr_closeDev( w );
+    if( reopen && skip ) skip = devmgr_pattHas( w, &op );  // forgotten now
+    res.skipped = skip;
+    if( skip ) {
+        res.rc = 0;
+    } else {
+        double start = mg_time();
+        res.rc = devmgr_doOp( w, path, &op, &res );
+        metrics_observe( &w->stats.write_millis, (mg_time() - start) * 1000 );
+    }
+    res.reqid = op.reqid;
+    res.tag = op.tag;
+    res.merged = 0;
+    if( op.reqid && notify_func ) notify_func( &res );
+
+    pthread_mutex_lock( &w->lock );
+    if( res.rc ) w->errors++;
+    return 0;
+}
+
+//
+static void devmgr_workerFree( devmgr_worker* w )
+{
+    devmgr_closeDev( w );
+    pthread_mutex_destroy( &w->lock );
+    pthread_cond_destroy( &w->cond );
+    pool_free( w );
+}
+
+#ifndef DEVMGR_INLINE
+//
+static void* devmgr_workerMain( void* arg )
+{
+    devmgr_worker* w = (devmgr_worker*) arg;
+    char path[pathstrmax];
+
+    // open right away so the firmware version is known before it's asked for
+    pthread_mutex_lock( &w->lock );
+    strcpy( path, w->path );
+    pthread_mutex_unlock( &w->lock );
+    devmgr_openDev( w, path );
+
+    pthread_mutex_lock( &w->lock );
+    for( ;; ) {
+        while( w->count == 0 && w->latest_dirty == 0 && !w->stop ) {
+            pthread_cond_wait( &w->cond, &w->lock );
+        }
+        int wait = devmgr_workerStep( w );
+        if( wait < 0 ) break;  // stopped and drained
+        if( wait > 0 ) {
+            pthread_mutex_unlock( &w->lock );
+            blink1_sleep( wait );
+            pthread_mutex_lock( &w->lock );
+        }
+    }
+    pthread_mutex_unlock( &w->lock );
+    devmgr_workerFree( w );
+    return NULL;
+}
+#endif
+
+//
+static devmgr_worker* devmgr_workerStart( devmgr_dev* d )
+{
+    devmgr_worker* w = pool_calloc( 1, sizeof(devmgr_worker) );
+    if( w == NULL ) return NULL;
+    strcpy( w->serial, d->serial );
+    strcpy( w->path, d->path );
+    w->type = d->type;
+    w->rate = (rate_override > 0) ? rate_override :
+        (d->type == BLINK1_MK3) ? devmgr_rate_mk3 :
+        (d->type == BLINK1_MK2) ? devmgr_rate_mk2 : devmgr_rate_mk1;
+    w->tokens = devmgr_burst;
+    w->refilled = mg_time();
+    pthread_mutex_init( &w->lock, NULL );
+    pthread_cond_init( &w->cond, NULL );
+#ifdef DEVMGR_INLINE
+    devmgr_openDev( w, w->path );  // for the firmware version, as the thread would
+#else
+    if( pthread_create( &w->thread, NULL, devmgr_workerMain, w ) != 0 ) {
+        pthread_mutex_destroy( &w->lock );
+        pthread_cond_destroy( &w->cond );
+        pool_free( w );
+        return NULL;
+    }
+    pthread_detach( w->thread );
+#endif
+    return w;
+}
+
+// worker frees itself once it has drained its queue.
+// inline, the device is gone so what's queued fails now
+static void devmgr_workerStop( devmgr_worker* w )
+{
+    if( w == NULL ) return;
+#ifdef DEVMGR_INLINE
+    for( ; w->count; w->count-- ) {
+        devop_t* op = &w->queue[ w->head ];
+        w->head = (w->head + 1) % devmgr_queue_max;
+        if( op->reqid && notify_func ) {
+            devop_result res = { op->reqid, op->tag, -1 };
+            strcpy( res.serial, w->serial );
+            notify_func( &res );
+        }
+    }
+    devmgr_workerFree( w );
+#else
+    pthread_mutex_lock( &w->lock );
+    w->stop = 1;
+    pthread_cond_signal( &w->cond );
+    pthread_mutex_unlock( &w->lock );
+#endif
+}
+
+// list attached devices into 'found', returns count
+static int devmgr_enumerate( devmgr_dev* found )
+{
+    int count = 0;
+    double start = mg_time();
+    pthread_mutex_lock( &lib_lock );
+    int n = blink1_enumerate();
+    for( int i=0; i < n && count < devmgr_max; i++ ) {
+        devmgr_dev* d = &found[count++];
+        memset( d, 0, sizeof(devmgr_dev) );
+        strncpy( d->serial, blink1_getCachedSerial(i), sizeof(d->serial)-1 );
+        strncpy( d->path, blink1_getCachedPath(i), sizeof(d->path)-1 );
+        d->type = blink1_getCachedType(i);
+    }
+    pthread_mutex_unlock( &lib_lock );
+    metrics_observe( &scan_millis, (mg_time() - start) * 1000 );
+    return count;
+}
+
+// make device list match 'found', keeping workers of devices still there
+static void devmgr_update( devmgr_dev* found, int count )
+{
+    int prev_count = devs_count;
+    memcpy( devs_prev, devs, sizeof(devmgr_dev) * prev_count );
+    memcpy( devs, found, sizeof(devmgr_dev) * count );
+    devs_count = count;
+
+    for( int i=0; i < devs_count; i++ ) {
+        devmgr_dev* d = &devs[i];
+        for( int j=0; j < prev_count; j++ ) {
+            devmgr_dev* p = &devs_prev[j];
+            if( p->worker == NULL || strcmp( p->serial, d->serial ) != 0 ) continue;
+            d->worker = p->worker;  // same device, keep worker, handle & state
+            d->state = p->state;
+            p->worker = NULL;
+            if( strcmp( p->path, d->path ) != 0 ) {
+                pthread_mutex_lock( &d->worker->lock );
+                strcpy( d->worker->path, d->path );
+                d->worker->reopen = 1;
+                pthread_mutex_unlock( &d->worker->lock );
+            }
+            break;
+        }
+        if( d->worker == NULL ) {
+            if( last_scan != 0 ) {
+                printf("blink1-server: device %s added\n", d->serial);
+            }
+            d->worker = devmgr_workerStart( d );
+            if( change_func ) change_func( DEVMGR_ADDED, d, i, 0 );
+        }
+    }
+
+    // stop whatever didn't carry over
+    for( int j=0; j < prev_count; j++ ) {
+        if( devs_prev[j].worker == NULL ) continue;
+        printf("blink1-server: device %s removed\n", devs_prev[j].serial);
+        devmgr_workerStop( devs_prev[j].worker );
+        if( change_func ) change_func( DEVMGR_REMOVED, &devs_prev[j], -1, 0 );
+    }
+
+    rescan_needed = 0;
+    last_scan = mg_time();
+}
+
+// enumerating can take tens of millis, so rescans for hotplug are done
+// on this thread and the results picked up by devmgr_poll()
+static void* devmgr_scannerMain( void* arg )
+{
+    (void) arg;
+    pthread_mutex_lock( &scan_lock );
+    for( ;; ) {
+        while( scan_state != SCAN_REQUESTED ) {
+            pthread_cond_wait( &scan_cond, &scan_lock );
+        }
+        pthread_mutex_unlock( &scan_lock );
+        int n = devmgr_enumerate( scan_found );
+        pthread_mutex_lock( &scan_lock );
+        scan_found_count = n;
+        scan_state = SCAN_DONE;
+    }
+    return NULL;
+}
+
+//
+int devmgr_scan(void)
+{
+    static devmgr_dev found[devmgr_max];
+    devmgr_update( found, devmgr_enumerate( found ) );
+    return devs_count;
+}
+
+//
+void devmgr_poll(void)
+{
+    double since = (mg_time() - last_scan) * 1000;
+
+    if( !scanner_running ) {  // no thread, rescan right here
+        if( (rescan_needed && since >= devmgr_rescan_min) ||
+            (rescan_millis > 0 && since >= rescan_millis) ) {
+            devmgr_scan();
+        }
+        return;
+    }
+
+    pthread_mutex_lock( &scan_lock );
+    if( scan_state == SCAN_DONE ) {
+        devmgr_update( scan_found, scan_found_count );
+        scan_state = SCAN_IDLE;
+    }
+    else if( scan_state == SCAN_IDLE && 
+             ((rescan_needed && since >= devmgr_rescan_min) ||
+              (rescan_millis > 0 && since >= rescan_millis)) ) {
+        scan_state = SCAN_REQUESTED;
+        pthread_cond_signal( &scan_cond );
+    }
+    pthread_mutex_unlock( &scan_lock );
+}
+
+//
+int devmgr_init( int rescanMillis, devmgr_notify_func notify )
+{
+    rescan_millis = rescanMillis;
+    notify_func = notify;
+#ifndef DEVMGR_INLINE
+    pthread_t thread;
+    if( pthread_create( &thread, NULL, devmgr_scannerMain, NULL ) == 0 ) {
+        pthread_detach( thread );
+        scanner_running = 1;
+    }
+#endif
+    return devmgr_scan();
+}
+
+//
+int devmgr_work(void)
+{
+    int next = -1;
+#ifdef DEVMGR_INLINE
+    for( int i=0; i < devs_count; i++ ) {
+        devmgr_worker* w = devs[i].worker;
+        if( w == NULL ) continue;
+        int wait = 0;
+        pthread_mutex_lock( &w->lock );
+        // a few at a time, so one busy device doesn't hold up the rest
+        for( int n=0; n < devmgr_burst && wait == 0; n++ ) {
+            wait = devmgr_workerStep( w );
+        }
+        if( wait == 0 && w->count == 0 && w->latest_dirty == 0 ) wait = -1;
+        pthread_mutex_unlock( &w->lock );
+        if( wait >= 0 && (next < 0 || wait < next) ) next = wait;
+    }
+#endif
+    return next;
+}
+
+//
+void devmgr_setRate( double reportsPerSec )
+{
+    rate_override = reportsPerSec;
+}
+
+//
+void devmgr_onChange( devmgr_change_func change )
+{
+    change_func = change;
+}
+
+// update device i's state shadow for op, returns -1 if ledn out of range
+static int devmgr_shadow( int i, devop_t* op )
+{
+    devmgr_state* st = &devs[i].state;
+    if( op->type == DEVOP_FADE ) {
+        devmgr_led led = { op->r, op->g, op->b, op->millis };
+        int n = op->ledn;
+        if( n >= devmgr_leds_max ) return -1;
+        if( n == 0 ) {
+            for( int l=0; l < devmgr_leds_max; l++ ) st->leds[l] = led;
+        } else {
+            st->leds[n] = led;
+            if( n > st->ledn_max ) st->ledn_max = n;
+        }
+        if( change_func ) change_func( DEVMGR_COLOR, &devs[i], i, n );
+    }
+    else if( op->type == DEVOP_PLAY ) {
+        st->playing = op->play;
+        st->startpos = op->startpos;
+        st->endpos = op->endpos;
+        st->count = op->count;
+        if( change_func ) change_func( DEVMGR_PLAY, &devs[i], i, 0 );
+    }
+    return 0;
+}
+
+//
+int devmgr_count(void)
+{
+    return devs_count;
+}
+
+//
+int devmgr_indexById( uint32_t id )
+{
+    if( id > devmgr_max ) { // then id is a serial number not an array index
+        char serialstr[serialstrmax];
+        snprintf(serialstr, sizeof(serialstr), "%X", id);
+        for( int i=0; i < devs_count; i++ ) {
+            if( strcmp( devs[i].serial, serialstr ) == 0 ) return i;
+        }
+        return -1;
+    }
+    return ( (int)id < devs_count ) ? (int)id : -1;
+}
+
+//
+int devmgr_parseIds( char* idstr, devmgr_set* set )
+{
+    int n = 0;
+    if( strcmp(idstr, "all") == 0 ) {
+        for( n=0; n < devs_count; n++ ) devmgr_set_add( set, n );
+        return n;
+    }
+    int ntok = 0;
+    for( char* pch = strtok(idstr, " ,"); pch != NULL; pch = strtok(NULL, " ,") ) {
+        int base = (strlen(pch)==8) ? 16:0;  // serials are 8 hex digits
+        char* end;
+        unsigned long id = strtoul(pch, &end, base);
+        if( *end != '\0' ) return -1;  // not a number, e.g. "foo"
+        int i = devmgr_indexById( id );
+        if( i < 0 ) return -1;
+        if( !devmgr_set_has( set, i ) ) n++;
+        devmgr_set_add( set, i );
+        ntok++;
+    }
+    return (ntok > 0) ? n : -1;  // "" names no device
+}
+
+//
+int devmgr_version( int i )
+{
+    devmgr_dev* d = devmgr_get(i);
+    if( d == NULL || d->worker == NULL ) return 0;
+    pthread_mutex_lock( &d->worker->lock );
+    int v = d->worker->fwversion;
+    pthread_mutex_unlock( &d->worker->lock );
+    return v;
+}
+
+//
+const char* devmgr_typestr( int type )
+{
+    switch( type ) {
+    case BLINK1_MK1: return "mk1";
+    case BLINK1_MK2: return "mk2";
+    case BLINK1_MK3: return "mk3";
+    default:         return "unknown";
+    }
+}
+
+// same color?  millis read back are rounded, so aren't compared
+static int devmgr_ledEq( devmgr_led* a, devmgr_led* b )
+{
+    return ( a->r == b->r && a->g == b->g && a->b == b->b );
+}
+
+//
+void devmgr_refresh( devop_result* res )
+{
+    int i;
+    if( res->rc != 0 ) return;
+    for( i=0; i < devs_count; i++ ) {
+        if( strcmp( devs[i].serial, res->serial ) == 0 ) break;
+    }
+    if( i == devs_count ) return;  // gone since
+    devmgr_dev* d = &devs[i];
+    devmgr_state* st = &d->state;
+
+    if( d->type == BLINK1_MK1 ) {
+        if( !devmgr_ledEq( &st->leds[0], &res->leds[0] ) ) {
+            for( int l=0; l < devmgr_leds_max; l++ ) st->leds[l] = res->leds[0];
+            if( change_func ) change_func( DEVMGR_COLOR, d, i, 0 );
+        }
+        return;
+    }
+    st->leds[0] = res->leds[0];
+    for( int n=1; n <= devmgr_leds_hw; n++ ) {
+        if( devmgr_ledEq( &st->leds[n], &res->leds[n] ) ) continue;
+        st->leds[n] = res->leds[n];
+        if( n > st->ledn_max ) st->ledn_max = n;
+        if( change_func ) change_func( DEVMGR_COLOR, d, i, n );
+    }
+    if( st->playing != res->playing || st->startpos != res->startpos ||
+        st->endpos != res->endpos || st->count != res->count ) {
+        st->playing = res->playing;
+        st->startpos = res->startpos;
+        st->endpos = res->endpos;
+        st->count = res->count;
+        if( change_func ) change_func( DEVMGR_PLAY, d, i, 0 );
+    }
+}
+
+//
+devmgr_dev* devmgr_get( int i )
+{
+    if( i < 0 || i >= devs_count ) return NULL;
+    return &devs[i];
+}
+
+//
+int devmgr_submit( int i, devop_t* op )
+{
+    devmgr_dev* d = devmgr_get(i);
+    if( d == NULL || d->worker == NULL ) return -1;
+    if( op->type == DEVOP_FADE && op->ledn >= devmgr_leds_max ) return -1;
+    devmgr_worker* w = d->worker;
+
+    devop_t merged = { DEVOP_NONE };
+    pthread_mutex_lock( &w->lock );
+    devop_t* tail = (w->count) ? &w->queue[ (w->head + w->count - 1) % devmgr_queue_max ] : NULL;
+    if( tail && op->type == DEVOP_FADE && tail->type == DEVOP_FADE && 
+        tail->ledn == op->ledn ) {
+        merged = *tail;  // not written yet, only the newer color matters
+        *tail = *op;
+    }
+    else if( w->count >= devmgr_queue_max ) {
+        pthread_mutex_unlock( &w->lock );
+        metrics_add( &w->stats.dropped, 1 );
+        return -2;
+    }
+    else {
+        w->queue[ (w->head + w->count) % devmgr_queue_max ] = *op;
+        w->count++;
+        pthread_cond_signal( &w->cond );
+    }
+    pthread_mutex_unlock( &w->lock );
+
+    if( merged.type != DEVOP_NONE ) {
+        metrics_add( &w->stats.merged, 1 );
+        if( merged.reqid && notify_func ) {
+            devop_result res = { merged.reqid, merged.tag, 0, 1 };
+            strcpy( res.serial, d->serial );
+            notify_func( &res );
+        }
+    }
+    devmgr_shadow( i, op );
+    return 0;
+}
+
+//
+int devmgr_stream( int i, devop_t* op )
+{
+    devmgr_dev* d = devmgr_get(i);
+    if( d == NULL || d->worker == NULL ) return -1;
+    if( op->ledn >= devmgr_leds_max ) return -1;
+    devmgr_worker* w = d->worker;
+    int n = op->ledn;
+
+    pthread_mutex_lock( &w->lock );
+    uint32_t replaced = (n == 0) ? w->latest_dirty : (w->latest_dirty & (1u << n));
+    if( n == 0 ) w->latest_dirty = 0;  // all LEDs overrides single ones
+    w->latest[n] = *op;
+    w->latest[n].reqid = 0;
+    w->latest_dirty |= (1u << n);
+    pthread_cond_signal( &w->cond );
+    pthread_mutex_unlock( &w->lock );
+    devmgr_shadow( i, op );
+    if( replaced ) metrics_add( &w->stats.coalesced, __builtin_popcount(replaced) );
+    return (replaced) ? 1 : 0;
+}
+
+//
+int devmgr_streamBacklog( int i )
+{
+    devmgr_dev* d = devmgr_get(i);
+    if( d == NULL || d->worker == NULL ) return 0;
+    pthread_mutex_lock( &d->worker->lock );
+    int n = __builtin_popcount( d->worker->latest_dirty );
+    pthread_mutex_unlock( &d->worker->lock );
+    return n;
+}
+
+//
+int devmgr_admit( int i )
+{
+    devmgr_dev* d = devmgr_get(i);
+    if( d == NULL || d->worker == NULL ) return -1;
+    devmgr_worker* w = d->worker;
+    pthread_mutex_lock( &w->lock );
+    double tokens = w->tokens + (mg_time() - w->refilled) * w->rate;
+    if( tokens > devmgr_burst ) tokens = devmgr_burst;
+    double ahead = w->count + __builtin_popcount( w->latest_dirty ) + 1;
+    double wait = (ahead - tokens) * 1000 / w->rate;
+    pthread_mutex_unlock( &w->lock );
+    if( wait <= devmgr_wait_max ) return 0;
+    metrics_add( &w->stats.rejected, 1 );
+    return -1;
+}
+
+//
+int devmgr_queueDepth( int i )
+{
+    devmgr_dev* d = devmgr_get(i);
+    if( d == NULL || d->worker == NULL ) return 0;
+    pthread_mutex_lock( &d->worker->lock );
+    int n = d->worker->count;
+    pthread_mutex_unlock( &d->worker->lock );
+    return n;
+}
+
+//
+uint32_t devmgr_errors( int i )
+{
+    devmgr_dev* d = devmgr_get(i);
+    if( d == NULL || d->worker == NULL ) return 0;
+    pthread_mutex_lock( &d->worker->lock );
+    uint32_t n = d->worker->errors;
+    pthread_mutex_unlock( &d->worker->lock );
+    return n;
+}
+
+//
+devmgr_stats* devmgr_getStats( int i )
+{
+    devmgr_dev* d = devmgr_get(i);
+    if( d == NULL || d->worker == NULL ) return NULL;
+    return &d->worker->stats;
+}
+
+//
+metrics_hist* devmgr_scanStats(void)
+{
+    return &scan_millis;
+}
+
+//
+void devmgr_close(void)
+{
+    for( int i=0; i < devs_count; i++ ) {
+        devmgr_workerStop( devs[i].worker );
+        devs[i].worker = NULL;
+    }
+    devs_count = 0;
+}
@@ -0,0 +1,289 @@
+/*
+ * devmgr -- blink1-tiny-server's device manager
+ *
+ * Keeps a handle open to every attached blink(1) so a request costs
+ * one feature report instead of an enumerate + open + close.
+ * Each device has its own worker thread fed by a bounded queue, so a
+ * slow or wedged device only holds up requests for that device.
+ * Handles that error out are closed and reopened on next use, and the
+ * device list is rescanned periodically to notice hotplug.
+ * Streamed color updates skip the queue: each device keeps only the
+ * latest unwritten update per LED, so a fast sender can't outrun it.
+ * Writes are paced by a token bucket at the rate the device type can
+ * sustain, and a queued color that's superseded before it's written is
+ * replaced rather than written.
+ * Each worker remembers the pattern lines it has written, so uploading
+ * a pattern the device already has costs no USB writes.
+ * What each device was last told to do is shadowed here, so state can
+ * be reported without asking the device.  Firmware versions are read
+ * once, when a device's worker first opens it.
+ * In the tiny build (BLINK1_SERVER_TINY) there are no threads: workers
+ * are run from the main loop by devmgr_work() and rescans are inline.
+ *
+ */
+
+#ifndef __DEVMGR_H__
+#define __DEVMGR_H__
+
+#include "blink1-lib.h"
+#include "metrics.h"
+
+// devices managed at once, build with -DBLINK1_SERVER_DEVMGR_MAX=n for fewer
+#ifdef BLINK1_SERVER_DEVMGR_MAX
+#define devmgr_max              BLINK1_SERVER_DEVMGR_MAX
+#else
+#define devmgr_max              blink1_max_devices
+#endif
+#if devmgr_max % 8 != 0 || devmgr_max <= 0
+#error "devmgr_max must be a positive multiple of 8, for devmgr_set"
+#endif
+#define devmgr_rescan_default   2000  // millis between hotplug rescans
+#define devmgr_queue_max        64    // ops waiting per device, room for a whole pattern
+#define devmgr_leds_max         19    // ledn 0 (all) to 18, for streaming
+#define devmgr_patt_max         32    // pattern lines on mk2 & mk3, mk1 has 12
+#define devmgr_leds_hw          2     // LEDs on mk2 & mk3, mk1 has 1
+
+// writes/sec each type keeps up with; conservative, override with devmgr_setRate()
+#define devmgr_rate_mk1         50    // V-USB low-speed, slow firmware
+#define devmgr_rate_mk2         100   // V-USB low-speed
+#define devmgr_rate_mk3         200   // hardware USB
+#define devmgr_burst            8     // writes allowed back-to-back after idle
+#define devmgr_wait_max         250   // millis, see devmgr_admit()
+
+#ifdef BLINK1_SERVER_TINY
+#define DEVMGR_INLINE  // workers run on the caller's thread
+#endif
+
+typedef struct devmgr_worker_ devmgr_worker;
+
+typedef struct devmgr_led_ {
+    uint8_t r, g, b;
+    uint16_t millis;        // of last fade
+} devmgr_led;
+
+// last commanded state of a device
+typedef struct devmgr_state_ {
+    devmgr_led leds[devmgr_leds_max]; // by ledn, [0] is last "all LEDs" color
+    uint8_t ledn_max;       // highest ledn ever set
+    uint8_t playing;
+    uint8_t startpos, endpos, count;
+} devmgr_state;
+
+typedef struct devmgr_dev_ {
+    char serial[serialstrmax];
+    char path[pathstrmax];
+    int type;               // from blink1Type_t
+    devmgr_worker* worker;  // thread doing this device's USB I/O
+    devmgr_state state;     // shadow of what it was last told
+} devmgr_dev;
+
+// per-device counters, updated without locks, see metrics.h
+typedef struct devmgr_stats_ {
+    metrics_hist write_millis;  // time per USB write
+    uint32_t coalesced;         // streamed colors replaced before being written
+    uint32_t dropped;           // ops refused because the queue was full
+    uint32_t merged;            // queued colors superseded before being written
+    uint32_t rejected;          // ops turned away by devmgr_admit()
+} devmgr_stats;
+
+typedef enum {
+    DEVMGR_ADDED = 0,
+    DEVMGR_REMOVED,
+    DEVMGR_COLOR,
+    DEVMGR_PLAY
+} devmgr_change_t;
+
+// a set of devices, by index
+typedef struct devmgr_set_ {
+    uint8_t bits[devmgr_max/8];
+} devmgr_set;
+
+#define devmgr_set_add(s,i)  ((s)->bits[(i)/8] |= (1 << ((i)%8)))
+#define devmgr_set_has(s,i)  ((s)->bits[(i)/8] &  (1 << ((i)%8)))
+
+typedef enum {
+    DEVOP_NONE = 0,
+    DEVOP_FADE,        // fade to r,g,b over millis on ledn
+    DEVOP_PLAY,        // play (or stop) pattern from startpos to endpos
+    DEVOP_PATTLINE,    // write r,g,b,millis,ledn as pattern line startpos
+    DEVOP_PATTSAVE,    // save pattern to flash (mk2+)
+    DEVOP_READPLAY,    // read play state into the result (mk2+)
+    DEVOP_READSTATE    // read LED colors & play state into the result
+} devopType_t;
+
+typedef struct devop_ {
+    devopType_t type;
+    uint16_t millis;
+    uint8_t r, g, b;
+    uint8_t ledn;           // 0 = all LEDs
+    unsigned long reqid;    // passed to notify func when done, 0 = don't
+    int tag;                // passed to notify func, for caller's use
+    uint8_t play;           // DEVOP_PLAY: 1 = play, 0 = stop
+    uint8_t startpos;
+    uint8_t endpos;
+    uint8_t count;          // times to loop, 0 = forever
+} devop_t;
+
+typedef struct devop_result_ {
+    unsigned long reqid;
+    int tag;
+    int rc;                 // 0 on success, -1 on device error
+    int merged;             // 1 if superseded by a later color, not written
+    char serial[serialstrmax];
+    int skipped;            // DEVOP_PATTLINE: 1 if device already had the line
+    uint8_t playing;        // DEVOP_READPLAY & _READSTATE: play state read from device
+    uint8_t startpos, endpos, count, pos;
+    devmgr_led leds[devmgr_leds_hw+1]; // DEVOP_READSTATE: colors by ledn
+} devop_result;
+
+/**
+ * Called from a worker thread when an op with a reqid has been done.
+ */
+typedef void (*devmgr_notify_func)( devop_result* res );
+
+/**
+ * Called on the main loop when a device is commanded, added or removed.
+ * @param i index of device, or -1 if removed
+ * @param ledn LED changed, for DEVMGR_COLOR
+ */
+typedef void (*devmgr_change_func)( devmgr_change_t change, devmgr_dev* d,
+                                    int i, uint8_t ledn );
+
+/**
+ * Start the device manager and do a first scan.
+ * @param rescanMillis how often to rescan for hotplug, 0 = never
+ * @param notify function called when ops finish, may be NULL
+ * @return number of devices found
+ */
+int devmgr_init( int rescanMillis, devmgr_notify_func notify );
+
+/**
+ * Set writes/sec for all devices, 0 = by device type. Call before devmgr_init().
+ */
+void devmgr_setRate( double reportsPerSec );
+
+/**
+ * Set function called on state changes, NULL for none.
+ */
+void devmgr_onChange( devmgr_change_func change );
+
+/**
+ * Re-enumerate devices now. Devices still at the same path keep their
+ * worker & open handle, workers of removed devices are stopped.
+ * @return number of devices found
+ */
+int devmgr_scan(void);
+
+/**
+ * Rescan if the rescan interval has passed or a device errored.
+ * The enumeration itself runs on a background thread, its result is
+ * applied on a later call.  Call this from the main loop.
+ */
+void devmgr_poll(void);
+
+/**
+ * Without worker threads, do the device writes that are due.
+ * Call this from the main loop.
+ * @return millis until more writes are due, -1 if none are queued
+ *         (always -1 when workers have threads)
+ */
+int devmgr_work(void);
+
+/**
+ * @return number of known devices
+ */
+int devmgr_count(void);
+
+/**
+ * @param id device index (0-devmgr_max) or serial number as uint32
+ * @return index into device list, or -1 if no such device
+ */
+int devmgr_indexById( uint32_t id );
+
+/**
+ * Parse "all" or a comma-separated list of device indexes and/or 
+ * 8-digit serial numbers.  Note: idstr is modified.
+ * @param set devices found are added to this
+ * @return number of devices, or -1 if an id isn't known, isn't a
+ *         number or serial, or there are no ids at all
+ */
+int devmgr_parseIds( char* idstr, devmgr_set* set );
+
+/**
+ * @return device info at index i, or NULL
+ */
+devmgr_dev* devmgr_get( int i );
+
+/**
+ * @return firmware version of device i (e.g. 205), 0 if not known yet
+ */
+int devmgr_version( int i );
+
+/**
+ * @return "mk1", "mk2", "mk3" or "unknown"
+ */
+const char* devmgr_typestr( int type );
+
+/**
+ * Update a device's state shadow from a DEVOP_READSTATE result,
+ * telling the change func about anything that differed.
+ * Call from the main loop.
+ */
+void devmgr_refresh( devop_result* res );
+
+/**
+ * Queue an op for device i's worker.
+ * A fade for the same LED as the op at the end of the queue replaces it;
+ * the replaced op is notified as done with 'merged' set.
+ * This, devmgr_stream() & the scans are to be called from the main loop.
+ * @return 0 if queued, -1 if no such device or ledn, -2 if device's queue is full
+ */
+int devmgr_submit( int i, devop_t* op );
+
+/**
+ * Set the color device i's worker should write next for op's LED,
+ * replacing any update for that LED it hasn't gotten to yet.
+ * Only DEVOP_FADE ops, reqid is ignored. Queued ops go first.
+ * @return 0 if new, 1 if it replaced an unwritten update, 
+ *         -1 if no such device or ledn
+ */
+int devmgr_stream( int i, devop_t* op );
+
+/**
+ * @return number of LEDs on device i with an unwritten streamed update
+ */
+int devmgr_streamBacklog( int i );
+
+/**
+ * Check if an op submitted now to device i would be written within
+ * devmgr_wait_max millis. Counts a rejection if not.
+ * @return 0 if so, -1 if device is too far behind (or gone)
+ */
+int devmgr_admit( int i );
+
+/**
+ * @return number of ops waiting for device i
+ */
+int devmgr_queueDepth( int i );
+
+/**
+ * @return number of failed opens & writes on device i
+ */
+uint32_t devmgr_errors( int i );
+
+/**
+ * @return counters for device i, or NULL
+ */
+devmgr_stats* devmgr_getStats( int i );
+
+/**
+ * @return histogram of time taken per device scan
+ */
+metrics_hist* devmgr_scanStats(void);
+
+/**
+ * Stop all workers and close all devices.
+ */
+void devmgr_close(void);
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ * events -- Server-Sent Events stream of blink(1) state changes
+ *
+ * see events.h
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mongoose.h"
+#include "devmgr.h"
+#include "events.h"
+
+#define EVENTS_SUBSCRIBER  MG_F_USER_1   // connection flag
+
+static struct mg_mgr* events_mgr = NULL;
+static int subscribers = 0;
+static unsigned long last_event_id = 0;
+static double last_send = 0;  // mg_time() of last event or keepalive
+
+//
+void events_init( struct mg_mgr* mgr )
+{
+    events_mgr = mgr;
+}
+
+// format a device's JSON description for change into str
+static int events_format( char* str, int len, devmgr_change_t change,
+                          devmgr_dev* d, int i, uint8_t ledn )
+{
+    devmgr_state* st = &d->state;
+    int n = snprintf(str, len, "{\"id\":%d, \"serial\":\"%s\"", i, d->serial);
+    if( change == DEVMGR_COLOR ) {
+        devmgr_led* l = &st->leds[ledn];
+        n += snprintf(str+n, len-n, ", \"ledn\":%d, \"rgb\":\"#%2.2x%2.2x%2.2x\", \"millis\":%d",
+                      ledn, l->r, l->g, l->b, l->millis);
+    }
+    else if( change == DEVMGR_PLAY ) {
+        n += snprintf(str+n, len-n, ", \"playing\":%d, \"start\":%d, \"end\":%d, \"count\":%d",
+                      st->playing, st->startpos, st->endpos, st->count);
+    }
+    n += snprintf(str+n, len-n, "}");
+    return n;
+}
+
+// queue the same bytes to every subscriber, dropping ones that fell behind
+static void events_send( const char* buf, int len )
+{
+    for( struct mg_connection* c = mg_next(events_mgr, NULL); c != NULL;
+         c = mg_next(events_mgr, c) ) {
+        if( !(c->flags & EVENTS_SUBSCRIBER) ) continue;
+        if( c->send_mbuf.len > events_sendbuf_max ) {
+            c->flags &= ~EVENTS_SUBSCRIBER;
+            c->flags |= MG_F_CLOSE_IMMEDIATELY;
+            subscribers--;
+            continue;
+        }
+        mg_send( c, buf, len );
+    }
+    last_send = mg_time();
+}
+
+// format an event once
+static int events_message( char* buf, int len, const char* type, const char* data )
+{
+    return snprintf(buf, len, "id: %lu\nevent: %s\ndata: %s\n\n",
+                    ++last_event_id, type, data);
+}
+
+//
+static const char* events_typestr( devmgr_change_t change )
+{
+    switch( change ) {
+    case DEVMGR_ADDED:   return "added";
+    case DEVMGR_REMOVED: return "removed";
+    case DEVMGR_COLOR:   return "color";
+    case DEVMGR_PLAY:    return "play";
+    default:             return "state";
+    }
+}
+
+//
+void events_deviceChanged( devmgr_change_t change, devmgr_dev* d,
+                           int i, uint8_t ledn )
+{
+    char data[300];
+    char buf[400];
+    if( subscribers == 0 || events_mgr == NULL ) return;
+    events_format( data, sizeof(data), change, d, i, ledn );
+    int len = events_message( buf, sizeof(buf), events_typestr(change), data );
+    events_send( buf, len );
+}
+
+//
+int events_formatState( char* str, int len, devmgr_dev* d, int i )
+{
+    devmgr_state* st = &d->state;
+    int nleds = (d->type == BLINK1_MK1) ? 0 : devmgr_leds_hw;
+    if( st->ledn_max > nleds ) nleds = st->ledn_max;
+    int n = snprintf(str, len,
+                     "{\"id\":%d, \"serial\":\"%s\", \"type\":\"%s\", \"version\":%d, "
+                     "\"rgb\":\"#%2.2x%2.2x%2.2x\", \"leds\":[",
+                     i, d->serial, devmgr_typestr(d->type), devmgr_version(i),
+                     st->leds[0].r, st->leds[0].g, st->leds[0].b);
+    for( int l=1; l <= nleds && n < len; l++ ) {
+        n += snprintf(str+n, len-n, "%s\"#%2.2x%2.2x%2.2x\"", (l>1) ? "," : "",
+                      st->leds[l].r, st->leds[l].g, st->leds[l].b);
+    }
+    if( n < len ) {
+        n += snprintf(str+n, len-n, "], \"playing\":%d, \"start\":%d, \"end\":%d, \"count\":%d}",
+                      st->playing, st->startpos, st->endpos, st->count);
+    }
+    return (n < len) ? n : len-1;
+}
+
+//
+void events_subscribe( struct mg_connection* nc )
+{
+    char data[600];
+    char buf[700];
+    mg_printf(nc, "%s", "HTTP/1.1 200 OK\r\n"
+              "Content-Type: text/event-stream\r\n"
+              "Cache-Control: no-cache\r\n"
+              "Access-Control-Allow-Origin: *\r\n\r\n");
+    // current state, no event id since it's just for this subscriber
+    for( int i=0; i < devmgr_count(); i++ ) {
+        events_formatState( data, sizeof(data), devmgr_get(i), i );
+        int len = snprintf(buf, sizeof(buf), "event: state\ndata: %s\n\n", data);
+        mg_send( nc, buf, len );
+    }
+    nc->flags |= EVENTS_SUBSCRIBER;
+    subscribers++;
+}
+
+//
+void events_closed( struct mg_connection* nc )
+{
+    if( !(nc->flags & EVENTS_SUBSCRIBER) ) return;
+    nc->flags &= ~EVENTS_SUBSCRIBER;
+    subscribers--;
+}
+
+//
+void events_poll(void)
+{
+    if( subscribers == 0 ) return;
+    if( (mg_time() - last_send) * 1000 >= events_keepalive_millis ) {
+        events_send( ": keepalive\n\n", 13 );
+    }
+}
+
+//
+int events_subscribers(void)
+{
+    return subscribers;
+}
@@ -0,0 +1,72 @@
+/*
+ * events -- Server-Sent Events stream of blink(1) state changes
+ *
+ * GET /blink1/events starts a text/event-stream.  Subscribers first get
+ * a "state" event per device, then an event every time a device is
+ * commanded or plugged/unplugged:
+ *
+ *   event: state
+ *   data: {"id":0, "serial":"2000ABCD", "type":"mk2", "version":205, "rgb":"#ff0000",
+ *          "leds":["#ff0000","#0000ff"], "playing":0, "start":0, "end":0, "count":0}
+ *
+ *   event: color
+ *   data: {"id":0, "serial":"2000ABCD", "ledn":1, "rgb":"#ff0000", "millis":100}
+ *
+ *   event: play     data: {"id":0, "serial":..., "playing":1, "start":0, "end":3, "count":2}
+ *   event: added    data: {"id":1, "serial":...}
+ *   event: removed  data: {"id":-1, "serial":...}
+ *
+ * Events come from devmgr's state shadow, so no USB reads are done.
+ * Each event is formatted once and the same bytes queued to every
+ * subscriber.  Subscribers that stop reading are dropped.
+ *
+ */
+
+#ifndef __EVENTS_H__
+#define __EVENTS_H__
+
+#include "mongoose.h"
+#include "devmgr.h"
+
+#define events_keepalive_millis  15000     // comment line sent when idle
+#define events_sendbuf_max       (256*1024) // drop subscriber past this backlog
+
+/**
+ * @param mgr mongoose manager whose connections may subscribe
+ */
+void events_init( struct mg_mgr* mgr );
+
+/**
+ * Make nc a subscriber: send stream headers and current state.
+ */
+void events_subscribe( struct mg_connection* nc );
+
+/**
+ * Write a device's state, as in the "state" event, to str.
+ * Also used for /blink1 status.
+ * @return chars written
+ */
+int events_formatState( char* str, int len, devmgr_dev* d, int i );
+
+/**
+ * Forget nc if it's a subscriber, call on MG_EV_CLOSE.
+ */
+void events_closed( struct mg_connection* nc );
+
+/**
+ * devmgr_change_func that publishes the change to subscribers.
+ */
+void events_deviceChanged( devmgr_change_t change, devmgr_dev* d,
+                           int i, uint8_t ledn );
+
+/**
+ * Send keepalives if idle.  Call from the main loop.
+ */
+void events_poll(void);
+
+/**
+ * @return number of subscribers
+ */
+int events_subscribers(void);
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * jobs -- timed light effects for blink1-tiny-server
+ *
+ * see jobs.h
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mongoose.h"  // for mg_time()
+#include "devmgr.h"
+#include "jobs.h"
+
+static job_t jobs[jobs_max];
+static int last_id = 0;
+
+//
+// find a free job slot and fill in the basics
+static job_t* jobs_new( jobType_t type, devmgr_set* devs )
+{
+    for( int i=0; i < jobs_max; i++ ) {
+        job_t* j = &jobs[i];
+        if( j->id != 0 ) continue;
+        memset( j, 0, sizeof(job_t) );
+        j->id = ++last_id;
+        j->type = type;
+        j->devs = *devs;
+        j->due = mg_time();
+        return j;
+    }
+    return NULL;
+}
+
+//
+int jobs_add( jobType_t type, devmgr_set* devs, uint8_t ledn,
+              uint16_t millis, int count, uint8_t r, uint8_t g, uint8_t b )
+{
+    job_t* j = jobs_new( type, devs );
+    if( j == NULL ) return -1;
+    j->ledn = ledn;
+        j->millis = millis;
+        j->count = count;
+    j->r = r; j->g = g; j->b = b;
+    return j->id;
+}
+
+//
+int jobs_schedule( devop_t* op, devmgr_set* devs, int delayMillis )
+{
+    job_t* j = jobs_new( JOB_ONESHOT, devs );
+    if( j == NULL ) return -1;
+    j->op = *op;
+    j->op.reqid = 0;  // nobody waiting on it
+    j->ledn = op->ledn;
+    j->millis = op->millis;
+    j->r = op->r; j->g = op->g; j->b = op->b;
+    j->count = 1;
+    j->due += delayMillis / 1000.0;
+    return j->id;
+}
+
+//
+int jobs_cancel( int id )
+{
+    for( int i=0; i < jobs_max; i++ ) {
+        if( id > 0 && jobs[i].id == id ) {
+            jobs[i].id = 0;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// queue op on each of job's devices
+static void jobs_submit( job_t* j, devop_t* op )
+{
+    for( int i=0; i < devmgr_max; i++ ) {
+        if( devmgr_set_has( &j->devs, i ) ) devmgr_submit( i, op );
+    }
+}
+
+// queue a fade on each of job's devices, no reply wanted
+static void jobs_fade( job_t* j, uint16_t millis, uint8_t r, uint8_t g, uint8_t b )
+{
+    devop_t op = { DEVOP_FADE, millis, r, g, b, j->ledn, 0 };
+    jobs_submit( j, &op );
+}
+
+// do one step of a job, returns 1 if job is finished
+static int jobs_step( job_t* j )
+{
+    uint16_t fade = j->millis / 2;
+    int done = 0;
+    switch( j->type ) {
+    case JOB_BLINK:    // even steps on, odd steps off
+        if( j->step % 2 == 0 ) {
+            jobs_fade( j, fade, j->r, j->g, j->b );
+        } else {
+            jobs_fade( j, fade, 0,0,0 );
+        }
+        done = ( ++j->step >= j->count * 2 );
+        break;
+    case JOB_RANDOM:
+        jobs_fade( j, fade, rand() % 255, rand() % 255, rand() % 255 );
+        done = ( ++j->step >= j->count );
+        break;
+    case JOB_ONESHOT:
+        jobs_submit( j, &j->op );
+        j->step++;
+        done = 1;
+        break;
+    default:
+        done = 1;
+    }
+    j->due += fade / 1000.0;
+    return done;
+}
+
+//
+int jobs_run(void)
+{
+    double now = mg_time();
+    double next = -1;
+    for( int i=0; i < jobs_max; i++ ) {
+        job_t* j = &jobs[i];
+        if( j->id == 0 ) continue;
+        if( j->due <= now ) {
+            if( jobs_step( j ) ) {
+                j->id = 0;
+                continue;
+            }
+            if( j->due < now ) j->due = now; // fell behind, don't burst
+        }
+        if( next < 0 || j->due < next ) next = j->due;
+    }
+    if( next < 0 ) return -1;
+    return (int)( (next - now) * 1000 );
+}
+
+//
+int jobs_devCount( job_t* j )
+{
+    int n = 0;
+    for( int i=0; i < devmgr_max; i++ ) {
+        if( devmgr_set_has( &j->devs, i ) ) n++;
+    }
+    return n;
+}
+
+//
+job_t* jobs_get( int i )
+{
+    if( i < 0 || i >= jobs_max || jobs[i].id == 0 ) return NULL;
+    return &jobs[i];
+}
+
+//
+const char* jobs_typestr( jobType_t type )
+{
+    switch( type ) {
+    case JOB_BLINK:  return "blink";
+    case JOB_RANDOM: return "random";
+    case JOB_ONESHOT: return "oneshot";
+    default:         return "none";
+    }
+}
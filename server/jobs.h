@@ -0,0 +1,82 @@
+/*
+ * jobs -- timed light effects for blink1-tiny-server
+ *
+ * Effects like blink and random take many steps spread over time.
+ * Rather than sleeping in the HTTP handler, each effect becomes a job
+ * whose steps are run from the server's main loop when they come due.
+ *
+ */
+
+#ifndef __JOBS_H__
+#define __JOBS_H__
+
+#include <stdint.h>
+
+#include "devmgr.h"
+
+#define jobs_max 64
+
+typedef enum {
+    JOB_NONE = 0,
+    JOB_BLINK,    // alternate color & off, 'count' times
+    JOB_RANDOM,   // 'count' random colors
+    JOB_ONESHOT   // do 'op' once when due, for scheduled batch ops
+} jobType_t;
+
+typedef struct job_ {
+    int id;            // > 0 if job slot in use
+    jobType_t type;
+    devmgr_set devs;   // devmgr indexes to run on
+    uint8_t ledn;      // 0 = all LEDs
+    uint8_t r, g, b;
+    uint16_t millis;   // time per blink / per color
+    int count;         // number of blinks or colors
+    int step;          // steps done so far
+    double due;        // mg_time() of next step
+    devop_t op;        // JOB_ONESHOT only
+} job_t;
+
+/**
+ * Start a job. First step is run on next jobs_run().
+ * @param devs devices to run on
+ * @param ledn LED to use, 0 = all
+ * @return job id, or -1 if too many jobs running
+ */
+int jobs_add( jobType_t type, devmgr_set* devs, uint8_t ledn,
+              uint16_t millis, int count, uint8_t r, uint8_t g, uint8_t b );
+
+/**
+ * Queue 'op' on devices after a delay, as a JOB_ONESHOT job.
+ * @param delayMillis millis from now to run op
+ * @return job id, or -1 if too many jobs running
+ */
+int jobs_schedule( devop_t* op, devmgr_set* devs, int delayMillis );
+
+/**
+ * @return number of devices job runs on
+ */
+int jobs_devCount( job_t* j );
+
+/**
+ * Cancel a job.
+ * @return 0 on success, -1 if no such job
+ */
+int jobs_cancel( int id );
+
+/**
+ * Run all job steps that are due.
+ * @return millis until next step is due, or -1 if no jobs
+ */
+int jobs_run(void);
+
+/**
+ * @return job in slot i (0-jobs_max), or NULL if slot unused
+ */
+job_t* jobs_get( int i );
+
+/**
+ * @return name of job type
+ */
+const char* jobs_typestr( jobType_t type );
+
+#endif
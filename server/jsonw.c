@@ -0,0 +1,182 @@
+/*
+ * jsonw -- bounded JSON writer for blink1-tiny-server replies
+ *
+ * see jsonw.h
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "jsonw.h"
+
+#define jsonw_pretty_level  2   // default for 'pretty'
+
+//
+static void jsonw_put( jsonw* w, const char* s, int n )
+{
+    if( w->overflow ) return;
+    if( w->len + n >= w->size ) {  // leave room for the nul
+        w->overflow = 1;
+        return;
+    }
+    memcpy( w->buf + w->len, s, n );
+    w->len += n;
+    w->buf[w->len] = '\0';
+}
+
+//
+static void jsonw_indent( jsonw* w, int level )
+{
+    static const char spaces[] = "\n        ";
+    if( level < 0 ) level = 0;
+    jsonw_put( w, spaces, 1 + 2*level );
+}
+
+// comma & newline before a key or value, unless it's the value of a key
+static void jsonw_sep( jsonw* w )
+{
+    if( w->key ) {
+        w->key = 0;
+        return;
+    }
+    int level = w->depth + w->base;
+    if( w->items[w->depth] ) jsonw_put( w, ",", 1 );
+    if( level > 0 && level <= w->pretty ) jsonw_indent( w, level-1 );
+    else if( w->items[w->depth] ) jsonw_put( w, " ", 1 );
+    w->items[w->depth] = 1;
+}
+
+//
+static void jsonw_open( jsonw* w, char open, char close )
+{
+    jsonw_sep( w );
+    if( w->depth == jsonw_depth_max ) {
+        w->overflow = 1;
+        return;
+    }
+    jsonw_put( w, &open, 1 );
+    w->depth++;
+    w->items[w->depth] = 0;
+    w->close[w->depth] = close;
+}
+
+//
+void jsonw_init( jsonw* w, char* buf, int size )
+{
+    memset( w, 0, sizeof(*w) );
+    w->buf = buf;
+    w->size = size;
+    w->pretty = jsonw_pretty_level;
+    if( size > 0 ) buf[0] = '\0';
+    else w->overflow = 1;
+}
+
+//
+void jsonw_initCompact( jsonw* w, char* buf, int size )
+{
+    jsonw_init( w, buf, size );
+    w->pretty = 0;
+}
+
+//
+void jsonw_initMembers( jsonw* w, char* buf, int size )
+{
+    jsonw_init( w, buf, size );
+    w->base = 1;
+}
+
+//
+void jsonw_obj( jsonw* w )
+{
+    jsonw_open( w, '{', '}' );
+}
+
+//
+void jsonw_arr( jsonw* w )
+{
+    jsonw_open( w, '[', ']' );
+}
+
+//
+void jsonw_end( jsonw* w )
+{
+    if( w->depth == 0 ) return;
+    int level = w->depth + w->base;
+    if( w->items[w->depth] && level <= w->pretty ) jsonw_indent( w, level-2 );
+    jsonw_put( w, &w->close[w->depth], 1 );
+    w->depth--;
+    if( w->depth == 0 && w->base == 0 && w->pretty ) jsonw_put( w, "\n", 1 );
+}
+
+//
+void jsonw_key( jsonw* w, const char* key )
+{
+    jsonw_str( w, key );
+    jsonw_put( w, ": ", 2 );
+    w->key = 1;
+}
+
+//
+void jsonw_str( jsonw* w, const char* s )
+{
+    char esc[8];
+    jsonw_sep( w );
+    jsonw_put( w, "\"", 1 );
+    const char* run = s;
+    for( ; *s; s++ ) {
+        unsigned char c = *s;
+        if( c >= 0x20 && c != '"' && c != '\\' ) continue;
+        jsonw_put( w, run, s - run );
+        run = s + 1;
+        if( c == '"' || c == '\\' ) {
+            esc[0] = '\\'; esc[1] = c;
+            jsonw_put( w, esc, 2 );
+        }
+        else if( c == '\n' ) jsonw_put( w, "\\n", 2 );
+        else if( c == '\t' ) jsonw_put( w, "\\t", 2 );
+        else jsonw_put( w, esc, sprintf(esc, "\\u%04x", c) );
+    }
+    jsonw_put( w, run, s - run );
+    jsonw_put( w, "\"", 1 );
+}
+
+//
+void jsonw_int( jsonw* w, long v )
+{
+    char num[24];
+    jsonw_sep( w );
+    jsonw_put( w, num, sprintf(num, "%ld", v) );
+}
+
+//
+void jsonw_raw( jsonw* w, const char* json, int len )
+{
+    jsonw_sep( w );
+    jsonw_put( w, json, len );
+}
+
+//
+void jsonw_members( jsonw* w, const jsonw* frag )
+{
+    if( frag->overflow ) w->overflow = 1;
+    if( frag->len == 0 ) return;
+    // frag's first member has its newline but no comma
+    if( w->items[w->depth] ) jsonw_put( w, ",", 1 );
+    jsonw_put( w, frag->buf, frag->len );
+    w->items[w->depth] = 1;
+}
+
+//
+void jsonw_kstr( jsonw* w, const char* key, const char* s )
+{
+    jsonw_key( w, key );
+    jsonw_str( w, s );
+}
+
+//
+void jsonw_kint( jsonw* w, const char* key, long v )
+{
+    jsonw_key( w, key );
+    jsonw_int( w, v );
+}
@@ -0,0 +1,101 @@
+/*
+ * jsonw -- bounded JSON writer for blink1-tiny-server replies
+ *
+ * Writes into a buffer the caller owns and never allocates.  Commas go
+ * in by themselves, strings are escaped, and members of the top-level
+ * object (and elements of arrays in it) go on their own lines so curl
+ * output stays readable.
+ *
+ * Nothing is ever written past the buffer: once a write doesn't fit,
+ * it and all later ones are dropped and 'overflow' is set, so check
+ * that before sending.
+ *
+ *   jsonw w;
+ *   jsonw_init( &w, buf, sizeof(buf) );
+ *   jsonw_obj( &w );
+ *   jsonw_kstr( &w, "result", "blink1 on" );
+ *   jsonw_key( &w, "ids" );  jsonw_arr( &w );
+ *   jsonw_int( &w, 1 );  jsonw_int( &w, 2 );
+ *   jsonw_end( &w );  jsonw_end( &w );
+ *
+ * A writer begun with jsonw_initMembers() holds just "key": value
+ * members, to be spliced into another writer's object later with
+ * jsonw_members().
+ *
+ */
+
+#ifndef __JSONW_H__
+#define __JSONW_H__
+
+#include <stdint.h>
+
+#define jsonw_depth_max  8
+
+typedef struct jsonw_ {
+    char* buf;
+    int size;
+    int len;          // chars written, buf is always nul-terminated
+    int overflow;     // something didn't fit
+    int depth;
+    int base;         // 1 for a members fragment, as if inside an object
+    int key;          // a key was just written, value comes next
+    int pretty;       // items down to this level go on their own line
+    char items[jsonw_depth_max+1];  // container at depth has items
+    char close[jsonw_depth_max+1];  // '}' or ']'
+} jsonw;
+
+/**
+ * Start writing into buf.
+ */
+void jsonw_init( jsonw* w, char* buf, int size );
+
+/**
+ * Start writing into buf, all on one line, for messages on a stream.
+ */
+void jsonw_initCompact( jsonw* w, char* buf, int size );
+
+/**
+ * Start writing object members, with no enclosing braces, into buf.
+ */
+void jsonw_initMembers( jsonw* w, char* buf, int size );
+
+/**
+ * Open an object or array.
+ */
+void jsonw_obj( jsonw* w );
+void jsonw_arr( jsonw* w );
+
+/**
+ * Close the innermost object or array.
+ */
+void jsonw_end( jsonw* w );
+
+/**
+ * Write a member name, the next value written is its value.
+ */
+void jsonw_key( jsonw* w, const char* key );
+
+/**
+ * Write a value.  Strings are escaped.
+ */
+void jsonw_str( jsonw* w, const char* s );
+void jsonw_int( jsonw* w, long v );
+
+/**
+ * Write a value that's already JSON, e.g. from events_formatState().
+ */
+void jsonw_raw( jsonw* w, const char* json, int len );
+
+/**
+ * Write the members of a jsonw_initMembers() writer into the current
+ * object.  Overflow carries over.
+ */
+void jsonw_members( jsonw* w, const jsonw* frag );
+
+/**
+ * Write a member, key & value at once.
+ */
+void jsonw_kstr( jsonw* w, const char* key, const char* s );
+void jsonw_kint( jsonw* w, const char* key, long v );
+
+#endif
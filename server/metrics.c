@@ -0,0 +1,245 @@
+/*
+ * metrics -- counters & latency histograms for blink1-tiny-server
+ *
+ * see metrics.h
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mongoose.h"
+#include "devmgr.h"
+#include "jobs.h"
+#include "events.h"
+#include "pool.h"
+#include "sched.h"
+#ifndef BLINK1_SERVER_TINY
+#include "broker.h"
+#endif
+#include "metrics.h"
+
+// upper bounds of buckets, in millis
+static const double bounds[metrics_buckets] = {
+    0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250, 500, 1000, 5000
+};
+
+typedef struct metrics_route_ {
+    char name[40];
+    uint64_t requests;
+    metrics_hist millis;
+} metrics_route;
+
+static metrics_route routes[metrics_routes_max];
+static int routes_count = 0;
+
+// devices ever seen, for up/down gauges
+typedef struct metrics_dev_ {
+    char serial[serialstrmax];
+    int up;
+} metrics_dev;
+
+static metrics_dev devs[devmgr_max];
+static int devs_count = 0;
+
+//
+void metrics_observe( metrics_hist* h, double millis )
+{
+    int i;
+    if( millis < 0 ) millis = 0;
+    for( i=0; i < metrics_buckets && millis > bounds[i]; i++ ) ;
+    metrics_add( &h->counts[i], 1 );
+    metrics_add( &h->sum_usecs, (uint64_t)(millis * 1000) );
+    metrics_add( &h->count, 1 );
+}
+
+//
+void metrics_request( const char* route, double start )
+{
+    metrics_route* r = NULL;
+    for( int i=0; i < routes_count; i++ ) {
+        if( strcmp( routes[i].name, route ) == 0 ) { r = &routes[i]; break; }
+    }
+    if( r == NULL ) {
+        if( routes_count == metrics_routes_max ) return;
+        r = &routes[routes_count];
+        snprintf(r->name, sizeof(r->name), "%s", route);
+        routes_count++;  // only the event loop adds routes
+    }
+    metrics_add( &r->requests, 1 );
+    metrics_observe( &r->millis, (mg_time() - start) * 1000 );
+}
+
+//
+void metrics_deviceChanged( int change, const char* serial )
+{
+    int i;
+    for( i=0; i < devs_count; i++ ) {
+        if( strcmp( devs[i].serial, serial ) == 0 ) break;
+    }
+    if( i == devs_count ) {
+        if( devs_count == devmgr_max ) return;
+        snprintf(devs[i].serial, sizeof(devs[i].serial), "%s", serial);
+        devs_count++;
+    }
+    if( change == DEVMGR_ADDED )   devs[i].up = 1;
+    if( change == DEVMGR_REMOVED ) devs[i].up = 0;
+}
+
+// append printf-style to buf
+static void metrics_printf( struct mbuf* buf, const char* fmt, ... )
+{
+    char line[300];
+    va_list ap;
+    va_start( ap, fmt );
+    int n = vsnprintf( line, sizeof(line), fmt, ap );
+    va_end( ap );
+    if( n > (int)sizeof(line)-1 ) n = sizeof(line)-1;
+    mbuf_append( buf, line, n );
+}
+
+//
+void metrics_formatHist( struct mbuf* buf, const char* name,
+                         const char* labels, metrics_hist* h )
+{
+    const char* sep = (labels[0]) ? "," : "";
+    uint64_t cum = 0;
+    for( int i=0; i <= metrics_buckets; i++ ) {
+        cum += h->counts[i];
+        if( i < metrics_buckets ) {
+            metrics_printf(buf, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels, sep,
+                           bounds[i] / 1000, (unsigned long long)cum);
+        } else {
+            metrics_printf(buf, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep,
+                           (unsigned long long)cum);
+        }
+    }
+    const char* lb = (labels[0]) ? "{" : "";
+    const char* rb = (labels[0]) ? "}" : "";
+    metrics_printf(buf, "%s_sum%s%s%s %.6f\n", name, lb, labels, rb, h->sum_usecs / 1e6);
+    metrics_printf(buf, "%s_count%s%s%s %llu\n", name, lb, labels, rb,
+                   (unsigned long long)h->count);
+}
+
+//
+void metrics_format( struct mbuf* buf )
+{
+    char labels[100];
+
+    metrics_printf(buf, "# TYPE blink1_http_requests counter\n"
+                   "# HELP blink1_http_requests Requests handled, by route.\n");
+    for( int i=0; i < routes_count; i++ ) {
+        metrics_printf(buf, "blink1_http_requests_total{route=\"%s\"} %llu\n",
+                       routes[i].name, (unsigned long long)routes[i].requests);
+    }
+    metrics_printf(buf, "# TYPE blink1_http_request_duration_seconds histogram\n"
+                   "# HELP blink1_http_request_duration_seconds Time from request to reply, by route.\n");
+    for( int i=0; i < routes_count; i++ ) {
+        snprintf(labels, sizeof(labels), "route=\"%s\"", routes[i].name);
+        metrics_formatHist( buf, "blink1_http_request_duration_seconds", labels, &routes[i].millis );
+    }
+
+    int n = devmgr_count();
+    metrics_printf(buf, "# TYPE blink1_usb_write_duration_seconds histogram\n"
+                   "# HELP blink1_usb_write_duration_seconds Time per USB write, by device.\n");
+    for( int i=0; i < n; i++ ) {
+        devmgr_stats* st = devmgr_getStats(i);
+        if( st == NULL ) continue;
+        snprintf(labels, sizeof(labels), "serial=\"%s\"", devmgr_get(i)->serial);
+        metrics_formatHist( buf, "blink1_usb_write_duration_seconds", labels, &st->write_millis );
+    }
+    metrics_printf(buf, "# TYPE blink1_queue_depth gauge\n"
+                   "# HELP blink1_queue_depth Ops waiting for the device.\n");
+    for( int i=0; i < n; i++ ) {
+        metrics_printf(buf, "blink1_queue_depth{serial=\"%s\"} %d\n",
+                       devmgr_get(i)->serial, devmgr_queueDepth(i));
+    }
+    metrics_printf(buf, "# TYPE blink1_stream_backlog gauge\n"
+                   "# HELP blink1_stream_backlog LEDs with a streamed color not yet written.\n");
+    for( int i=0; i < n; i++ ) {
+        metrics_printf(buf, "blink1_stream_backlog{serial=\"%s\"} %d\n",
+                       devmgr_get(i)->serial, devmgr_streamBacklog(i));
+    }
+    metrics_printf(buf, "# TYPE blink1_coalesced counter\n"
+                   "# HELP blink1_coalesced Streamed colors replaced before being written.\n");
+    for( int i=0; i < n; i++ ) {
+        devmgr_stats* st = devmgr_getStats(i);
+        if( st == NULL ) continue;
+        metrics_printf(buf, "blink1_coalesced_total{serial=\"%s\"} %u\n",
+                       devmgr_get(i)->serial, st->coalesced);
+    }
+    metrics_printf(buf, "# TYPE blink1_dropped counter\n"
+                   "# HELP blink1_dropped Ops refused because the device's queue was full.\n");
+    for( int i=0; i < n; i++ ) {
+        devmgr_stats* st = devmgr_getStats(i);
+        if( st == NULL ) continue;
+        metrics_printf(buf, "blink1_dropped_total{serial=\"%s\"} %u\n",
+                       devmgr_get(i)->serial, st->dropped);
+    }
+    metrics_printf(buf, "# TYPE blink1_merged counter\n"
+                   "# HELP blink1_merged Queued colors superseded before being written.\n");
+    for( int i=0; i < n; i++ ) {
+        devmgr_stats* st = devmgr_getStats(i);
+        if( st == NULL ) continue;
+        metrics_printf(buf, "blink1_merged_total{serial=\"%s\"} %u\n",
+                       devmgr_get(i)->serial, st->merged);
+    }
+    metrics_printf(buf, "# TYPE blink1_rejected counter\n"
+                   "# HELP blink1_rejected Requests answered 429 because the device was too far behind.\n");
+    for( int i=0; i < n; i++ ) {
+        devmgr_stats* st = devmgr_getStats(i);
+        if( st == NULL ) continue;
+        metrics_printf(buf, "blink1_rejected_total{serial=\"%s\"} %u\n",
+                       devmgr_get(i)->serial, st->rejected);
+    }
+    metrics_printf(buf, "# TYPE blink1_device_errors counter\n"
+                   "# HELP blink1_device_errors Failed opens & writes.\n");
+    for( int i=0; i < n; i++ ) {
+        metrics_printf(buf, "blink1_device_errors_total{serial=\"%s\"} %u\n",
+                       devmgr_get(i)->serial, devmgr_errors(i));
+    }
+
+    metrics_printf(buf, "# TYPE blink1_device_up gauge\n"
+                   "# HELP blink1_device_up 1 if device is plugged in, 0 if it was and isn't now.\n");
+    for( int i=0; i < devs_count; i++ ) {
+        metrics_printf(buf, "blink1_device_up{serial=\"%s\"} %d\n", devs[i].serial, devs[i].up);
+    }
+    metrics_printf(buf, "# TYPE blink1_devices gauge\n"
+                   "# HELP blink1_devices Devices plugged in.\n"
+                   "blink1_devices %d\n", n);
+    metrics_printf(buf, "# TYPE blink1_enumerate_duration_seconds histogram\n"
+                   "# HELP blink1_enumerate_duration_seconds Time per USB device scan.\n");
+    metrics_formatHist( buf, "blink1_enumerate_duration_seconds", "", devmgr_scanStats() );
+
+    int njobs = 0;
+    for( int i=0; i < jobs_max; i++ ) {
+        if( jobs_get(i) ) njobs++;
+    }
+    metrics_printf(buf, "# TYPE blink1_jobs gauge\n"
+                   "# HELP blink1_jobs Background effects running or scheduled.\n"
+                   "blink1_jobs %d\n", njobs);
+    metrics_printf(buf, "# TYPE blink1_schedules gauge\n"
+                   "# HELP blink1_schedules Scheduled & recurring batches.\n"
+                   "blink1_schedules %d\n", sched_count());
+    metrics_printf(buf, "# TYPE blink1_event_subscribers gauge\n"
+                   "# HELP blink1_event_subscribers Connections to /blink1/events.\n"
+                   "blink1_event_subscribers %d\n", events_subscribers());
+#ifndef BLINK1_SERVER_TINY
+    metrics_printf(buf, "# TYPE blink1_mqtt_clients gauge\n"
+                   "# HELP blink1_mqtt_clients Connections to the MQTT broker.\n"
+                   "blink1_mqtt_clients %d\n", broker_clients());
+#else
+    pool_stats* ps = pool_getStats();
+    metrics_printf(buf, "# TYPE blink1_pool_bytes gauge\n"
+                   "# HELP blink1_pool_bytes Memory pool size, in use, and most ever in use.\n"
+                   "blink1_pool_bytes{kind=\"size\"} %u\n"
+                   "blink1_pool_bytes{kind=\"used\"} %u\n"
+                   "blink1_pool_bytes{kind=\"peak\"} %u\n",
+                   ps->size, ps->used, ps->peak);
+    metrics_printf(buf, "# TYPE blink1_pool_failures counter\n"
+                   "# HELP blink1_pool_failures Allocations the pools had no room for.\n"
+                   "blink1_pool_failures_total %u\n", ps->failures);
+#endif
+    metrics_printf(buf, "# EOF\n");
+}
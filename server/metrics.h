@@ -0,0 +1,58 @@
+/*
+ * metrics -- counters & latency histograms for blink1-tiny-server
+ *
+ * Histograms are fixed arrays of bucket counts bumped with atomic adds,
+ * so worker threads and the event loop can record without taking locks.
+ * Nothing is formatted until /metrics is scraped, which writes
+ * OpenMetrics text for Prometheus.
+ *
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdint.h>
+
+#include "mongoose.h"
+
+#define metrics_buckets     14   // not counting +Inf
+#define metrics_routes_max  32
+
+typedef struct metrics_hist_ {
+    uint64_t counts[metrics_buckets+1];  // per bucket, last is +Inf
+    uint64_t sum_usecs;
+    uint64_t count;
+} metrics_hist;
+
+#define metrics_add(p,n)  __sync_fetch_and_add( (p), (n) )
+
+/**
+ * Record a duration in a histogram. Thread-safe, lock-free.
+ */
+void metrics_observe( metrics_hist* h, double millis );
+
+/**
+ * Count a request on route and how long it took.
+ * @param route URI that was matched, or "other"
+ * @param start mg_time() when request arrived
+ */
+void metrics_request( const char* route, double start );
+
+/**
+ * Track device up/down, call on DEVMGR_ADDED & DEVMGR_REMOVED.
+ */
+void metrics_deviceChanged( int change, const char* serial );
+
+/**
+ * Write all metrics as OpenMetrics text to buf.
+ */
+void metrics_format( struct mbuf* buf );
+
+/**
+ * Write one histogram in OpenMetrics text to buf.
+ * @param labels e.g. "serial=\"2000ABCD\"", or "" for none
+ */
+void metrics_formatHist( struct mbuf* buf, const char* name,
+                         const char* labels, metrics_hist* h );
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * pattern -- parse color patterns for upload to a blink(1)'s pattern memory
+ *
+ * see pattern.h
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json.h"  // https://github.com/udp/json-parser
+
+#include "pattern.h"
+#include "pool.h"
+
+// get a number from a JSON int or double
+static double pattern_num( json_value* jv )
+{
+    if( jv->type == json_integer ) return jv->u.integer;
+    if( jv->type == json_double )  return jv->u.dbl;
+    return 0;
+}
+
+//
+static int pattern_parseLine( json_value* jv, patternline_t* line )
+{
+    if( jv->type != json_object ) return -1;
+    memset( line, 0, sizeof(patternline_t) );
+    double millis = 100;
+    for( unsigned int i=0; i < jv->u.object.length; i++ ) {
+        const char* name = jv->u.object.values[i].name;
+        json_value* v = jv->u.object.values[i].value;
+        if( strcmp(name, "rgb") == 0 && v->type == json_string ) {
+            parsecolor( &line->color, v->u.string.ptr );
+        }
+        else if( strcmp(name, "millis") == 0 ) millis = pattern_num(v);
+        else if( strcmp(name, "time") == 0 )   millis = 1000 * pattern_num(v);
+        else if( strcmp(name, "ledn") == 0 )   line->ledn = pattern_num(v);
+    }
+    if( millis < 0 ) millis = 0;
+    if( millis > 65535 ) millis = 65535;
+    line->millis = millis;
+    return 0;
+}
+
+//
+static int pattern_parseJson( const char* str, size_t len, pattern_t* patt,
+                              char* errstr, int errlen )
+{
+    json_value* jv = pool_jsonParse( str, len );
+    json_value* lines = jv;
+    if( jv && jv->type == json_object ) {
+        lines = NULL;
+        for( unsigned int i=0; i < jv->u.object.length; i++ ) {
+            const char* name = jv->u.object.values[i].name;
+            json_value* v = jv->u.object.values[i].value;
+            if( strcmp(name, "lines") == 0 )   lines = v;
+            if( strcmp(name, "repeats") == 0 ) patt->repeats = pattern_num(v);
+        }
+    }
+    int rc = 0;
+    if( lines == NULL || lines->type != json_array ) {
+        snprintf(errstr, errlen, "pattern must be a JSON array of lines");
+        rc = -1;
+    }
+    else if( lines->u.array.length > pattern_lines_max ) {
+        snprintf(errstr, errlen, "too many lines, max %d", pattern_lines_max);
+        rc = -1;
+    }
+    for( unsigned int i=0; rc == 0 && i < lines->u.array.length; i++ ) {
+        if( pattern_parseLine( lines->u.array.values[i], &patt->lines[i] ) < 0 ) {
+            snprintf(errstr, errlen, "line %d is not an object", i);
+            rc = -1;
+        }
+        patt->len++;
+    }
+    pool_jsonFree( jv );
+    return (rc == 0) ? patt->len : -1;
+}
+
+//
+int pattern_parse( const char* str, size_t len, pattern_t* patt,
+                   char* errstr, int errlen )
+{
+    memset( patt, 0, sizeof(pattern_t) );
+    while( len && (*str == ' ' || *str == '\t' || *str == '\r' || *str == '\n') ) {
+        str++; len--;
+    }
+    if( len && (*str == '{' || *str == '[') ) {
+        return pattern_parseJson( str, len, patt, errstr, errlen );
+    }
+
+    // parsePattern() doesn't know how big 'lines' is, so check first
+    char buf[2000];
+    int commas = 0;
+    if( len >= sizeof(buf) ) {
+        snprintf(errstr, errlen, "pattern too long");
+        return -1;
+    }
+    memcpy( buf, str, len );
+    buf[len] = '\0';
+    for( char* c = buf; *c; c++ ) {
+        if( *c == ',' ) commas++;
+    }
+    if( commas > 3 * pattern_lines_max ) {
+        snprintf(errstr, errlen, "too many lines, max %d", pattern_lines_max);
+        return -1;
+    }
+    if( commas < 3 ) {
+        snprintf(errstr, errlen, "pattern needs 'repeats,color,secs,ledn,...'");
+        return -1;
+    }
+    patt->repeats = 0;
+    patt->len = parsePattern( buf, &patt->repeats, patt->lines );
+    if( patt->repeats < 0 ) patt->repeats = 0;
+    return patt->len;
+}
+
+//
+void pattern_lineOp( pattern_t* patt, int i, int pos, devop_t* op )
+{
+    patternline_t* l = &patt->lines[i];
+    memset( op, 0, sizeof(devop_t) );
+    op->type = DEVOP_PATTLINE;
+    op->r = l->color.r;
+    op->g = l->color.g;
+    op->b = l->color.b;
+    op->millis = l->millis / 2;  // fade for half the step, as blink1-tool does
+    op->ledn = l->ledn;
+    op->startpos = pos;
+}
@@ -0,0 +1,46 @@
+/*
+ * pattern -- parse color patterns for upload to a blink(1)'s pattern memory
+ *
+ * Patterns come in blink1-tool's text format (see parsePattern()):
+ *
+ *   "repeats,color1,secs1,ledn1,color2,secs2,ledn2,..."
+ *   e.g. "3,#ff0000,0.5,0,#0000ff,0.5,0"
+ *
+ * or as JSON, either an array of lines or an object with "repeats":
+ *
+ *   {"repeats":3, "lines":[ {"rgb":"#ff0000", "time":0.5, "ledn":0},
+ *                           {"rgb":"#0000ff", "millis":500} ]}
+ *
+ * Each line's time is how long that step lasts; like blink1-tool, the
+ * fade is half of it.
+ *
+ */
+
+#ifndef __PATTERN_H__
+#define __PATTERN_H__
+
+#include "blink1-lib.h"
+#include "devmgr.h"
+
+#define pattern_lines_max  devmgr_patt_max
+
+typedef struct pattern_ {
+    patternline_t lines[pattern_lines_max];
+    int len;
+    int repeats;         // 0 = forever
+} pattern_t;
+
+/**
+ * Parse a pattern in text or JSON format into patt.
+ * @param errstr filled in with reason if parse fails
+ * @return number of lines, or -1 on error
+ */
+int pattern_parse( const char* str, size_t len, pattern_t* patt,
+                   char* errstr, int errlen );
+
+/**
+ * Make the op that writes line i of patt to pattern position pos.
+ */
+void pattern_lineOp( pattern_t* patt, int i, int pos, devop_t* op );
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * pool -- memory for blink1-tiny-server's connections & requests
+ *
+ * see pool.h
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+static pool_stats s_stats;
+
+#ifdef BLINK1_SERVER_TINY
+
+#define POOL_BYTES(size, count)   + (size)*(count)
+#define POOL_CLASS(size, count)   { size, count },
+
+#define pool_bytes  (0 pool_classes(POOL_BYTES))
+
+typedef struct pool_class_ {
+    uint32_t size;
+    uint32_t count;
+} pool_class;
+
+static const pool_class s_classes[] = { pool_classes(POOL_CLASS) };
+#define nclasses  (int)(sizeof(s_classes)/sizeof(s_classes[0]))
+
+// blocks are handed out in order the first time, so pages nobody has
+// needed yet are never touched and don't count toward RSS
+static uint8_t s_arena[pool_bytes] __attribute__((aligned(16)));
+static uint8_t* s_start[nclasses];   // first block of each class
+static uint32_t s_fresh[nclasses];   // blocks never handed out start here
+static void*    s_free[nclasses];    // freed blocks, linked through their first word
+
+//
+static void pool_init(void)
+{
+    uint8_t* p = s_arena;
+    for( int c=0; c < nclasses; c++ ) {
+        s_start[c] = p;
+        p += s_classes[c].size * s_classes[c].count;
+    }
+    s_stats.size = pool_bytes;
+}
+
+// @return class p's block is in, -1 if p isn't from the pools
+static int pool_classOf( void* p )
+{
+    uint8_t* b = (uint8_t*) p;
+    if( b < s_arena || b >= s_arena + pool_bytes ) return -1;
+    for( int c = nclasses-1; c >= 0; c-- ) {
+        if( b >= s_start[c] ) return c;
+    }
+    return -1;
+}
+
+//
+void* pool_malloc( size_t size )
+{
+    if( s_stats.size == 0 ) pool_init();
+    for( int c=0; c < nclasses; c++ ) {
+        if( size > s_classes[c].size ) continue;
+        void* p = s_free[c];
+        if( p != NULL ) {
+            s_free[c] = *(void**) p;
+        } else if( s_fresh[c] < s_classes[c].count ) {
+            p = s_start[c] + s_classes[c].size * s_fresh[c]++;
+        } else {
+            continue;  // class used up, take a bigger block
+        }
+        s_stats.used += s_classes[c].size;
+        if( s_stats.used > s_stats.peak ) s_stats.peak = s_stats.used;
+        return p;
+    }
+    s_stats.failures++;
+    return NULL;
+}
+
+//
+void pool_free( void* p )
+{
+    if( p == NULL ) return;
+    int c = pool_classOf( p );
+    if( c < 0 ) {  // from the heap, by something outside the server
+        free( p );
+        return;
+    }
+    *(void**) p = s_free[c];
+    s_free[c] = p;
+    s_stats.used -= s_classes[c].size;
+}
+
+//
+void* pool_realloc( void* p, size_t size )
+{
+    if( p == NULL ) return pool_malloc( size );
+    if( size == 0 ) {
+        pool_free( p );
+        return NULL;
+    }
+    int c = pool_classOf( p );
+    if( c < 0 ) return realloc( p, size );
+    if( size <= s_classes[c].size ) return p;
+    void* q = pool_malloc( size );
+    if( q == NULL ) return NULL;  // p is still good, as with realloc()
+    memcpy( q, p, s_classes[c].size );
+    pool_free( p );
+    return q;
+}
+
+#else  // normal build, the heap
+
+//
+void* pool_malloc( size_t size )
+{
+    return malloc( size );
+}
+
+//
+void pool_free( void* p )
+{
+    free( p );
+}
+
+//
+void* pool_realloc( void* p, size_t size )
+{
+    return realloc( p, size );
+}
+
+#endif
+
+//
+void* pool_calloc( size_t n, size_t size )
+{
+    void* p = pool_malloc( n * size );
+    if( p ) memset( p, 0, n * size );
+    return p;
+}
+
+// json_settings' mem_alloc & mem_free
+static void* pool_jsonMemAlloc( size_t size, int zero, void* user_data )
+{
+    (void) user_data;
+    return (zero) ? pool_calloc( 1, size ) : pool_malloc( size );
+}
+
+//
+static void pool_jsonMemFree( void* p, void* user_data )
+{
+    (void) user_data;
+    pool_free( p );
+}
+
+static json_settings s_json = { .mem_alloc = pool_jsonMemAlloc, .mem_free = pool_jsonMemFree };
+
+//
+json_value* pool_jsonParse( const char* json, size_t len )
+{
+    return json_parse_ex( &s_json, json, len, NULL );
+}
+
+//
+void pool_jsonFree( json_value* jv )
+{
+    if( jv ) json_value_free_ex( &s_json, jv );
+}
+
+//
+pool_stats* pool_getStats(void)
+{
+    return &s_stats;
+}
@@ -0,0 +1,59 @@
+/*
+ * pool -- memory for blink1-tiny-server's connections & requests
+ *
+ * The server, mongoose and json-parser allocate through here.  In the
+ * normal build these are just malloc() & friends.  In the tiny build
+ * (BLINK1_SERVER_TINY, "make SERVER_PROFILE=tiny") they come from fixed
+ * pools of fixed-size blocks in one static array, so memory use is set
+ * at link time and nothing touches the heap once the server is up.
+ * A request that needs more than is left fails (and is counted) instead
+ * of growing the process.
+ *
+ * Block sizes & counts are pool_classes below, sized for the tiny
+ * build's connection and device limits.
+ *
+ */
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "json.h"  // https://github.com/udp/json-parser
+
+// X(block size, blocks) for each pool, smallest first.
+// 4608 holds a device worker or a batch, just over 4K each.
+// 16384 holds a connection's send buffer with the biggest reply, one
+// for each of the server's conns_max (16) connections and a few spare
+#define pool_classes(X) \
+    X(64, 256) X(256, 128) X(1024, 96) X(4608, 32) X(16384, 20) X(32768, 2)
+
+typedef struct pool_stats_ {
+    uint32_t size;          // bytes the pools hold
+    uint32_t used;          // bytes in blocks handed out now
+    uint32_t peak;          // most 'used' has been
+    uint32_t failures;      // allocations that didn't fit
+} pool_stats;
+
+void* pool_malloc( size_t size );
+void* pool_calloc( size_t n, size_t size );
+void* pool_realloc( void* p, size_t size );
+void  pool_free( void* p );
+
+/**
+ * Parse JSON with json-parser, allocating through the pool.
+ * @return parsed value, to be freed with pool_jsonFree(), or NULL
+ */
+json_value* pool_jsonParse( const char* json, size_t len );
+/**
+ * Free a value from pool_jsonParse(), NULL is ok.
+ */
+void pool_jsonFree( json_value* jv );
+
+/**
+ * @return pool usage, all zero in the normal build
+ */
+pool_stats* pool_getStats(void);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * query -- single-pass query string parsing for blink1-tiny-server
+ *
+ * see query.h
+ *
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "query.h"
+
+static const struct {
+    const char* name;
+    int len;
+    uint32_t bit;
+} s_args[] = {
+    { "millis",  6, QUERY_MILLIS },
+    { "time",    4, QUERY_TIME },
+    { "rgb",     3, QUERY_RGB },
+    { "count",   5, QUERY_COUNT },
+    { "id",      2, QUERY_ID },
+    { "ledn",    4, QUERY_LEDN },
+    { "fresh",   5, QUERY_FRESH },
+    { "start",   5, QUERY_START },
+    { "end",     3, QUERY_END },
+    { "save",    4, QUERY_SAVE },
+    { "pattern", 7, QUERY_PATTERN },
+    { "at",      2, QUERY_AT },
+    { "every",   5, QUERY_EVERY },
+    { "cron",    4, QUERY_CRON },
+};
+#define nargs  (int)(sizeof(s_args)/sizeof(s_args[0]))
+
+//
+static uint32_t query_arg( const char* key, int len )
+{
+    for( int i=0; i < nargs; i++ ) {
+        if( s_args[i].len == len && memcmp( s_args[i].name, key, len ) == 0 ) {
+            return s_args[i].bit;
+        }
+    }
+    return 0;
+}
+
+//
+int query_parse( const struct mg_str* qs, query_t* q )
+{
+    char val[query_id_max];
+    uint16_t timeMillis = 0;
+    char* e;
+    int n = 0;
+    const char* p = qs->p;
+    const char* end = qs->p + qs->len;
+
+    memset( q, 0, offsetof(query_t, id) );  // not the big buffers
+    q->id[0] = '\0';
+    q->pattern[0] = '\0';
+    q->patternlen = -1;
+    q->at[0] = q->every[0] = q->cron[0] = '\0';
+    while( p < end ) {
+        const char* amp = memchr( p, '&', end - p );
+        if( amp == NULL ) amp = end;
+        const char* eq = memchr( p, '=', amp - p );
+        if( eq == NULL ) eq = amp;
+        uint32_t bit = query_arg( p, eq - p );
+        const char* v = (eq < amp) ? eq + 1 : amp;
+        int vlen = amp - v;
+        p = amp + 1;
+        // unknown, empty or not the first; an empty id is kept, so it's an error, not device 0
+        if( bit == 0 || (vlen == 0 && bit != QUERY_ID) || (q->has & bit) ) continue;
+        q->has |= bit;
+        n++;
+
+        if( bit == QUERY_PATTERN ) {
+            q->patternlen = mg_url_decode( v, vlen, q->pattern, sizeof(q->pattern), 1 );
+            if( q->patternlen < 0 ) q->patternlen = -2;
+            continue;
+        }
+        char* dst = (bit == QUERY_ID) ? q->id : (bit == QUERY_AT) ? q->at :
+            (bit == QUERY_EVERY) ? q->every : (bit == QUERY_CRON) ? q->cron : val;
+        int max = (bit & (QUERY_AT|QUERY_EVERY|QUERY_CRON)) ? query_sched_max : query_id_max;
+        if( mg_url_decode( v, vlen, dst, max, 1 ) < 0 ) dst[0] = '\0';
+
+        switch( bit ) {
+        case QUERY_MILLIS: q->millis = strtod(val,NULL);            break;
+        case QUERY_TIME:   timeMillis = 1000 * strtof(val,NULL);    break;
+        case QUERY_RGB:    parsecolor( &q->rgb, val );              break;
+        case QUERY_COUNT:  q->count = strtol(val,NULL,10);          break;
+        case QUERY_LEDN:   q->ledn = strtol(val,&e,10);
+                           if( e == val || *e != '\0' ) q->ledn = -1;  break;
+        case QUERY_FRESH:  q->fresh = (strcmp(val, "0") != 0);      break;
+        case QUERY_START:  q->start = strtol(val,NULL,10);          break;
+        case QUERY_END:    q->end = strtol(val,NULL,10);            break;
+        case QUERY_SAVE:   q->save = strtol(val,NULL,10);           break;
+        }
+    }
+    if( q->has & QUERY_TIME ) q->millis = timeMillis;
+    return n;
+}
@@ -0,0 +1,70 @@
+/*
+ * query -- single-pass query string parsing for blink1-tiny-server
+ *
+ * Splits the query string once, decodes only the args the server knows,
+ * and converts them to what the routes use:
+ *
+ *   millis=250  time=0.25   -- fade time, 'time' (secs) wins if both given
+ *   rgb=%23ff00ff           -- color, anything parsecolor() takes
+ *   count=3                 -- blink / random / pattern repeats
+ *   id=all  id=0,2          -- devices, or the job for /blink1/jobs/cancel
+ *   ledn=2  fresh=1
+ *   start=0  end=3  save=1  pattern=...   -- pattern routes
+ *   at=+90  every=300  cron=0+9+*+*+1-5     -- /blink1/schedule, see sched.h
+ *
+ * As with mg_get_http_var(), the first of a repeated arg counts and
+ * values are form-decoded ('+' is a space).  Unknown args are skipped.
+ *
+ */
+
+#ifndef __QUERY_H__
+#define __QUERY_H__
+
+#include "mongoose.h"
+#include "blink1-lib.h"
+
+#define query_id_max       1000
+#define query_pattern_max  2000
+#define query_sched_max    64
+
+// bits of query_t.has
+#define QUERY_MILLIS   (1<<0)
+#define QUERY_TIME     (1<<1)
+#define QUERY_RGB      (1<<2)
+#define QUERY_COUNT    (1<<3)
+#define QUERY_ID       (1<<4)
+#define QUERY_LEDN     (1<<5)
+#define QUERY_FRESH    (1<<6)
+#define QUERY_START    (1<<7)
+#define QUERY_END      (1<<8)
+#define QUERY_SAVE     (1<<9)
+#define QUERY_PATTERN  (1<<10)
+#define QUERY_AT       (1<<11)
+#define QUERY_EVERY    (1<<12)
+#define QUERY_CRON     (1<<13)
+
+typedef struct query_ {
+    uint32_t has;           // QUERY_ bits of the args given
+    uint16_t millis;        // from 'millis' or 'time'
+    rgb_t rgb;
+    int count;
+    int ledn;               // -1 if not a number
+    int fresh;              // given & not "0"
+    int start;
+    int end;
+    int save;
+    char id[query_id_max];
+    char pattern[query_pattern_max];
+    int patternlen;         // -2 if too long for pattern[]
+    char at[query_sched_max];     // schedule specs, as given
+    char every[query_sched_max];
+    char cron[query_sched_max];
+} query_t;
+
+/**
+ * Parse a query string into q.
+ * @return number of args recognized
+ */
+int query_parse( const struct mg_str* qs, query_t* q );
+
+#endif
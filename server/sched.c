@@ -0,0 +1,506 @@
+/*
+ * sched -- scheduled & recurring batches for blink1-tiny-server
+ *
+ * see sched.h
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mongoose.h"  // for mg_time()
+#include "batch.h"
+#include "sched.h"
+#include "pool.h"
+
+#define sched_bits       6      // log2(sched_slots)
+#define sched_span       (1LL << (sched_bits*sched_levels))  // ticks the wheels cover
+#define sched_catchup    (sched_slots*sched_slots)  // ticks to step through after a stall
+#define sched_dead_max   64     // dead journal lines over live ones before rewriting
+#define sched_line_max   (sched_body_max + sched_spec_max + 64)
+
+static sched_entry s_entries[sched_max];
+static int32_t s_free = -1;          // unused entries, linked through 'next'
+static int s_count = 0;
+static int s_last_id = 0;
+static int32_t s_wheel[sched_levels][sched_slots];  // first entry in slot, -1 = none
+static time_t s_tick = 0;            // next tick to do, 0 = wheels not started
+static batch_t s_batch;              // batches run one at a time, on the main loop
+
+static char s_path[256];             // journal
+static FILE* s_journal = NULL;
+static int s_dead = 0;               // journal lines for removed schedules
+
+//
+// set up the free list & wheels, the first time through
+static void sched_start(void)
+{
+    if( s_tick != 0 ) return;
+    if( s_free < 0 && s_count == 0 ) {
+        for( int i = sched_max-1; i >= 0; i-- ) {
+            s_entries[i].next = s_free;
+            s_free = i;
+        }
+    }
+    memset( s_wheel, 0xff, sizeof(s_wheel) );  // all -1
+    s_tick = time(NULL);
+}
+
+// put entry i in the slot for its due time, in the lowest wheel whose
+// span reaches it.  overdue entries go in the next tick's slot
+static void sched_link( int32_t i )
+{
+    sched_entry* e = &s_entries[i];
+    time_t due = (e->due > s_tick) ? e->due : s_tick;
+    if( due - s_tick >= sched_span ) due = s_tick + sched_span - 1;  // put back when cascaded
+    int64_t delta = due - s_tick;
+    int level = 0;
+    while( level < sched_levels-1 && delta >= (1LL << (sched_bits*(level+1))) ) level++;
+    e->level = level;
+    e->slot = (due >> (sched_bits*level)) & (sched_slots-1);
+    e->prev = -1;
+    e->next = s_wheel[e->level][e->slot];
+    if( e->next >= 0 ) s_entries[e->next].prev = i;
+    s_wheel[e->level][e->slot] = i;
+}
+
+//
+static void sched_unlink( int32_t i )
+{
+    sched_entry* e = &s_entries[i];
+    if( e->prev >= 0 ) s_entries[e->prev].next = e->next;
+    else s_wheel[e->level][e->slot] = e->next;
+    if( e->next >= 0 ) s_entries[e->next].prev = e->prev;
+}
+
+// relink everything, after the clock jumped
+static void sched_rewheel( time_t tick )
+{
+    memset( s_wheel, 0xff, sizeof(s_wheel) );
+    s_tick = tick;
+    for( int32_t i=0; i < sched_max; i++ ) {
+        if( s_entries[i].id ) sched_link( i );
+    }
+}
+
+// parse one cron field: "*", "5", "1-5", "*/15", "0-30/10" or a list of those
+static int cron_field( const char* s, int lo, int hi, uint64_t* bits )
+{
+    char* end;
+    *bits = 0;
+    while( *s ) {
+        int a = lo, b = hi, step = 1;
+        int single = 0;
+        if( *s == '*' ) {
+            s++;
+        } else {
+            a = b = strtol( s, &end, 10 );
+            if( end == s ) return -1;
+            s = end;
+            single = 1;
+            if( *s == '-' ) {
+                b = strtol( ++s, &end, 10 );
+                if( end == s ) return -1;
+                s = end;
+                single = 0;
+            }
+        }
+        if( *s == '/' ) {
+            step = strtol( ++s, &end, 10 );
+            if( end == s || step < 1 ) return -1;
+            s = end;
+            if( single ) b = hi;  // "5/15" is 5-hi/15, as in cron
+        }
+        if( a < lo || b > hi || a > b ) return -1;
+        for( int v=a; v <= b; v += step ) *bits |= 1ULL << v;
+        if( *s == ',' ) s++;
+        else if( *s ) return -1;
+    }
+    return 0;
+}
+
+// parse "min hour dom mon dow" or an @name into c
+static int cron_parse( const char* expr, sched_cron* c )
+{
+    const char* names[][2] = { { "@hourly", "0 * * * *" }, { "@daily", "0 0 * * *" },
+                               { "@midnight", "0 0 * * *" }, { "@weekly", "0 0 * * 0" },
+                               { "@monthly", "0 0 1 * *" }, { "@yearly", "0 0 1 1 *" } };
+    char buf[sched_spec_max];
+    char* fields[5];
+    char* save;
+    int n = 0;
+    uint64_t bits;
+
+    for( int i=0; i < (int)(sizeof(names)/sizeof(names[0])); i++ ) {
+        if( strcmp( expr, names[i][0] ) == 0 ) expr = names[i][1];
+    }
+    snprintf(buf, sizeof(buf), "%s", expr);
+    for( char* p = strtok_r(buf, " \t", &save); p; p = strtok_r(NULL, " \t", &save) ) {
+        if( n == 5 ) return -1;
+        fields[n++] = p;
+    }
+    if( n != 5 ) return -1;
+
+    memset( c, 0, sizeof(sched_cron) );
+    if( cron_field( fields[0], 0, 59, &bits ) < 0 ) return -1;
+    c->min = bits;
+    if( cron_field( fields[1], 0, 23, &bits ) < 0 ) return -1;
+    c->hour = bits;
+    if( cron_field( fields[2], 1, 31, &bits ) < 0 ) return -1;
+    c->dom = bits;
+    if( cron_field( fields[3], 1, 12, &bits ) < 0 ) return -1;
+    c->mon = bits;
+    if( cron_field( fields[4], 0, 7, &bits ) < 0 ) return -1;
+    if( bits & (1 << 7) ) bits |= 1;  // 7 is Sunday too
+    c->dow = bits & 0x7f;
+    // as in cron, if both day fields are restricted either may match
+    c->anyday = ( fields[2][0] == '*' || fields[4][0] == '*' );
+    return 0;
+}
+
+//
+static int cron_day( sched_cron* c, struct tm* tm )
+{
+    int dom = ( c->dom & (1u << tm->tm_mday) ) != 0;
+    int dow = ( c->dow & (1u << tm->tm_wday) ) != 0;
+    return (c->anyday) ? (dom && dow) : (dom || dow);
+}
+
+// @return first time after 'after' that c matches, local time, or -1 if none soon
+static time_t cron_next( sched_cron* c, time_t after )
+{
+    struct tm tm;
+    time_t t = after - (after % 60) + 60;  // next whole minute
+    time_t limit = after + 5*366*24*3600;  // Feb 30 never comes
+    localtime_r( &t, &tm );
+    while( t < limit ) {
+        if( !( c->mon & (1u << (tm.tm_mon+1)) ) ) {
+            tm.tm_mon++; tm.tm_mday = 1; tm.tm_hour = 0; tm.tm_min = 0;
+        } else if( !cron_day( c, &tm ) ) {
+            tm.tm_mday++; tm.tm_hour = 0; tm.tm_min = 0;
+        } else if( !( c->hour & (1u << tm.tm_hour) ) ) {
+            tm.tm_hour++; tm.tm_min = 0;
+        } else if( !( c->min & (1ULL << tm.tm_min) ) ) {
+            tm.tm_min++;
+        } else {
+            return t;
+        }
+        tm.tm_sec = 0;
+        tm.tm_isdst = -1;  // mktime() works out DST, and normalizes the rest
+        t = mktime( &tm );
+        if( t < 0 ) return -1;
+        localtime_r( &t, &tm );
+    }
+    return -1;
+}
+
+// @return e's next run after 'after', or -1 if there isn't one
+static time_t sched_next( sched_entry* e, time_t after )
+{
+    switch( e->type ) {
+    case SCHED_EVERY:
+        if( after < e->anchor ) return e->anchor + e->every;
+        return e->anchor + ( (after - e->anchor) / e->every + 1 ) * (time_t) e->every;
+    case SCHED_CRON:
+        return cron_next( &e->cron, after );
+    default:
+        return -1;
+    }
+}
+
+//
+static void sched_writeAdd( FILE* f, sched_entry* e )
+{
+    fprintf(f, "add\t%d\t%s\t%ld\t%s\t%s\n", e->id, sched_typestr(e->type),
+            (long) e->anchor, e->spec, e->body);
+}
+
+// append to the journal, if there is one
+static void sched_logAdd( sched_entry* e )
+{
+    if( s_journal == NULL ) return;
+    sched_writeAdd( s_journal, e );
+    fflush( s_journal );
+}
+
+//
+static void sched_logDel( int id )
+{
+    if( s_journal == NULL ) return;
+    fprintf(s_journal, "del\t%d\n", id);
+    fflush( s_journal );
+}
+
+// rewrite the journal with just the live schedules
+static void sched_compact(void)
+{
+    char tmp[sizeof(s_path) + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", s_path);
+    FILE* f = fopen( tmp, "w" );
+    if( f == NULL ) return;  // keep appending to the old one
+    for( int i=0; i < sched_max; i++ ) {
+        if( s_entries[i].id ) sched_writeAdd( f, &s_entries[i] );
+    }
+    if( fclose( f ) == 0 ) rename( tmp, s_path );
+    if( s_journal ) fclose( s_journal );
+    s_journal = fopen( s_path, "a" );
+    s_dead = 0;
+}
+
+// make a schedule, without journaling it.  anchor & id are from the
+// journal, or 0 for a new one.  returns its entry, or -1 on error
+static int32_t sched_new( schedType_t type, const char* spec, const char* body, int len,
+                          time_t anchor, int id, char* errstr, int errlen )
+{
+    char* end;
+    time_t now = time(NULL);
+    sched_entry e;
+    memset( &e, 0, sizeof(e) );
+    e.type = type;
+    e.anchor = (anchor) ? anchor : now;
+
+    if( strlen(spec) >= sched_spec_max ) {
+        snprintf(errstr, errlen, "schedule too long");
+        return -1;
+    }
+    if( len >= sched_body_max ) {
+        snprintf(errstr, errlen, "batch too big to schedule, max %d bytes", sched_body_max-1);
+        return -1;
+    }
+    switch( type ) {
+    case SCHED_AT:
+        e.due = strtoll( spec, &end, 10 );
+        if( end == spec || *end || e.due <= 0 ) {
+            snprintf(errstr, errlen, "bad 'at', want unix time or +secs");
+            return -1;
+        }
+        if( spec[0] == '+' ) e.due += now;
+        snprintf(e.spec, sizeof(e.spec), "%ld", (long) e.due);  // so a reload isn't relative
+        break;
+    case SCHED_EVERY:
+        e.every = strtol( spec, &end, 10 );
+        if( end == spec || *end || e.every < 1 ) {
+            snprintf(errstr, errlen, "bad 'every', want secs");
+            return -1;
+        }
+        snprintf(e.spec, sizeof(e.spec), "%d", e.every);
+        e.due = sched_next( &e, now );
+        break;
+    case SCHED_CRON:
+        if( cron_parse( spec, &e.cron ) < 0 ) {
+            snprintf(errstr, errlen, "bad 'cron', want 'min hour day month weekday'");
+            return -1;
+        }
+        snprintf(e.spec, sizeof(e.spec), "%s", spec);
+        e.due = sched_next( &e, now );
+        if( e.due < 0 ) {
+            snprintf(errstr, errlen, "'cron' never matches");
+            return -1;
+        }
+        break;
+    default:
+        snprintf(errstr, errlen, "no 'at', 'every' or 'cron'");
+        return -1;
+    }
+
+    sched_start();
+    if( s_free < 0 ) {
+        snprintf(errstr, errlen, "too many schedules, max %d", sched_max);
+        return -1;
+    }
+    e.body = pool_malloc( len + 1 );
+    if( e.body == NULL ) {
+        snprintf(errstr, errlen, "out of memory");
+        return -1;
+    }
+    for( int i=0; i < len; i++ ) {  // one line in the journal, whitespace is all JSON allows here
+        e.body[i] = (body[i] == '\n' || body[i] == '\r' || body[i] == '\t') ? ' ' : body[i];
+    }
+    e.body[len] = '\0';
+
+    int32_t i = s_free;
+    s_free = s_entries[i].next;
+    e.id = (id) ? id : ++s_last_id;
+    if( e.id > s_last_id ) s_last_id = e.id;
+    s_entries[i] = e;
+    sched_link( i );
+    s_count++;
+    return i;
+}
+
+// free entry i, already out of the wheel, & journal that
+static void sched_drop( int32_t i )
+{
+    sched_entry* e = &s_entries[i];
+    int id = e->id;
+    pool_free( e->body );
+    e->body = NULL;
+    e->id = 0;
+    e->next = s_free;
+    s_free = i;
+    s_count--;
+    sched_logDel( id );
+    if( s_journal && (s_dead += 2) > s_count + sched_dead_max ) sched_compact();
+}
+
+//
+int sched_init( const char* path )
+{
+    char line[sched_line_max];
+    char err[200];
+    snprintf(s_path, sizeof(s_path), "%s", path);
+
+    FILE* f = fopen( s_path, "r" );
+    while( f && fgets( line, sizeof(line), f ) ) {
+        char* fields[6];
+        int n = 0;
+        line[ strcspn(line, "\n") ] = '\0';
+        for( char* p = line; p && n < 6; n++ ) {
+            fields[n] = p;
+            p = strchr( p, '\t' );
+            if( p ) *p++ = '\0';
+        }
+        if( n == 2 && strcmp(fields[0], "del") == 0 ) {
+            sched_cancel( atoi(fields[1]) );  // not journaled, no file open yet
+        }
+        else if( n == 6 && strcmp(fields[0], "add") == 0 ) {
+            schedType_t type = (strcmp(fields[2], "at") == 0) ? SCHED_AT :
+                               (strcmp(fields[2], "every") == 0) ? SCHED_EVERY :
+                               (strcmp(fields[2], "cron") == 0) ? SCHED_CRON : SCHED_NONE;
+            if( sched_new( type, fields[4], fields[5], strlen(fields[5]),
+                           atol(fields[3]), atoi(fields[1]), err, sizeof(err) ) < 0 ) {
+                fprintf(stderr, "schedule %s in %s: %s\n", fields[1], s_path, err);
+            }
+        }
+    }
+    if( f ) fclose( f );
+
+    sched_compact();  // start from just what's live
+    if( s_journal == NULL ) return -1;
+    return s_count;
+}
+
+//
+int sched_add( schedType_t type, const char* spec, const char* body, int len,
+               char* errstr, int errlen )
+{
+    char err[200];
+    if( batch_parse( body, len, &s_batch, err, sizeof(err) ) < 0 ) {
+        snprintf(errstr, errlen, "%s", err);
+        return -1;
+    }
+    int32_t i = sched_new( type, spec, body, len, 0, 0, errstr, errlen );
+    if( i < 0 ) return -1;
+    sched_logAdd( &s_entries[i] );
+    return s_entries[i].id;
+}
+
+//
+int sched_cancel( int id )
+{
+    for( int32_t i=0; i < sched_max; i++ ) {
+        if( id > 0 && s_entries[i].id == id ) {
+            sched_unlink( i );
+            sched_drop( i );
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// run entry i's batch, then put it back in the wheel for its next time.
+// i has been taken out of the wheel
+static void sched_fire( int32_t i, time_t now )
+{
+    char err[200];
+    sched_entry* e = &s_entries[i];
+    e->runs++;
+    if( batch_parse( e->body, strlen(e->body), &s_batch, err, sizeof(err) ) < 0 ) {
+        fprintf(stderr, "schedule %d: %s\n", e->id, err);  // e.g. device unplugged
+    } else {
+        batch_run( &s_batch, 0 );  // nobody to tell how it went
+    }
+    // from now, so runs missed while stalled are run once, not all at once
+    e->due = sched_next( e, now );
+    if( e->due < 0 ) {
+        sched_drop( i );
+    } else {
+        sched_link( i );
+    }
+}
+
+// do one tick: move down wheel slots whose time has come, then run
+// what's in the bottom slot.  entries relinked from a slot always land
+// in a different one, so popping until it's empty is safe
+static void sched_tick( time_t now )
+{
+    int32_t i;
+    for( int level=1; level < sched_levels; level++ ) {
+        if( s_tick & ((1LL << (sched_bits*level)) - 1) ) break;
+        int slot = (s_tick >> (sched_bits*level)) & (sched_slots-1);
+        while( (i = s_wheel[level][slot]) >= 0 ) {
+            sched_unlink( i );
+            sched_link( i );
+        }
+    }
+    int slot = s_tick & (sched_slots-1);
+    while( (i = s_wheel[0][slot]) >= 0 ) {
+        sched_unlink( i );
+        if( s_entries[i].due > s_tick ) sched_link( i );  // not due after all
+        else sched_fire( i, now );
+    }
+    s_tick++;
+}
+
+//
+int sched_run(void)
+{
+    if( s_count == 0 ) {
+        s_tick = 0;  // restart from the clock when there's something to do
+        return -1;
+    }
+    time_t now = time(NULL);
+    if( now - s_tick > sched_catchup || s_tick - now > sched_catchup ) {
+        sched_rewheel( now );  // clock jumped, don't step through it
+    }
+    while( s_tick <= now && s_count > 0 ) {
+        sched_tick( now );
+    }
+    int wait = (int)( (s_tick - mg_time()) * 1000 ) + 1;
+    return (wait > 0) ? wait : 0;
+}
+
+//
+sched_entry* sched_get( int i )
+{
+    if( i < 0 || i >= sched_max || s_entries[i].id == 0 ) return NULL;
+    return &s_entries[i];
+}
+
+//
+sched_entry* sched_find( int id )
+{
+    for( int i=0; i < sched_max; i++ ) {
+        if( id > 0 && s_entries[i].id == id ) return &s_entries[i];
+    }
+    return NULL;
+}
+
+//
+int sched_count(void)
+{
+    return s_count;
+}
+
+//
+const char* sched_typestr( schedType_t type )
+{
+    switch( type ) {
+    case SCHED_AT:    return "at";
+    case SCHED_EVERY: return "every";
+    case SCHED_CRON:  return "cron";
+    default:          return "none";
+    }
+}
@@ -0,0 +1,125 @@
+/*
+ * sched -- scheduled & recurring batches for blink1-tiny-server
+ *
+ * A schedule runs a batch (see batch.h) at a time, every N seconds,
+ * or when a cron expression matches, so timed changes don't need an
+ * outside cron calling the server:
+ *
+ *   at=1767225600  at=+90           -- once, at a unix time or secs from now
+ *   every=300                       -- every 5 minutes, from when it was added
+ *   cron=0 9-17 * * 1-5             -- minute hour day-of-month month day-of-week,
+ *   cron=@daily                        local time, with lists, ranges & steps as cron;
+ *                                      @hourly @daily @weekly @monthly too
+ *
+ * Schedules live in a hierarchical timer wheel: sched_levels wheels of
+ * sched_slots slots, one-second ticks at the bottom.  Adding or removing
+ * a schedule is O(1), and a tick costs O(1) however many are waiting:
+ * it fires one bottom slot, and every sched_slots ticks moves one slot
+ * of the wheel above down a level.
+ *
+ * Each change is appended to a journal file, which is replayed at
+ * startup so schedules survive restarts.  The journal is rewritten with
+ * only the live schedules when it's mostly dead lines.  A one-shot whose
+ * time passed while the server was down runs once, late.
+ *
+ */
+
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef BLINK1_SERVER_SCHED_MAX
+#define sched_max        BLINK1_SERVER_SCHED_MAX
+#else
+#define sched_max        4096   // schedules at once
+#endif
+#define sched_body_max   2048   // bytes of batch JSON per schedule
+#define sched_spec_max   64     // bytes of at / every / cron spec
+#define sched_slots      64     // per wheel, power of 2
+#define sched_levels     4      // wheels, so ~194 days before clamping
+
+typedef enum {
+    SCHED_NONE = 0,
+    SCHED_AT,       // once
+    SCHED_EVERY,    // every 'every' secs after 'anchor'
+    SCHED_CRON      // when 'cron' matches
+} schedType_t;
+
+typedef struct sched_cron_ {
+    uint64_t min;           // bit per allowed minute, 0-59
+    uint32_t hour;          // 0-23
+    uint32_t dom;           // 1-31
+    uint16_t mon;           // 1-12
+    uint8_t dow;            // 0-6, Sunday = 0
+    uint8_t anyday;         // dom or dow is '*', so both must match
+} sched_cron;
+
+typedef struct sched_entry_ {
+    int id;                 // > 0 if in use
+    schedType_t type;
+    char spec[sched_spec_max];  // as given, for listing & the journal
+    time_t anchor;          // SCHED_EVERY: runs are anchor + k*every
+    int every;
+    sched_cron cron;
+    time_t due;             // next run
+    int runs;               // times run since added or loaded
+    char* body;             // batch JSON
+    int32_t next, prev;     // wheel slot list
+    uint8_t level, slot;
+} sched_entry;
+
+/**
+ * Load schedules from the journal, creating it if need be, and keep
+ * it up to date from then on.  Without this, schedules aren't saved.
+ * @param path journal file
+ * @return number of schedules loaded, or -1 if path can't be written
+ */
+int sched_init( const char* path );
+
+/**
+ * Add a schedule.
+ * @param type SCHED_AT, SCHED_EVERY or SCHED_CRON
+ * @param spec unix time or "+secs", secs, or cron expression
+ * @param body batch JSON, checked here and parsed again at each run
+ * @param errstr filled in with reason on failure
+ * @return schedule id, or -1 on error
+ */
+int sched_add( schedType_t type, const char* spec, const char* body, int len,
+               char* errstr, int errlen );
+
+/**
+ * Remove a schedule.
+ * @return 0 on success, -1 if no such schedule
+ */
+int sched_cancel( int id );
+
+/**
+ * Advance the wheel to now, running the batches that are due.
+ * Call this from the main loop.
+ * @return millis until the next tick, or -1 if nothing is scheduled
+ */
+int sched_run(void);
+
+/**
+ * @return schedule in slot i (0-sched_max), or NULL if slot unused
+ */
+sched_entry* sched_get( int i );
+
+/**
+ * @return schedule with id, or NULL if none
+ */
+sched_entry* sched_find( int id );
+
+/**
+ * @return number of schedules
+ */
+int sched_count(void);
+
+/**
+ * @return name of schedule type
+ */
+const char* sched_typestr( schedType_t type );
+
+#endif
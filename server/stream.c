@@ -0,0 +1,150 @@
+/*
+ * stream -- WebSocket color streaming for blink1-tiny-server
+ *
+ * see stream.h
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mongoose.h"
+#include "devmgr.h"
+#include "batch.h"
+#include "stream.h"
+#include "pool.h"
+#include "jsonw.h"
+
+static batch_op ops[stream_ops_max];  // only used from the event loop
+
+// parse a JSON frame into ops, returns number of ops or -1
+static int stream_parseText( const char* json, size_t len, unsigned long* seq,
+                             char* errstr, int errlen )
+{
+    json_value* jv = pool_jsonParse( json, len );
+    json_value* opsv = jv;
+    int n = 0;
+    if( jv && jv->type == json_object ) {
+        opsv = NULL;
+        for( unsigned int i=0; i < jv->u.object.length; i++ ) {
+            const char* name = jv->u.object.values[i].name;
+            json_value* v = jv->u.object.values[i].value;
+            if( strcmp(name, "seq") == 0 && v->type == json_integer ) *seq = v->u.integer;
+            if( strcmp(name, "ops") == 0 ) opsv = v;
+        }
+    }
+    if( opsv == NULL || opsv->type != json_array ) {
+        snprintf(errstr, errlen, "frame must be an object with seq & ops, or an array of ops");
+        n = -1;
+    }
+    else if( opsv->u.array.length > stream_ops_max ) {
+        snprintf(errstr, errlen, "too many ops, max %d", stream_ops_max);
+        n = -1;
+    }
+    for( unsigned int i=0; n >= 0 && i < opsv->u.array.length; i++ ) {
+        char operr[100];
+        if( batch_parseOp( opsv->u.array.values[i], &ops[n], operr, sizeof(operr) ) < 0 ) {
+            snprintf(errstr, errlen, "op %d: %s", i, operr);
+            n = -1;
+        }
+        else if( ops[n].delay ) {
+            snprintf(errstr, errlen, "op %d: no 'delay' on streams, use /blink1/batch", i);
+            n = -1;
+        }
+        else n++;
+    }
+    pool_jsonFree( jv );
+    return n;
+}
+
+// parse a binary frame into ops, returns number of ops or -1
+static int stream_parseBinary( const uint8_t* buf, size_t len, unsigned long* seq,
+                               char* errstr, int errlen )
+{
+    if( len < 4 || (len - 4) % 7 != 0 ) {
+        snprintf(errstr, errlen, "binary frame must be 4-byte seq + 7 bytes per update");
+        return -1;
+    }
+    *seq = ((unsigned long)buf[0]<<24) | (buf[1]<<16) | (buf[2]<<8) | buf[3];
+    int n = (len - 4) / 7;
+    if( n > stream_ops_max ) {
+        snprintf(errstr, errlen, "too many ops, max %d", stream_ops_max);
+        return -1;
+    }
+    for( int i=0; i < n; i++ ) {
+        const uint8_t* p = buf + 4 + i*7;
+        batch_op* bop = &ops[i];
+        memset( bop, 0, sizeof(batch_op) );
+        int d = devmgr_indexById( p[0] );
+        if( d < 0 ) {
+            snprintf(errstr, errlen, "op %d: unknown blink1 id", i);
+            return -1;
+        }
+        if( p[1] >= devmgr_leds_max ) {
+            snprintf(errstr, errlen, "op %d: bad ledn, must be 0-%d", i, devmgr_leds_max-1);
+            return -1;
+        }
+        bop->name = "fade";
+        devmgr_set_add( &bop->devs, d );
+        bop->ndevs = 1;
+        bop->op.type = DEVOP_FADE;
+        bop->op.ledn = p[1];
+        bop->op.r = p[2]; bop->op.g = p[3]; bop->op.b = p[4];
+        bop->op.millis = (p[5] << 8) | p[6];
+    }
+    return n;
+}
+
+//
+int stream_frame( struct mg_connection* nc, struct websocket_message* wm )
+{
+    char errstr[200];
+    char ack[300];
+    jsonw w;
+    unsigned long seq = 0;
+    int op = wm->flags & 0x0f;
+    int n;
+
+    if( op == WEBSOCKET_OP_TEXT ) {
+        n = stream_parseText( (const char*)wm->data, wm->size, &seq, errstr, sizeof(errstr) );
+    } else if( op == WEBSOCKET_OP_BINARY ) {
+        n = stream_parseBinary( wm->data, wm->size, &seq, errstr, sizeof(errstr) );
+    } else {
+        return 0;  // pings & such
+    }
+    jsonw_initCompact( &w, ack, sizeof(ack) );
+    jsonw_obj( &w );
+    jsonw_kint( &w, "ack", seq );
+    if( n < 0 ) {
+        jsonw_kstr( &w, "error", errstr );
+        jsonw_end( &w );
+        mg_send_websocket_frame( nc, WEBSOCKET_OP_TEXT, ack, w.len );
+        return -1;
+    }
+
+    int coalesced = 0, errors = 0, backlog = 0;
+    devmgr_set touched;
+    memset( &touched, 0, sizeof(touched) );
+    for( int i=0; i < n; i++ ) {
+        batch_op* bop = &ops[i];
+        for( int d=0; d < devmgr_max; d++ ) {
+            if( !devmgr_set_has( &bop->devs, d ) ) continue;
+            devmgr_set_add( &touched, d );
+            int rc = ( bop->op.type == DEVOP_FADE ) ?
+                devmgr_stream( d, &bop->op ) : devmgr_submit( d, &bop->op );
+            if( rc < 0 ) errors++;
+            else if( rc == 1 ) coalesced++;
+        }
+    }
+    for( int d=0; d < devmgr_max; d++ ) {
+        if( devmgr_set_has( &touched, d ) ) backlog += devmgr_streamBacklog( d );
+    }
+    jsonw_kint( &w, "ops", n );
+    jsonw_kint( &w, "coalesced", coalesced );
+    jsonw_kint( &w, "backlog", backlog );
+    jsonw_kint( &w, "errors", errors );
+    jsonw_end( &w );
+    mg_send_websocket_frame( nc, WEBSOCKET_OP_TEXT, ack, w.len );
+    return n;
+}
@@ -0,0 +1,41 @@
+/*
+ * stream -- WebSocket color streaming for blink1-tiny-server
+ *
+ * Clients connect to ws://host:port/blink1/ws and send frames of color
+ * updates, either JSON text:
+ *
+ *   {"seq":12, "ops":[ {"op":"fade", "id":0, "ledn":1, "rgb":"#ff0000", "millis":50},
+ *                      {"op":"set",  "id":[1,2], "rgb":"#00ff00"} ]}
+ *
+ * (ops as in batch.h, no "delay"), or binary:
+ *
+ *   4-byte big-endian seq, then 7 bytes per update:
+ *   device index, ledn, r, g, b, millis (2 bytes big-endian)
+ *
+ * Updates go to devmgr_stream() so each LED only keeps its latest color
+ * and devices are written as fast as they can take it, however fast the
+ * client sends.  Every frame is answered with a text ack:
+ *
+ *   {"ack":12, "ops":3, "coalesced":1, "backlog":2, "errors":0}
+ *
+ * 'coalesced' is updates in this frame that replaced one not yet
+ * written, 'backlog' is LEDs still waiting to be written on the frame's
+ * devices.  A client seeing these stay above zero is sending faster than
+ * its devices can keep up with and can slow down.
+ *
+ */
+
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include "mongoose.h"
+
+#define stream_ops_max   256  // updates per frame
+
+/**
+ * Apply a WebSocket frame of updates and send its ack.
+ * @return number of updates applied, or -1 if frame was bad
+ */
+int stream_frame( struct mg_connection* nc, struct websocket_message* wm );
+
+#endif
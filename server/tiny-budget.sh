@@ -0,0 +1,73 @@
+#!/bin/bash
+#
+# tiny-budget.sh -- check blink1-tiny-server's size & memory against a budget
+#
+# Usage: tiny-budget.sh [server] [port] [secs]
+#
+# Fails if the server binary is bigger than MAX_KB (stripped), or if the
+# server's peak RSS goes over MAX_RSS_KB while blink1-server-bench runs
+# BENCH_CONNS connections at it, or if it runs more than one thread.
+# Budgets are for the tiny profile, "make SERVER_PROFILE=tiny
+# blink1-tiny-server", see README.md.
+# Reads /proc, so Linux only.
+#
+# For a build with USBLIB_TYPE=HIDAPI_FAKE, set BLINK1_FAKE_DEVICES to
+# have something to talk to.
+#
+
+SERVER=${1:-./blink1-tiny-server}
+PORT=${2:-8099}
+SECS=${3:-5}
+MAX_KB=${MAX_KB:-160}
+MAX_RSS_KB=${MAX_RSS_KB:-3072}
+BENCH_CONNS=${BENCH_CONNS:-16}
+BENCH=${BENCH:-./blink1-server-bench}
+
+fail=0
+
+size=$(( $(stat -c %s "$SERVER") / 1024 ))
+if file "$SERVER" | grep -q "not stripped"; then
+    tmp=$(mktemp)
+    strip -o $tmp "$SERVER"
+    size=$(( $(stat -c %s $tmp) / 1024 ))
+    rm -f $tmp
+fi
+printf "binary:   %6d KB stripped  (budget %d KB)\n" $size $MAX_KB
+[ $size -gt $MAX_KB ] && fail=1
+
+"$SERVER" -p $PORT > /dev/null &
+pid=$!
+trap "kill $pid 2>/dev/null" EXIT
+sleep 0.5
+if ! kill -0 $pid 2>/dev/null; then
+    echo "server didn't start"
+    exit 1
+fi
+rss=$(awk '/VmRSS/ { print $2 }' /proc/$pid/status)
+printf "idle:     %6d KB RSS\n" $rss
+
+if [ -x "$BENCH" ]; then
+    "$BENCH" -h localhost:$PORT -c $BENCH_CONNS -t $SECS | tail -1
+else
+    echo "no $BENCH, loading with curl instead"
+    end=$(( $(date +%s) + SECS ))
+    while [ $(date +%s) -lt $end ]; do
+        curl -s "http://localhost:$PORT/blink1/fadeToRGB?rgb=%23ff00ff&millis=0" \
+             "http://localhost:$PORT/blink1/jobs" > /dev/null
+    done
+fi
+
+hwm=$(awk '/VmHWM/ { print $2 }' /proc/$pid/status)
+threads=$(awk '/Threads/ { print $2 }' /proc/$pid/status)
+printf "loaded:   %6d KB peak RSS  (budget %d KB), %d thread%s\n" \
+       $hwm $MAX_RSS_KB $threads $( [ $threads -eq 1 ] || echo s )
+[ $hwm -gt $MAX_RSS_KB ] && fail=1
+[ $threads -ne 1 ] && fail=1  # the tiny build has no device worker threads
+fails=$(curl -s http://localhost:$PORT/metrics | awk '/^blink1_pool_failures_total/ { print $2 }')
+if [ -n "$fails" ]; then
+    printf "pools:    %6d allocations failed\n" $fails
+    [ $fails -gt 0 ] && fail=1
+fi
+
+[ $fail -eq 0 ] && echo "within budget" || echo "OVER BUDGET"
+exit $fail
@@ -0,0 +1,94 @@
+/*
+ * unixsock -- serve blink1-tiny-server's HTTP API on a Unix domain socket
+ *
+ * see unixsock.h
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "unixsock.h"
+
+#ifdef _WIN32
+
+struct mg_connection* unixsock_bind( struct mg_mgr* mgr, const char* path, int mode,
+                                     mg_event_handler_t handler, const char** errstr )
+{
+    (void) mgr; (void) path; (void) mode; (void) handler;
+    *errstr = "Unix domain sockets not supported on this platform";
+    return NULL;
+}
+
+void unixsock_close( const char* path )
+{
+    (void) path;
+}
+
+#else
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+//
+struct mg_connection* unixsock_bind( struct mg_mgr* mgr, const char* path, int mode,
+                                     mg_event_handler_t handler, const char** errstr )
+{
+    struct sockaddr_un sun;
+    struct stat st;
+
+    if( strlen(path) >= sizeof(sun.sun_path) ) {
+        *errstr = "socket path too long";
+        return NULL;
+    }
+    memset( &sun, 0, sizeof(sun) );
+    sun.sun_family = AF_UNIX;
+    strcpy( sun.sun_path, path );
+
+    // left over from a previous run? don't clobber anything else
+    if( lstat( path, &st ) == 0 ) {
+        if( !S_ISSOCK(st.st_mode) ) {
+            *errstr = "path exists and isn't a socket";
+            return NULL;
+        }
+        unlink( path );
+    }
+
+    int sock = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( sock < 0 ) {
+        *errstr = strerror(errno);
+        return NULL;
+    }
+    // no window where the socket is open to everyone
+    mode_t oldmask = umask( 0777 & ~mode );
+    int rc = bind( sock, (struct sockaddr*) &sun, sizeof(sun) );
+    umask( oldmask );
+    if( rc < 0 || chmod( path, mode ) < 0 || listen( sock, SOMAXCONN ) < 0 ) {
+        *errstr = strerror(errno);
+        close( sock );
+        return NULL;
+    }
+
+    struct mg_connection* nc = mg_add_sock( mgr, sock, handler );  // sets non-blocking
+    if( nc == NULL ) {
+        *errstr = "out of memory";
+        close( sock );
+        unlink( path );
+        return NULL;
+    }
+    nc->flags |= MG_F_LISTENING;  // so mongoose accept()s on it
+    return nc;
+}
+
+//
+void unixsock_close( const char* path )
+{
+    struct stat st;
+    if( lstat( path, &st ) == 0 && S_ISSOCK(st.st_mode) ) unlink( path );
+}
+
+#endif
@@ -0,0 +1,39 @@
+/*
+ * unixsock -- serve blink1-tiny-server's HTTP API on a Unix domain socket
+ *
+ * For clients on the same host: no TCP loopback, no port to collide
+ * with, and who may connect is decided by the socket file's owner,
+ * group & mode.  e.g.:
+ *
+ *   blink1-tiny-server -s /run/blink1.sock -m 0660
+ *   curl --unix-socket /run/blink1.sock http://localhost/blink1/red
+ *
+ * Mongoose 6 only binds TCP & UDP, so the socket is made here and
+ * handed to mongoose as a listener; connections accepted on it are
+ * handled exactly like TCP ones.
+ *
+ */
+
+#ifndef __UNIXSOCK_H__
+#define __UNIXSOCK_H__
+
+#include "mongoose.h"
+
+#define unixsock_mode_default  0660
+
+/**
+ * Listen on a Unix domain socket at path.  A stale socket file left
+ * there is replaced, anything else at path is an error.
+ * @param mode permissions for the socket file, e.g. 0660
+ * @param errstr set to reason on failure
+ * @return listening connection, or NULL on error
+ */
+struct mg_connection* unixsock_bind( struct mg_mgr* mgr, const char* path, int mode,
+                                     mg_event_handler_t handler, const char** errstr );
+
+/**
+ * Remove the socket file, call on shutdown.
+ */
+void unixsock_close( const char* path );
+
+#endif